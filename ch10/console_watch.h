@@ -0,0 +1,105 @@
+/*
+ * ch10/console_watch.h
+ ***********************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Debugging"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+ *
+ * From: Ch 10 : Kernel panic, lockups and hangs
+ ************************************************************************
+ * Brief Description:
+ * Timestamp *when* the kernel emits a given diagnostic - the soft/hard lockup
+ * detectors, RCU stall warnings, the workqueue watchdog, etc - by hooking
+ * into the 'console' tracepoint (fired for every printk) and matching the
+ * message text against a small table of substrings. The first hit for each
+ * pattern is timestamped with the NMI-safe ktime_get_mono_fast_ns() clock.
+ *
+ * We look the tracepoint up by name (it isn't exported to modules), so the
+ * module must be GPL-compatible.
+ *
+ * Caveat: on kernels older than 5.15, printk's issued from NMI context (the
+ * hard lockup detector!) are deferred to a per-CPU buffer and only stored -
+ * and thus seen here - once IRQs are re-enabled on that CPU.
+ *
+ * Usage:
+ *  static struct cw_pattern pats[] = {
+ *	{ .substr = "soft lockup", .label = "soft lockup detector" },
+ *  };
+ *  console_watch_start(pats, ARRAY_SIZE(pats));
+ *  ...
+ *  if (pats[0].first_ns) ...  // ns timestamp of the first match, else 0
+ *  console_watch_stop();
+ * Only one watch per module (we keep the table pointer in static state).
+ */
+#ifndef __LKD_CONSOLE_WATCH_H__
+#define __LKD_CONSOLE_WATCH_H__
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/atomic.h>
+#include <linux/timekeeping.h>
+#include <linux/tracepoint.h>
+
+struct cw_pattern {
+	const char *substr;	/* match this within the printk text */
+	const char *label;	/* what to call it when reporting */
+	u64 first_ns;		/* ktime_get_mono_fast_ns() of the first match */
+	atomic_t hits;
+};
+
+static struct cw_pattern *cw_pats;
+static int cw_npats;
+static struct tracepoint *cw_tp;
+
+/* The tracepoint probe; may well run in NMI context, so: lockless, no printk */
+static void cw_probe(void *data, const char *text, size_t len)
+{
+	u64 now = ktime_get_mono_fast_ns();
+	int i;
+
+	for (i = 0; i < cw_npats; i++) {
+		if (!strnstr(text, cw_pats[i].substr, len))
+			continue;
+		if (atomic_inc_return(&cw_pats[i].hits) == 1)
+			WRITE_ONCE(cw_pats[i].first_ns, now);
+	}
+}
+
+static void cw_find_tp(struct tracepoint *tp, void *priv)
+{
+	if (!strcmp(tp->name, "console"))
+		cw_tp = tp;
+}
+
+static int console_watch_start(struct cw_pattern *pats, int npats)
+{
+	int i;
+
+	for (i = 0; i < npats; i++) {
+		pats[i].first_ns = 0;
+		atomic_set(&pats[i].hits, 0);
+	}
+	cw_pats = pats;
+	cw_npats = npats;
+
+	for_each_kernel_tracepoint(cw_find_tp, NULL);
+	if (!cw_tp) {
+		pr_warn("console tracepoint not found; can't watch for messages\n");
+		return -ENOENT;
+	}
+	return tracepoint_probe_register(cw_tp, (void *)cw_probe, NULL);
+}
+
+static void console_watch_stop(void)
+{
+	if (!cw_tp)
+		return;
+	tracepoint_probe_unregister(cw_tp, (void *)cw_probe, NULL);
+	tracepoint_synchronize_unregister();
+	cw_tp = NULL;
+}
+
+#endif   /* #ifndef __LKD_CONSOLE_WATCH_H__ */
@@ -14,6 +14,22 @@
  * Added buggy code to deliberately spin on the CPU, in order to kick the
  * kernel watchdog into action and detect the softlockup caused!
  *
+ * It's now a (small) harness to measure lockup detection latency: we hold
+ * the CPU(s) for a precise duration ('hold_ms') in one of three ways:
+ *  lockup_type=1 : preemption disabled (spin_lock()); trips the soft lockup
+ *                  detector (and RCU stall warnings)
+ *  lockup_type=2 : IRQs disabled as well (spin_lock_irq()); trips the hard
+ *                  lockup (NMI) detector
+ *  lockup_type=3 : as 2, but 'NMI-safe': no lock and no printk at all while
+ *                  holding, only the NMI-safe mono clock is read (via the
+ *                  spin_ms() busy-wait in convenient.h)
+ * on the CPUs given via 'cpus' (one kthread bound to each). Meanwhile we
+ * timestamp when the soft/hard lockup detectors and the RCU stall detector
+ * report (see ../console_watch.h) and, once all holds complete (and again
+ * on rmmod), report how long after the start of the hold each fired. F.e.:
+ *  sudo insmod ./kthread_stuck.ko lockup_type=1 hold_ms=30000 cpus=1
+ * Use it to tune kernel.watchdog_thresh and friends for your configs.
+ *
  * Original comment:
  * A simple LKM to demo delays and sleeps in the kernel.
  *
@@ -30,28 +46,97 @@
 #include <linux/kthread.h>
 #include <asm/atomic.h>
 #include <linux/spinlock.h>
+#include <linux/cpumask.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
 #include "../../convenient.h"
+#include "../console_watch.h"
 
 #define KTHREAD_NAME	"kt_stuck"
 #define DO_SOFT_LOCKUP  1
 #define DO_HARD_LOCKUP  2
+#define DO_HARD_LOCKUP_NMISAFE  3
 
 MODULE_AUTHOR("[insert name]");
-MODULE_DESCRIPTION("a simple LKM to demo the kernel softlockup detector!");
+MODULE_DESCRIPTION("a simple LKM to demo (and time) the kernel soft/hard lockup detectors!");
 MODULE_LICENSE("Dual MIT/GPL");	// or whatever
-MODULE_VERSION("0.1");
+MODULE_VERSION("0.2");
 
 static int lockup_type = DO_SOFT_LOCKUP;
 module_param(lockup_type, int, 0);
-MODULE_PARM_DESC(lockup_type, "specify the lockup type; pass 1 for soft lockup (default), 2 for hard lockup");
+MODULE_PARM_DESC(lockup_type, "specify the lockup type; pass 1 for soft lockup (default), 2 for hard lockup, 3 for hard lockup (NMI-safe)");
+
+static uint hold_ms = 25000;
+module_param(hold_ms, uint, 0);
+MODULE_PARM_DESC(hold_ms, "how long to hold the CPU, in ms (default 25000; > 2 * watchdog_thresh trips the soft lockup detector)");
+
+static char *cpus;
+module_param(cpus, charp, 0);
+MODULE_PARM_DESC(cpus, "CPU list to hold, f.e. \"1\" or \"1,3-4\"; one kthread per CPU (default: a single unbound kthread)");
+
+static struct stuck_thr {
+	struct task_struct *ts;
+	spinlock_t spinlock;
+	int cpu;		/* -1 : unbound */
+	u64 t_start, t_end;	/* ktime_get_mono_fast_ns() */
+} *gthr;
+static int gnthr;
+static atomic_t nholding;
+
+/* What we watch the kernel log for */
+static struct cw_pattern watch[] = {
+	{ .substr = "soft lockup", .label = "soft lockup detector" },
+	{ .substr = "hard LOCKUP", .label = "hard lockup detector" },
+	{ .substr = "self-detected stall", .label = "RCU stall (self-detected)" },
+	{ .substr = "detected stalls on CPU", .label = "RCU stall (detected by another CPU)" },
+};
+static bool watching;
 
-static struct task_struct *gkthrd_ts;
-static spinlock_t spinlock;
+static const char *lockup_name(int type)
+{
+	switch (type) {
+	case DO_SOFT_LOCKUP:
+		return "soft: preemption off";
+	case DO_HARD_LOCKUP:
+		return "hard: IRQs off";
+	case DO_HARD_LOCKUP_NMISAFE:
+		return "hard: IRQs off, NMI-safe";
+	}
+	return "?";
+}
+
+static void report_detection(void)
+{
+	u64 t0 = U64_MAX;
+	int i;
+
+	for (i = 0; i < gnthr; i++) {
+		if (!gthr[i].t_start)
+			continue;
+		t0 = min(t0, gthr[i].t_start);
+		pr_info(" cpu %3d: held for %llu ms (asked for %u ms)\n", gthr[i].cpu,
+			gthr[i].t_end ? (gthr[i].t_end - gthr[i].t_start) / NSEC_PER_MSEC : 0,
+			hold_ms);
+	}
+	if (!watching || t0 == U64_MAX)
+		return;
+	for (i = 0; i < ARRAY_SIZE(watch); i++) {
+		u64 t = READ_ONCE(watch[i].first_ns);
+
+		if (t)
+			pr_info(" %-36s: fired %lld ms after the hold began (%d msgs)\n",
+				watch[i].label, ((s64)t - (s64)t0) / (s64)NSEC_PER_MSEC,
+				atomic_read(&watch[i].hits));
+		else
+			pr_info(" %-36s: not seen (yet)\n", watch[i].label);
+	}
+}
 
 /* Our simple kernel thread. */
 static int simple_kthread(void *arg)
 {
-	u64 i = 0;
+	struct stuck_thr *thr = arg;
+	unsigned long flags;
 
 	PRINT_CTX();
 	if (!current->mm)
@@ -64,27 +149,41 @@ static int simple_kthread(void *arg)
 	allow_signal(SIGINT);
 	allow_signal(SIGQUIT);
 
-	while(!kthread_should_stop()) {
-		//------------------------------------
-		pr_info("DELIBERATELY spinning on CPU core now...\n");
-
-		if (lockup_type == DO_SOFT_LOCKUP)
-			spin_lock(&spinlock);
-		else
-			spin_lock_irq(&spinlock);
+	//------------------------------------
+	pr_info("DELIBERATELY holding CPU %d for %u ms now (%s)...\n",
+		raw_smp_processor_id(), hold_ms, lockup_name(lockup_type));
 
-		while (i < 10000000000) { // adjust these arbit #s for your system if reqd..
-			i ++;
-			if (!(i%50000000))
-				PRINT_CTX();
-		}
+	switch (lockup_type) {
+	case DO_SOFT_LOCKUP:
+		spin_lock(&thr->spinlock);
+		thr->t_start = ktime_get_mono_fast_ns();
+		spin_ms(hold_ms);	/* spinlock held, preemption off; no printk */
+		thr->t_end = ktime_get_mono_fast_ns();
+		spin_unlock(&thr->spinlock);
+		break;
+	case DO_HARD_LOCKUP:
+		spin_lock_irq(&thr->spinlock);
+		thr->t_start = ktime_get_mono_fast_ns();
+		spin_ms(hold_ms);	/* spinlock held, irqs off; no printk */
+		thr->t_end = ktime_get_mono_fast_ns();
+		spin_unlock_irq(&thr->spinlock);
+		break;
+	case DO_HARD_LOCKUP_NMISAFE:
+		local_irq_save(flags);
+		thr->t_start = ktime_get_mono_fast_ns();
+		spin_ms(hold_ms);	/* irqs off, no lock held; no printk */
+		thr->t_end = ktime_get_mono_fast_ns();
+		local_irq_restore(flags);
+		break;
+	}
+	//------------------------------------
 
-		if (lockup_type == DO_SOFT_LOCKUP)
-			spin_unlock(&spinlock);
-		else
-			spin_unlock_irq(&spinlock);
-		//------------------------------------
+	if (atomic_dec_and_test(&nholding)) {
+		pr_info("all holds done:\n");
+		report_detection();
+	}
 
+	while (!kthread_should_stop()) {
 		pr_info("FYI, I, kernel thread PID %d, am going to sleep now...\n",
 		    current->pid);
 		set_current_state(TASK_INTERRUPTIBLE);
@@ -104,50 +203,109 @@ static int simple_kthread(void *arg)
 	return 0;
 }
 
+static void stop_kthreads(int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		kthread_stop(gthr[i].ts);
+			/* waits for our kthread to terminate */
+		put_task_struct(gthr[i].ts);
+	}
+}
+
 static int kthread_simple_init(void)
 {
-	int ret=0;
+	cpumask_var_t mask;
+	int ret = 0, cpu, i = 0;
 
-	if (lockup_type != DO_SOFT_LOCKUP && lockup_type != DO_HARD_LOCKUP) {
+	if (lockup_type < DO_SOFT_LOCKUP || lockup_type > DO_HARD_LOCKUP_NMISAFE) {
 		pr_info("pass parameter lockup_type correctly\n");
 		return -EINVAL;
 	}
-	pr_info("lockup type to test: %s\n", lockup_type == DO_HARD_LOCKUP ? "hard":"soft");
+	pr_info("lockup type to test: %s, for %u ms\n", lockup_name(lockup_type), hold_ms);
 
-	spin_lock_init(&spinlock);
-	pr_info("Lets now create a kernel thread...\n");
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+	if (cpus) {
+		ret = cpulist_parse(cpus, mask);
+		cpumask_and(mask, mask, cpu_online_mask);
+		if (ret || cpumask_empty(mask)) {
+			pr_info("pass parameter cpus correctly (a list of online CPUs)\n");
+			ret = -EINVAL;
+			goto out;
+		}
+		gnthr = cpumask_weight(mask);
+	} else
+		gnthr = 1;
 
-	/*
-	 * kthread_run(threadfn, data, namefmt, ...)
-	 * - it's just a thin wrapper over the kthread_create() API
-	 * The 2nd arg is any (void * arg) to pass to the just-born kthread,
-	 * and the return value is the task struct pointer on success
-	 */
-	gkthrd_ts = kthread_run(simple_kthread, NULL, "lkd/%s", KTHREAD_NAME);
-	if (IS_ERR(gkthrd_ts)) {
-		ret = PTR_ERR(gkthrd_ts); // it's usually -ENOMEM
-		pr_err("kthread creation failed (%d)\n", ret);
-		return ret;
+	gthr = kcalloc(gnthr, sizeof(struct stuck_thr), GFP_KERNEL);
+	if (!gthr) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < gnthr; i++) {
+		spin_lock_init(&gthr[i].spinlock);
+		gthr[i].cpu = -1;
 	}
-	get_task_struct(gkthrd_ts); /* increment the kthread task structure's
-				      * reference count, marking it as being
-				      * in use
-				      */
-	pr_info("Initialized, kernel thread task ptr is 0x%pK (actual=0x%px)\n"
-	"See the new kernel thread 'lkd/%s' with ps (and kill it with SIGINT or SIGQUIT)\n",
-		gkthrd_ts, gkthrd_ts, KTHREAD_NAME);
-
-	return 0;		// success
+	i = 0;
+	if (cpus)
+		for_each_cpu(cpu, mask)
+			gthr[i++].cpu = cpu;
+
+	watching = !console_watch_start(watch, ARRAY_SIZE(watch));
+	atomic_set(&nholding, gnthr);
+	pr_info("Lets now create %d kernel thread(s)...\n", gnthr);
+
+	for (i = 0; i < gnthr; i++) {
+		/*
+		 * kthread_create(threadfn, data, namefmt, ...)
+		 * The 2nd arg is any (void * arg) to pass to the just-born kthread,
+		 * and the return value is the task struct pointer on success
+		 */
+		if (gthr[i].cpu >= 0)
+			gthr[i].ts = kthread_create(simple_kthread, &gthr[i], "lkd/%s/%d",
+						    KTHREAD_NAME, gthr[i].cpu);
+		else
+			gthr[i].ts = kthread_create(simple_kthread, &gthr[i], "lkd/%s",
+						    KTHREAD_NAME);
+		if (IS_ERR(gthr[i].ts)) {
+			ret = PTR_ERR(gthr[i].ts); // it's usually -ENOMEM
+			pr_err("kthread creation failed (%d)\n", ret);
+			stop_kthreads(i);
+			if (watching)
+				console_watch_stop();
+			kfree(gthr);
+			goto out;
+		}
+		get_task_struct(gthr[i].ts); /* increment the kthread task structure's
+					      * reference count, marking it as being
+					      * in use
+					      */
+		if (gthr[i].cpu >= 0)
+			kthread_bind(gthr[i].ts, gthr[i].cpu);
+		wake_up_process(gthr[i].ts);
+		pr_info("Initialized, kernel thread task ptr is 0x%pK (actual=0x%px)\n",
+			gthr[i].ts, gthr[i].ts);
+	}
+	pr_info("See the new kernel thread(s) 'lkd/%s[/<cpu>]' with ps (and kill them with SIGINT or SIGQUIT)\n",
+		KTHREAD_NAME);
+ out:
+	free_cpumask_var(mask);
+	return ret;
 }
 
 static void kthread_simple_exit(void)
 {
-	kthread_stop(gkthrd_ts);
-			/* waits for our kthread to terminate; it also
-			 * internally invokes the put_task_struct() to
-			 * decrement task's reference count
-			 */
-	pr_info("kthread stopped, and LKM removed.\n");
+	stop_kthreads(gnthr);
+	if (watching) {
+		/* some reports can arrive after the hold ends; show the final tally */
+		pr_info("final detection report:\n");
+		report_detection();
+		console_watch_stop();
+	}
+	kfree(gthr);
+	pr_info("kthread(s) stopped, and LKM removed.\n");
 }
 
 module_init(kthread_simple_init);
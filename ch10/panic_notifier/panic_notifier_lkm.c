@@ -16,12 +16,62 @@
  * type of notifier chain). Thus, our custom panic handler will be invoked upon
  * kernel panic.
  *
+ * Our panic handler is also a crash recorder: it snapshots a bounded binary
+ * record (see panic_rec.h) - the panic string, the panicking task and its
+ * stack, a few key counters and the last PREC_NEVENTS events from our event
+ * ring - into a reserved region of RAM that survives a warm reboot. After the
+ * reboot, the panic_rec_reader module recovers it; post-mortem data without
+ * having to set up (and wait for) a full kdump.
+ * At panic time we do no allocation and take no locks; the event ring is
+ * lock-free as well, so other modules can log to it (panic_rec_log()) from
+ * any context.
+ *
+ * Reserve the region via the kernel command line, f.e. on x86:
+ *   memmap=1M$0x7f000000
+ * (or a 'reserved-memory' DT node) and pass it to both modules:
+ *   insmod panic_notifier_lkm.ko rec_phys=0x7f000000 rec_size=0x100000
+ * With no region given we record into a kernel buffer; that's only useful
+ * when looking at a kdump/crash image.
+ * Note: by the time the panic notifiers run, panic() has already stopped the
+ * other CPUs; so it's only the panicking CPU's stack that we can safely walk.
+ *
+ * After the record, the rest of the region receives the tail of the kernel
+ * log (up to 'kmsg_tail_kb'), LZ4-compressed - with a preallocated context -
+ * within a time budget of 'zbudget_us'. Boot with ftrace_dump_on_oops and
+ * this includes the ftrace buffers. A console is slow (and a headless box has
+ * none); this gets far more post-mortem text into a fixed-size region.
+ * This part needs CONFIG_LZ4_COMPRESS (and the reader, CONFIG_LZ4_DECOMPRESS);
+ * without it, the module builds and records as usual, just without the tail.
+ *
+ * Slow panic notifiers delay the reboot; with time_notifiers=1 (the default)
+ * we time each one at panic - see prec_timing_handler() - and save the
+ * timings in the record. <debugfs>/panic_notifier_lkm/notifiers is a dry run:
+ * it lists the chain in call order, with priorities, without calling any.
+ *
  * For details, please refer the book, Ch 10.
  */
 #define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/delay.h>
+#include <linux/io.h>
+#include <linux/vmalloc.h>
+#include <linux/atomic.h>
+#include <linux/sched.h>
+#include <linux/sched/clock.h>
+#include <linux/stacktrace.h>
+#include <linux/timekeeping.h>
+#include <linux/utsname.h>
+#include <linux/vmstat.h>
+#include <linux/log2.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/rcupdate.h>
+#include <linux/uaccess.h>
+#include <linux/kmsg_dump.h>
+#include <linux/lz4.h>
+#include "panic_rec.h"
 
 // see kernel commit f39650de687e35766572ac89dbcd16a5911e2f0a
 #include <linux/version.h>
@@ -33,6 +83,253 @@
 
 /* The atomic_notifier_chain_[un]register() api's are GPL-exported! */
 MODULE_LICENSE("Dual MIT/GPL");
+MODULE_DESCRIPTION("LKD book:ch10/panic_notifier: panic notifier + persistent crash recorder");
+
+static unsigned long rec_phys;
+module_param(rec_phys, ulong, 0444);
+MODULE_PARM_DESC(rec_phys, "Physical address of the reserved region to record into (default 0: a kernel buffer, not persistent)");
+
+static unsigned long rec_size;
+module_param(rec_size, ulong, 0444);
+MODULE_PARM_DESC(rec_size, "Size of the reserved region, in bytes");
+
+static unsigned int kmsg_tail_kb = 256;
+module_param(kmsg_tail_kb, uint, 0444);
+MODULE_PARM_DESC(kmsg_tail_kb, "How much of the tail of the kernel log to compress into the region at panic, in KB (default 256, max 1024; 0 to disable)");
+
+static unsigned int zbudget_us = 20000;
+module_param(zbudget_us, uint, 0444);
+MODULE_PARM_DESC(zbudget_us, "Time budget for compressing the log tail at panic, in us (default 20000)");
+
+static bool time_notifiers = true;
+module_param(time_notifiers, bool, 0444);
+MODULE_PARM_DESC(time_notifiers, "Time every panic notifier at panic and save the timings in the record (default 1)");
+
+static void *region;			/* the whole region */
+static size_t region_size;
+static bool region_mapped;		/* memremap()'ed, else vmalloc()'ed */
+static struct prec_record *prec;	/* where we record */
+static atomic_t prec_written;
+
+/* The event ring; always in kernel memory, copied into the record at panic */
+static struct prec_event prec_ring[PREC_NEVENTS];
+static atomic64_t prec_head;		/* seq # of the last event logged */
+static atomic64_t prec_ctrs[PREC_NCOUNTERS];
+
+/* The compressed log tail: where it goes, and what we need to produce it */
+static struct prec_zdump *pzd;
+static size_t pzd_space;		/* room for pzd->data[] */
+static char *pz_raw, *pz_bounce;
+static size_t pz_raw_size;
+static void *pz_wrkmem;			/* the LZ4 compression context */
+
+static struct dentry *prec_dbgfs_dir;
+
+/*
+ * Log an event. Each slot's 'seq' is zeroed while it's written and set to the
+ * event's (1-based) sequence number once done; the snapshot only takes slots
+ * whose seq is what it expects. Wait-free: a writer lapping the ring can at
+ * worst cause the (torn) slot to be dropped from the record.
+ */
+void panic_rec_log(u32 id, u64 arg, const char *msg)
+{
+	u64 seq = atomic64_inc_return(&prec_head);
+	struct prec_event *e = &prec_ring[(seq - 1) & (PREC_NEVENTS - 1)];
+
+	WRITE_ONCE(e->seq, 0);
+	smp_wmb();
+	e->ts_ns = local_clock();
+	e->cpu = raw_smp_processor_id();
+	e->id = id;
+	e->arg = arg;
+	strscpy(e->msg, msg ? msg : "", sizeof(e->msg));
+	smp_store_release(&e->seq, seq);
+}
+EXPORT_SYMBOL_GPL(panic_rec_log);
+
+void panic_rec_counter_set(unsigned int idx, u64 val)
+{
+	if (idx >= PREC_CTR_FIRST_USER && idx < PREC_NCOUNTERS)
+		atomic64_set(&prec_ctrs[idx], val);
+}
+EXPORT_SYMBOL_GPL(panic_rec_counter_set);
+
+void panic_rec_counter_add(unsigned int idx, u64 delta)
+{
+	if (idx >= PREC_CTR_FIRST_USER && idx < PREC_NCOUNTERS)
+		atomic64_add(delta, &prec_ctrs[idx]);
+}
+EXPORT_SYMBOL_GPL(panic_rec_counter_add);
+
+/* Copy the last (up to) PREC_NEVENTS intact events into the record, oldest first */
+static void prec_snapshot_events(struct prec_record *rec)
+{
+	u64 head = atomic64_read(&prec_head), s;
+	u32 n = 0;
+
+	for (s = head > PREC_NEVENTS ? head - PREC_NEVENTS + 1 : 1; s <= head; s++) {
+		struct prec_event *e = &prec_ring[(s - 1) & (PREC_NEVENTS - 1)];
+
+		if (smp_load_acquire(&e->seq) != s)
+			continue;
+		rec->events[n] = *e;
+		smp_rmb();
+		if (READ_ONCE(e->seq) != s)	/* overwritten while we copied */
+			continue;
+		n++;
+	}
+	rec->nr_events = n;
+}
+
+/* The CRC, and only then the magic: the reader trusts nothing without both */
+static void prec_seal(struct prec_record *rec)
+{
+	WRITE_ONCE(rec->magic, 0);
+	wmb();
+	rec->crc = prec_crc(rec);
+	wmb();
+	WRITE_ONCE(rec->magic, PREC_MAGIC);
+	wmb();
+}
+
+/*
+ * Write the crash record. Runs in panic context: all other CPUs are stopped,
+ * IRQs are off. So: no locks, no allocation, nothing that might sleep.
+ */
+static void prec_write(const char *panic_str)
+{
+	struct prec_record *rec = prec;
+	unsigned long entries[PREC_STACK_DEPTH];
+	unsigned int i, nr;
+
+	if (!rec || atomic_xchg(&prec_written, 1))
+		return;
+
+	/* invalidate any older record while we overwrite it */
+	WRITE_ONCE(rec->magic, 0);
+	wmb();
+	memset(&rec->crc, 0, sizeof(*rec) - offsetof(struct prec_record, crc));
+
+	rec->version = PREC_VERSION;
+	rec->size = sizeof(*rec);
+	rec->panic_ts_ns = local_clock();
+	rec->panic_wall_sec = ktime_get_real_seconds();
+	rec->panic_cpu = raw_smp_processor_id();
+	rec->panic_pid = current->pid;
+	strscpy(rec->panic_comm, current->comm, sizeof(rec->panic_comm));
+	strscpy(rec->panic_str, panic_str ? panic_str : "", sizeof(rec->panic_str));
+	strscpy(rec->release, init_utsname()->release, sizeof(rec->release));
+	rec->panic_fn_addr = (unsigned long)panic;
+
+	for (i = PREC_CTR_FIRST_USER; i < PREC_NCOUNTERS; i++)
+		rec->counters[i] = atomic64_read(&prec_ctrs[i]);
+	rec->counters[PREC_CTR_JIFFIES] = jiffies;
+	rec->counters[PREC_CTR_UPTIME_MS] = ktime_get_mono_fast_ns() / NSEC_PER_MSEC;
+	rec->counters[PREC_CTR_FREE_PAGES] = global_zone_page_state(NR_FREE_PAGES);
+	rec->counters[PREC_CTR_ONLINE_CPUS] = num_online_cpus();
+	rec->counters[PREC_CTR_EVENTS_LOGGED] = atomic64_read(&prec_head);
+
+	nr = stack_trace_save(entries, PREC_STACK_DEPTH, 0);
+	for (i = 0; i < nr; i++)
+		rec->stack[i] = entries[i];
+	rec->nr_stack = nr;
+
+	prec_snapshot_events(rec);
+	prec_seal(rec);
+}
+
+/*
+ * The compressed log tail. We hook in as a kmsg dumper, not as a (second)
+ * panic notifier: panic() calls kmsg_dump(KMSG_DUMP_PANIC) right after the
+ * panic notifier chain. So, booting with ftrace_dump_on_oops, the ftrace
+ * ring buffers - dumped by the tracing panic notifier (trace_panic_handler())
+ * into the kernel log - are in the text we compress too.
+ */
+static size_t prec_kmsg_tail(struct kmsg_dumper *dumper)
+{
+	size_t len = 0;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 13, 0)
+	struct kmsg_dump_iter iter;
+
+	kmsg_dump_rewind(&iter);
+	kmsg_dump_get_buffer(&iter, false, pz_raw, pz_raw_size, &len);
+#else
+	kmsg_dump_rewind(dumper);
+	kmsg_dump_get_buffer(dumper, false, pz_raw, pz_raw_size, &len);
+#endif
+	return len;	/* kmsg_dump_get_buffer() fetches the *newest* text that fits */
+}
+
+/*
+ * Compress @len bytes of log text, newest first, chunk by chunk, until we're
+ * done, out of space or out of time (zbudget_us). Panic context, as above.
+ */
+static void prec_zdump_write(size_t len)
+{
+	struct prec_zdump *z = pzd;
+	u64 t0 = ktime_get_mono_fast_ns(), budget = (u64)zbudget_us * NSEC_PER_USEC;
+	size_t end = len;
+	u32 off = 0, n = 0;
+
+	if (!IS_ENABLED(CONFIG_LZ4_COMPRESS))	/* compiles the LZ4 call out */
+		return;
+	WRITE_ONCE(z->magic, 0);
+	wmb();
+	memset(&z->crc, 0, sizeof(*z) - offsetof(struct prec_zdump, crc));
+	z->version = PREC_ZVERSION;
+	z->hdr_size = sizeof(*z);
+	z->budget_us = zbudget_us;
+
+	while (end && n < PREC_ZMAX_CHUNKS) {
+		size_t start = end > PREC_ZCHUNK_RAW ? end - PREC_ZCHUNK_RAW : 0;
+		int zlen;
+
+		if (ktime_get_mono_fast_ns() - t0 > budget)
+			break;
+		zlen = LZ4_compress_default(pz_raw + start, pz_bounce, end - start,
+					    LZ4_COMPRESSBOUND(PREC_ZCHUNK_RAW), pz_wrkmem);
+		if (zlen <= 0 || off + zlen > pzd_space)
+			break;
+		memcpy(z->data + off, pz_bounce, zlen);
+		z->chunk[n].raw_len = end - start;
+		z->chunk[n].z_off = off;
+		z->chunk[n].z_len = zlen;
+		z->raw_total += end - start;
+		off += zlen;
+		n++;
+		end = start;
+	}
+	z->nr_chunks = n;
+	z->data_len = off;
+	z->raw_dropped = end;
+	z->elapsed_ns = ktime_get_mono_fast_ns() - t0;
+
+	z->crc = prec_zcrc(z);
+	wmb();
+	WRITE_ONCE(z->magic, PREC_ZMAGIC);
+	wmb();
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+static void prec_kmsg_dump(struct kmsg_dumper *dumper, struct kmsg_dump_detail *detail)
+{
+	if (detail->reason == KMSG_DUMP_PANIC && pzd)
+		prec_zdump_write(prec_kmsg_tail(dumper));
+}
+#else
+static void prec_kmsg_dump(struct kmsg_dumper *dumper, enum kmsg_dump_reason reason)
+{
+	if (reason == KMSG_DUMP_PANIC && pzd)
+		prec_zdump_write(prec_kmsg_tail(dumper));
+}
+#endif
+
+static struct kmsg_dumper prec_dumper = {
+	.dump = prec_kmsg_dump,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+	.max_reason = KMSG_DUMP_PANIC,
+#endif
+};
 
 /* Do what's required here for the product/project,
  * but keep it simple. Left essentially empty here..
@@ -47,6 +344,7 @@ static int mypanic_handler(struct notifier_block *nb, unsigned long val, void *d
 	pr_emerg("\n************ Panic : SOUNDING ALARM ************\n\
 val = %lu\n\
 data(str) = \"%s\"\n", val, (char *)data);
+	prec_write((char *)data);
 	dev_ring_alarm();
 
 	return NOTIFY_OK;
@@ -57,10 +355,212 @@ static struct notifier_block mypanic_nb = {
 //	.priority = INT_MAX
 };
 
+/*
+ * Timing the panic notifiers. The kernel's notifier chain walk has no hooks,
+ * so we do the walk ourselves: prec_timing_nb is registered at the highest
+ * priority, so that it's (typically) called first; it then calls every
+ * notifier after it on the chain - exactly as notifier_call_chain() would,
+ * in order, honouring NOTIFY_STOP - timing each, and finally returns
+ * NOTIFY_STOP, so that the kernel doesn't call them all a second time.
+ * (Any other INT_MAX priority notifiers registered before us run before us,
+ * untimed; we count them.) The timings go into the crash record.
+ */
+static struct prec_ntime prec_nt[PREC_MAX_NOTIFIERS];
+
+static int prec_timing_handler(struct notifier_block *nb, unsigned long val, void *data)
+{
+	struct prec_record *rec = prec;
+	struct notifier_block *n;
+	u64 t0 = ktime_get_mono_fast_ns(), t1, t2;
+	int ret;
+	u32 i = 0, untimed = 0;
+
+	for (n = rcu_dereference_raw(panic_notifier_list.head); n && n != nb;
+	     n = rcu_dereference_raw(n->next))
+		untimed++;
+
+	for (n = rcu_dereference_raw(nb->next); n; n = rcu_dereference_raw(n->next)) {
+		t1 = ktime_get_mono_fast_ns();
+		ret = n->notifier_call(n, val, data);
+		t2 = ktime_get_mono_fast_ns();
+		if (i < PREC_MAX_NOTIFIERS) {
+			prec_nt[i].fn_addr = (unsigned long)n->notifier_call;
+			prec_nt[i].ns = t2 - t1;
+			prec_nt[i].priority = n->priority;
+			prec_nt[i].ret = ret;
+		}
+		i++;
+		if (ret & NOTIFY_STOP_MASK)
+			break;
+	}
+	t2 = ktime_get_mono_fast_ns();
+
+	/* usually mypanic_handler() has written the record by now; if not, do so */
+	prec_write((char *)data);
+	if (rec) {
+		u32 j;
+
+		rec->nr_notifiers = i;
+		rec->nr_untimed = untimed;
+		rec->notifiers_ns = t2 - t0;
+		for (j = 0; j < min_t(u32, i, PREC_MAX_NOTIFIERS); j++) {
+			rec->ntimes[j] = prec_nt[j];
+			snprintf(rec->ntimes[j].sym, PREC_SYM_LEN, "%ps",
+				 (void *)(unsigned long)prec_nt[j].fn_addr);
+		}
+		prec_seal(rec);
+	}
+	return NOTIFY_STOP;
+}
+
+static struct notifier_block prec_timing_nb = {
+	.notifier_call = prec_timing_handler,
+	.priority = INT_MAX
+};
+
+/* cat <debugfs>/panic_notifier_lkm/notifiers : dry run; list the chain, calling nothing */
+static int prec_notifiers_show(struct seq_file *seq, void *v)
+{
+	struct notifier_block *n;
+	int i = 0;
+
+	seq_printf(seq, "# panic notifier chain, in call order%s\n",
+		   time_notifiers ? "; those after ours are timed at panic" : "");
+	seq_printf(seq, "# %3s %11s  %s\n", "#", "priority", "notifier_call");
+	rcu_read_lock();
+	for (n = rcu_dereference(panic_notifier_list.head); n; n = rcu_dereference(n->next))
+		seq_printf(seq, "  %3d %11d  %ps%s\n", i++, n->priority, n->notifier_call,
+			   n == &prec_timing_nb ? "  <-- our timing notifier" :
+			   n == &mypanic_nb ? "  <-- our recorder" : "");
+	rcu_read_unlock();
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(prec_notifiers);
+
+/* echo "some text" > <debugfs>/panic_notifier_lkm/event : log an event (id 0) */
+static ssize_t prec_event_write(struct file *filp, const char __user *ubuf, size_t count,
+				loff_t *fpos)
+{
+	char buf[PREC_EVT_MSG_LEN];
+	size_t len = min(count, sizeof(buf) - 1);
+
+	if (copy_from_user(buf, ubuf, len))
+		return -EFAULT;
+	buf[len] = '\0';
+	strim(buf);
+	panic_rec_log(0, 0, buf);
+	return count;
+}
+
+static const struct file_operations prec_event_fops = {
+	.write = prec_event_write,
+};
+
+/* Allocate all we need at panic time now; there's no allocating then */
+static int prec_zsetup(void)
+{
+	if (!kmsg_tail_kb)
+		return 0;
+	if (!IS_ENABLED(CONFIG_LZ4_COMPRESS)) {
+		pr_notice("no CONFIG_LZ4_COMPRESS; not saving the compressed log tail\n");
+		return 0;
+	}
+	if (region_size < PREC_ZDUMP_OFFSET + sizeof(*pzd) + PAGE_SIZE) {
+		pr_warn("region too small for the compressed log tail; not saving it\n");
+		return 0;
+	}
+	pz_raw_size = min_t(size_t, kmsg_tail_kb, PREC_ZMAX_CHUNKS * PREC_ZCHUNK_RAW / 1024) * 1024;
+	pz_raw = vmalloc(pz_raw_size);
+	pz_bounce = vmalloc(LZ4_COMPRESSBOUND(PREC_ZCHUNK_RAW));
+	pz_wrkmem = vmalloc(LZ4_MEM_COMPRESS);
+	if (!pz_raw || !pz_bounce || !pz_wrkmem)
+		return -ENOMEM;
+
+	pzd = region + PREC_ZDUMP_OFFSET;
+	pzd_space = region_size - PREC_ZDUMP_OFFSET - sizeof(*pzd);
+	pr_info("compressing up to %zu KB of log tail into %zu bytes, budget %u us\n",
+		pz_raw_size / 1024, pzd_space, zbudget_us);
+	return kmsg_dump_register(&prec_dumper);
+}
+
+static int prec_setup(void)
+{
+	BUILD_BUG_ON(!is_power_of_2(PREC_NEVENTS));
+
+	if (!rec_phys) {
+		region_size = PREC_ZDUMP_OFFSET + sizeof(*pzd) + kmsg_tail_kb * 1024;
+		region = vzalloc(region_size);
+		if (!region)
+			return -ENOMEM;
+		pr_warn("no rec_phys region given; recording into a (non-persistent) kernel buffer @ %px\n",
+			region);
+	} else {
+		if (rec_size < sizeof(*prec)) {
+			pr_warn("rec_size (%lu) too small; need at least %zu bytes\n",
+				rec_size, sizeof(*prec));
+			return -EINVAL;
+		}
+		/* write-combined, like ramoops does by default: nothing lingers in the cache */
+		region = memremap(rec_phys, rec_size, MEMREMAP_WC);
+		if (!region) {
+			pr_warn("memremap(0x%lx, %lu) failed\n", rec_phys, rec_size);
+			return -ENOMEM;
+		}
+		region_size = rec_size;
+		region_mapped = true;
+	}
+	prec = region;
+	if (prec->magic == PREC_MAGIC && prec->version == PREC_VERSION &&
+	    prec->size == sizeof(*prec) && prec->crc == prec_crc(prec))
+		pr_notice("a previous crash record is present; it's kept until the next panic (see panic_rec_reader)\n");
+	if (rec_phys)
+		pr_info("recording into 0x%lx (%zu bytes)\n", rec_phys, region_size);
+	return 0;
+}
+
+static void prec_teardown(void)
+{
+	if (pzd)
+		kmsg_dump_unregister(&prec_dumper);
+	pzd = NULL;
+	vfree(pz_wrkmem);
+	vfree(pz_bounce);
+	vfree(pz_raw);
+	if (region_mapped)
+		memunmap(region);
+	else
+		vfree(region);
+	region = NULL;
+	prec = NULL;
+}
+
 static int __init panic_notifier_lkm_init(void)
 {
+	int ret;
+
+	ret = prec_setup();
+	if (ret)
+		return ret;
+	ret = prec_zsetup();
+	if (ret) {
+		pzd = NULL;
+		prec_teardown();
+		return ret;
+	}
+	if (IS_ENABLED(CONFIG_DEBUG_FS)) {
+		prec_dbgfs_dir = debugfs_create_dir(KBUILD_MODNAME, NULL);
+		if (!IS_ERR_OR_NULL(prec_dbgfs_dir)) {
+			debugfs_create_file("event", 0200, prec_dbgfs_dir, NULL, &prec_event_fops);
+			debugfs_create_file("notifiers", 0444, prec_dbgfs_dir, NULL,
+					    &prec_notifiers_fops);
+		}
+	}
+
 	atomic_notifier_chain_register(&panic_notifier_list, &mypanic_nb);
-	pr_info("Registered panic notifier\n");
+	if (time_notifiers)
+		atomic_notifier_chain_register(&panic_notifier_list, &prec_timing_nb);
+	pr_info("Registered panic notifier%s\n", time_notifiers ? "s" : "");
+	panic_rec_log(0, 0, "recorder armed");
 
 	/*
 	 * Make #if 1 to have this module panic all by itself :-)
@@ -77,7 +577,11 @@ static int __init panic_notifier_lkm_init(void)
 
 static void __exit panic_notifier_lkm_exit(void)
 {
+	if (time_notifiers)
+		atomic_notifier_chain_unregister(&panic_notifier_list, &prec_timing_nb);
 	atomic_notifier_chain_unregister(&panic_notifier_list, &mypanic_nb);
+	debugfs_remove_recursive(prec_dbgfs_dir);
+	prec_teardown();
 	pr_info("Unregistered panic notifier\n");
 }
 
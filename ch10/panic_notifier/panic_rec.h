@@ -0,0 +1,173 @@
+/*
+ * ch10/panic_notifier/panic_rec.h
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Debugging"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+ *
+ * From: Ch 10: Kernel panic, hangcheck and watchdogs
+ ****************************************************************
+ * Brief Description:
+ * The layout of the binary crash record our panic_notifier_lkm module writes,
+ * at panic time, into a reserved region of RAM, and that the panic_rec_reader
+ * module recovers from it after a warm reboot. Both modules include this, so
+ * keep it self-contained; bump PREC_VERSION on any layout change.
+ *
+ * The record is fixed-size and is written in place: every field is filled in,
+ * then the CRC is computed over everything following the 'crc' member, and
+ * only then is the magic written. So a reader that sees the magic and a
+ * matching CRC knows the record is complete.
+ *
+ * After the record, the region holds the compressed tail of the kernel log
+ * (see struct prec_zdump below).
+ *
+ * Also here: the API other modules (GPL) use to feed the recorder's event
+ * ring and counters.
+ */
+#ifndef __LKD_PANIC_REC_H__
+#define __LKD_PANIC_REC_H__
+
+#include <linux/types.h>
+#include <linux/crc32.h>
+#include <linux/stddef.h>
+#include <linux/kernel.h>	/* ALIGN() */
+
+#define PREC_MAGIC		0x5043524bU	/* "KRCP" in memory (LE) */
+#define PREC_VERSION		2
+
+#define PREC_PANIC_STR_LEN	256
+#define PREC_RELEASE_LEN	65		/* __NEW_UTS_LEN + 1 */
+#define PREC_STACK_DEPTH	48
+#define PREC_NEVENTS		256		/* the last N events we keep */
+#define PREC_EVT_MSG_LEN	32
+#define PREC_NCOUNTERS		16
+#define PREC_MAX_NOTIFIERS	32
+#define PREC_SYM_LEN		48
+
+/* Built-in counters; the rest (up to PREC_NCOUNTERS) are for callers */
+enum prec_counter {
+	PREC_CTR_JIFFIES,
+	PREC_CTR_UPTIME_MS,
+	PREC_CTR_FREE_PAGES,
+	PREC_CTR_ONLINE_CPUS,
+	PREC_CTR_EVENTS_LOGGED,	/* total, since the recorder loaded */
+	PREC_CTR_FIRST_USER,
+};
+
+struct prec_event {
+	u64 seq;		/* 1-based position in the event stream; 0: unused */
+	u64 ts_ns;		/* local_clock() */
+	u32 cpu;
+	u32 id;			/* caller-defined */
+	u64 arg;		/* caller-defined */
+	char msg[PREC_EVT_MSG_LEN];
+};
+
+/* How long one panic notifier took */
+struct prec_ntime {
+	u64 fn_addr;		/* its notifier_call */
+	u64 ns;
+	s32 priority;
+	u32 ret;		/* NOTIFY_* */
+	char sym[PREC_SYM_LEN];	/* "%ps" of fn_addr, at panic time */
+};
+
+struct prec_record {
+	u32 magic;
+	u32 crc;		/* crc32_le() of the record following this member */
+	/* ---- everything below is covered by the CRC ---- */
+	u32 version;
+	u32 size;		/* sizeof(struct prec_record) */
+	u64 panic_ts_ns;	/* local_clock() */
+	s64 panic_wall_sec;	/* ktime_get_real_seconds() */
+	u32 panic_cpu;
+	u32 panic_pid;
+	char panic_comm[16];	/* TASK_COMM_LEN */
+	char panic_str[PREC_PANIC_STR_LEN];
+	char release[PREC_RELEASE_LEN];	/* utsname()->release */
+	/* to undo KASLR in the reader: the runtime address of panic() */
+	u64 panic_fn_addr;
+
+	u64 counters[PREC_NCOUNTERS];
+
+	/* the panicking CPU's stack */
+	u32 nr_stack;
+	u64 stack[PREC_STACK_DEPTH];
+
+	/* the last (up to) PREC_NEVENTS events, oldest first */
+	u32 nr_events;
+	struct prec_event events[PREC_NEVENTS];
+
+	/* the panic notifiers, in chain order, timed (if time_notifiers=1) */
+	u32 nr_notifiers;	/* timed; may exceed PREC_MAX_NOTIFIERS */
+	u32 nr_untimed;		/* ran before our timing notifier; not timed */
+	u64 notifiers_ns;	/* the whole chain, as seen by us */
+	struct prec_ntime ntimes[PREC_MAX_NOTIFIERS];
+};
+
+#define PREC_CRC_OFFSET	offsetof(struct prec_record, version)
+
+static inline u32 prec_crc(const struct prec_record *rec)
+{
+	return crc32_le(~0U, (const u8 *)rec + PREC_CRC_OFFSET,
+			sizeof(*rec) - PREC_CRC_OFFSET) ^ ~0U;
+}
+
+/*
+ * The compressed kernel log tail ('zdump'): it follows the record, page
+ * aligned, and runs to the end of the region. It's written at
+ * kmsg_dump(KMSG_DUMP_PANIC) time - after the panic notifiers have run - and
+ * has its own magic and CRC (covering the header and data[0..data_len)).
+ * The text is split into PREC_ZCHUNK_RAW sized chunks, each an independent
+ * LZ4 block; chunk[0] holds the *newest* text, so that if the time budget or
+ * the space runs out, it's the oldest text that's lost.
+ */
+#define PREC_ZMAGIC		0x5a52434bU	/* "KCRZ" in memory (LE) */
+#define PREC_ZVERSION		1
+#define PREC_ZCHUNK_RAW		(16 * 1024)
+#define PREC_ZMAX_CHUNKS	64		/* so, at most 1 MB of text */
+#define PREC_ZDUMP_OFFSET	ALIGN(sizeof(struct prec_record), 4096)
+
+struct prec_zchunk {
+	u32 raw_len;
+	u32 z_off;		/* within data[] */
+	u32 z_len;
+	u32 pad;
+};
+
+struct prec_zdump {
+	u32 magic;
+	u32 crc;
+	/* ---- everything below, plus data[0..data_len), is covered by the CRC ---- */
+	u32 version;
+	u32 hdr_size;		/* sizeof(struct prec_zdump) */
+	u64 elapsed_ns;		/* time taken to fetch and compress */
+	u32 budget_us;
+	u32 raw_total;		/* bytes of log text saved (uncompressed) */
+	u32 raw_dropped;	/* older log text we had, but no time/space for */
+	u32 nr_chunks;
+	u32 data_len;
+	u32 pad;
+	struct prec_zchunk chunk[PREC_ZMAX_CHUNKS];
+	u8 data[];
+};
+
+#define PREC_ZCRC_OFFSET	offsetof(struct prec_zdump, version)
+
+static inline u32 prec_zcrc(const struct prec_zdump *z)
+{
+	u32 crc = crc32_le(~0U, (const u8 *)z + PREC_ZCRC_OFFSET,
+			   sizeof(*z) - PREC_ZCRC_OFFSET);
+
+	return crc32_le(crc, z->data, z->data_len) ^ ~0U;
+}
+
+/* Exported by panic_notifier_lkm; lock-free and allocation-free: callable from any context */
+void panic_rec_log(u32 id, u64 arg, const char *msg);
+void panic_rec_counter_set(unsigned int idx, u64 val);
+void panic_rec_counter_add(unsigned int idx, u64 delta);
+
+#endif   /* #ifndef __LKD_PANIC_REC_H__ */
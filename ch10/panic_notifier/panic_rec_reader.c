@@ -0,0 +1,274 @@
+/*
+ * ch10/panic_notifier/panic_rec_reader.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Debugging"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+ *
+ * From: Ch 10: Kernel panic, hangcheck and watchdogs
+ ****************************************************************
+ * Brief Description:
+ * The other half of our panic_notifier_lkm crash recorder: after the (warm)
+ * reboot, load this module with the same reserved region; it validates the
+ * crash record found there (magic, version, size and CRC), prints it to the
+ * kernel log and makes a copy of the raw record available as
+ *  <debugfs>/panic_rec_reader/record
+ * so that you can save it away. Likewise for the compressed tail of the
+ * kernel log that follows the record: it's decompressed and made available
+ * as <debugfs>/panic_rec_reader/kmsg. With clear=1 both are then invalidated
+ * in the region, so that they're not reported again.
+ * Decompressing needs CONFIG_LZ4_DECOMPRESS; without it we still load and
+ * recover the record, and just report that the log tail is there (it's then
+ * left in place, even with clear=1).
+ *
+ * KASLR will likely have placed the kernel elsewhere this boot; the record
+ * holds the address panic() was at, so - as long as it's the same kernel -
+ * we relocate the stack's kernel text addresses and symbolize them. (Module
+ * addresses we can't relocate; they're shown raw.)
+ * We also show how long each panic notifier took (if the recorder timed them).
+ *
+ *   insmod panic_rec_reader.ko rec_phys=0x7f000000 rec_size=0x100000 [clear=1]
+ *
+ * For details, please refer the book, Ch 10.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/io.h>
+#include <linux/vmalloc.h>
+#include <linux/time64.h>
+#include <linux/utsname.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+#include <linux/lz4.h>
+#include "panic_rec.h"
+
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_DESCRIPTION("LKD book:ch10/panic_notifier: recover the crash record written by panic_notifier_lkm");
+
+static unsigned long rec_phys;
+module_param(rec_phys, ulong, 0444);
+MODULE_PARM_DESC(rec_phys, "Physical address of the reserved region holding the record (required)");
+
+static unsigned long rec_size;
+module_param(rec_size, ulong, 0444);
+MODULE_PARM_DESC(rec_size, "Size of the reserved region, in bytes");
+
+static bool clear;
+module_param(clear, bool, 0444);
+MODULE_PARM_DESC(clear, "Invalidate the record in the region once it's been read (default 0)");
+
+static const char * const prec_ctr_names[PREC_CTR_FIRST_USER] = {
+	[PREC_CTR_JIFFIES]       = "jiffies",
+	[PREC_CTR_UPTIME_MS]     = "uptime (ms)",
+	[PREC_CTR_FREE_PAGES]    = "free pages",
+	[PREC_CTR_ONLINE_CPUS]   = "online CPUs",
+	[PREC_CTR_EVENTS_LOGGED] = "events logged",
+};
+
+static struct prec_record *rec_copy;
+static struct debugfs_blob_wrapper rec_blob;
+static char *kmsg_copy;			/* the decompressed log tail */
+static struct debugfs_blob_wrapper kmsg_blob;
+static struct dentry *rdr_dbgfs_dir;
+
+static void prec_report(const struct prec_record *rec)
+{
+	bool same_kernel = !strcmp(rec->release, init_utsname()->release);
+	long kaslr_delta = (long)((unsigned long)panic - (unsigned long)rec->panic_fn_addr);
+	struct tm tm;
+	u32 i;
+
+	time64_to_tm(rec->panic_wall_sec, 0, &tm);
+	pr_info("=== crash record: panic @ %04ld-%02d-%02d %02d:%02d:%02d UTC, uptime %llu.%06llu s ===\n",
+		tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+		rec->panic_ts_ns / NSEC_PER_SEC, (rec->panic_ts_ns % NSEC_PER_SEC) / NSEC_PER_USEC);
+	pr_info("kernel %s%s\n", rec->release, same_kernel ? "" : " (NOT the running kernel)");
+	pr_info("panic: \"%s\"\n", rec->panic_str);
+	pr_info("on cpu %u, task %s (pid %u)\n", rec->panic_cpu, rec->panic_comm, rec->panic_pid);
+
+	for (i = 0; i < PREC_NCOUNTERS; i++) {
+		if (i < PREC_CTR_FIRST_USER)
+			pr_info("  %-14s : %llu\n", prec_ctr_names[i], rec->counters[i]);
+		else if (rec->counters[i])
+			pr_info("  counter[%2u]    : %llu\n", i, rec->counters[i]);
+	}
+
+	pr_info("stack (%u entries):\n", rec->nr_stack);
+	for (i = 0; i < rec->nr_stack && i < PREC_STACK_DEPTH; i++) {
+		unsigned long ip = (unsigned long)rec->stack[i] + kaslr_delta;
+
+		if (same_kernel)	/* %pS shows non-symbols as plain hex */
+			pr_info("  [%2u] 0x%016llx %pS\n", i, rec->stack[i], (void *)ip);
+		else
+			pr_info("  [%2u] 0x%016llx\n", i, rec->stack[i]);
+	}
+
+	pr_info("last %u event(s):\n", rec->nr_events);
+	for (i = 0; i < rec->nr_events && i < PREC_NEVENTS; i++) {
+		const struct prec_event *e = &rec->events[i];
+
+		pr_info("  #%-8llu [%5llu.%06llu] cpu%-3u id %-5u arg 0x%llx \"%.*s\"\n",
+			e->seq, e->ts_ns / NSEC_PER_SEC, (e->ts_ns % NSEC_PER_SEC) / NSEC_PER_USEC,
+			e->cpu, e->id, e->arg, PREC_EVT_MSG_LEN, e->msg);
+	}
+
+	if (!rec->nr_notifiers)
+		return;
+	pr_info("panic notifiers: %u timed (%u before ours, untimed), %llu us in all:\n",
+		rec->nr_notifiers, rec->nr_untimed, rec->notifiers_ns / NSEC_PER_USEC);
+	for (i = 0; i < rec->nr_notifiers && i < PREC_MAX_NOTIFIERS; i++) {
+		const struct prec_ntime *nt = &rec->ntimes[i];
+
+		pr_info("  %2u %11d %10llu ns  ret 0x%04x  %.*s\n", i, nt->priority, nt->ns,
+			nt->ret, PREC_SYM_LEN, nt->sym);
+	}
+}
+
+/* Validate and copy out the record; 0 if there's a good one */
+static int prec_recover(const struct prec_record *rec)
+{
+	if (rec->magic != PREC_MAGIC) {
+		pr_info("no crash record at 0x%lx\n", rec_phys);
+		return -ENOENT;
+	}
+	if (rec->version != PREC_VERSION || rec->size != sizeof(*rec)) {
+		pr_warn("crash record version %u / size %u; we understand v%u / %zu bytes\n",
+			rec->version, rec->size, PREC_VERSION, sizeof(*rec));
+		return -EPROTO;
+	}
+	/* work on a copy; also what we'll expose via debugfs */
+	rec_copy = vmalloc(sizeof(*rec));
+	if (!rec_copy)
+		return -ENOMEM;
+	memcpy(rec_copy, rec, sizeof(*rec));
+	if (rec_copy->crc != prec_crc(rec_copy)) {
+		pr_warn("crash record CRC mismatch (0x%08x != 0x%08x); corrupt or incomplete\n",
+			rec_copy->crc, prec_crc(rec_copy));
+		vfree(rec_copy);
+		rec_copy = NULL;
+		return -EBADMSG;
+	}
+	prec_report(rec_copy);
+	return 0;
+}
+
+/*
+ * Validate and decompress the log tail; 0 if there's a good one, -EOPNOTSUPP
+ * if there is but we can't decompress it here
+ */
+static int prec_zrecover(const struct prec_zdump *z, size_t space)
+{
+	u32 i, off = 0;
+	int n;
+
+	if (z->magic != PREC_ZMAGIC) {
+		pr_info("no compressed log tail present\n");
+		return -ENOENT;
+	}
+	if (z->version != PREC_ZVERSION || z->hdr_size != sizeof(*z) ||
+	    z->data_len > space || z->nr_chunks > PREC_ZMAX_CHUNKS ||
+	    z->raw_total > PREC_ZMAX_CHUNKS * PREC_ZCHUNK_RAW) {
+		pr_warn("compressed log tail: bad header (version %u)\n", z->version);
+		return -EPROTO;
+	}
+	if (z->crc != prec_zcrc(z)) {
+		pr_warn("compressed log tail: CRC mismatch; corrupt or incomplete\n");
+		return -EBADMSG;
+	}
+	if (!IS_ENABLED(CONFIG_LZ4_DECOMPRESS)) {	/* compiles the LZ4 call out */
+		pr_notice("compressed log tail present (%u bytes of log in %u bytes) but not decodable here: no CONFIG_LZ4_DECOMPRESS\n",
+			  z->raw_total, z->data_len);
+		return -EOPNOTSUPP;
+	}
+
+	kmsg_copy = vmalloc(z->raw_total + 1);
+	if (!kmsg_copy)
+		return -ENOMEM;
+	/* chunk[0] is the newest text; so lay them out back to front */
+	for (i = z->nr_chunks; i-- > 0; ) {
+		const struct prec_zchunk *c = &z->chunk[i];
+
+		if (c->z_off + c->z_len > z->data_len || off + c->raw_len > z->raw_total)
+			break;
+		n = LZ4_decompress_safe((const char *)z->data + c->z_off, kmsg_copy + off, c->z_len,
+					c->raw_len);
+		if (n != (int)c->raw_len) {
+			pr_warn("compressed log tail: chunk %u failed to decompress (%d)\n", i, n);
+			break;
+		}
+		off += n;
+	}
+	kmsg_copy[off] = '\0';
+	kmsg_blob.data = kmsg_copy;
+	kmsg_blob.size = off;
+	pr_info("log tail: %u bytes (%u dropped) from %u bytes compressed, in %llu us (budget %u us); see <debugfs>/%s/kmsg\n",
+		off, z->raw_dropped, z->data_len, z->elapsed_ns / NSEC_PER_USEC, z->budget_us,
+		KBUILD_MODNAME);
+	return 0;
+}
+
+static int __init panic_rec_reader_init(void)
+{
+	void *region;
+	struct prec_zdump *z = NULL;
+	size_t zspace = 0;
+	int ret, zret;
+
+	if (!rec_phys || rec_size < sizeof(struct prec_record)) {
+		pr_warn("pass the reserved region: rec_phys=<addr> rec_size=<size (>= %zu)>\n",
+			sizeof(struct prec_record));
+		return -EINVAL;
+	}
+	region = memremap(rec_phys, rec_size, MEMREMAP_WC);
+	if (!region) {
+		pr_warn("memremap(0x%lx, %lu) failed\n", rec_phys, rec_size);
+		return -ENOMEM;
+	}
+	if (rec_size >= PREC_ZDUMP_OFFSET + sizeof(*z)) {
+		z = region + PREC_ZDUMP_OFFSET;
+		zspace = rec_size - PREC_ZDUMP_OFFSET - sizeof(*z);
+	}
+
+	ret = prec_recover(region);
+	zret = z ? prec_zrecover(z, zspace) : -ENOENT;
+	if (ret && zret && zret != -EOPNOTSUPP) {
+		memunmap(region);
+		return ret;
+	}
+	if (clear) {
+		WRITE_ONCE(((struct prec_record *)region)->magic, 0);
+		if (z && zret != -EOPNOTSUPP)	/* keep it for a kernel that can decode it */
+			WRITE_ONCE(z->magic, 0);
+		pr_info("crash record cleared\n");
+	}
+	memunmap(region);
+
+	if (IS_ENABLED(CONFIG_DEBUG_FS)) {
+		rdr_dbgfs_dir = debugfs_create_dir(KBUILD_MODNAME, NULL);
+		if (!IS_ERR_OR_NULL(rdr_dbgfs_dir)) {
+			if (rec_copy) {
+				rec_blob.data = rec_copy;
+				rec_blob.size = sizeof(*rec_copy);
+				debugfs_create_blob("record", 0400, rdr_dbgfs_dir, &rec_blob);
+			}
+			if (kmsg_copy)
+				debugfs_create_blob("kmsg", 0400, rdr_dbgfs_dir, &kmsg_blob);
+		}
+	}
+	return 0;		/* success */
+}
+
+static void __exit panic_rec_reader_exit(void)
+{
+	debugfs_remove_recursive(rdr_dbgfs_dir);
+	vfree(kmsg_copy);
+	vfree(rec_copy);
+	pr_info("removed\n");
+}
+
+module_init(panic_rec_reader_init);
+module_exit(panic_rec_reader_exit);
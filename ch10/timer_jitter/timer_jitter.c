@@ -0,0 +1,487 @@
+/*
+ * ch10/timer_jitter/timer_jitter.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Debugging"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+ *
+ * From: Ch 10 : Kernel panic, lockups and hangs
+ ****************************************************************
+ * Brief Description:
+ * Our workq_stall module's ding() re-arms a timer_list every exp_ms; the
+ * ch11/kgdb_try module uses schedule_delayed_work(). How precisely do such
+ * periodic mechanisms actually fire? This module benchmarks the expiry jitter
+ * (actual minus expected expiry time) of:
+ *  timer   : timer_list (jiffies-based; the timer wheel)
+ *  hrtimer : high resolution timers (CLOCK_MONOTONIC, pinned)
+ *  dwork   : delayed work (queue_delayed_work_on() on system_wq)
+ * On each online CPU we arm 'ntimers' instances of each selected mechanism,
+ * every one re-arming itself with a period of 'period_us', for 'duration_ms'.
+ * - for hrtimers the expected expiry is the absolute hrtimer expiry; they're
+ *   forwarded along a fixed grid
+ * - for the timer_list and delayed work, the expiry is in jiffies (the
+ *   period rounded up to them); the expected time is when jiffies reaches it,
+ *   taken from the time of the current jiffy's tick (the coarse clock's
+ *   updated along with jiffies), not from the time of (re)arming - else the
+ *   jiffy round-up (up to a jiffy) would show up as lateness. It's still
+ *   approximate, to within the tick handling time: expect a few us either
+ *   way (early ones are counted separately). The timer_list is TIMER_PINNED,
+ *   so re-arming it can't migrate it off its CPU (NOHZ timer migration)
+ * We report, per mechanism and per CPU, the min/avg/max jitter, approximate
+ * 50th and 99th percentiles (from a log2 histogram; upper bucket bounds) and
+ * the histogram itself.
+ *
+ * Usage (debugfs):
+ *  echo 1 > /sys/kernel/debug/timer_jitter/run      # blocks until done
+ *  cat /sys/kernel/debug/timer_jitter/results
+ * Tune the run via the module parameters (they're writable at runtime under
+ * /sys/module/timer_jitter/parameters/).
+ *
+ * For details, please refer the book, Ch 10.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/cpumask.h>
+#include <linux/smp.h>
+#include <linux/timer.h>
+#include <linux/hrtimer.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "../../convenient.h"
+
+MODULE_AUTHOR("<insert your name here>");
+MODULE_DESCRIPTION("LKD book:ch10/timer_jitter: timer_list vs hrtimer vs delayed work expiry jitter benchmark");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+static char *mechs = "all";
+module_param(mechs, charp, 0644);
+MODULE_PARM_DESC(mechs, "Mechanisms to benchmark, comma-separated (default 'all'): timer,hrtimer,dwork");
+
+static unsigned int period_us = 10000;
+module_param(period_us, uint, 0644);
+MODULE_PARM_DESC(period_us, "Timer period, in us (default 10000, min 10)");
+
+static unsigned int ntimers = 4;
+module_param(ntimers, uint, 0644);
+MODULE_PARM_DESC(ntimers, "# of instances of each mechanism per CPU (default 4)");
+
+static unsigned int duration_ms = 5000;
+module_param(duration_ms, uint, 0644);
+MODULE_PARM_DESC(duration_ms, "How long to run, in ms (default 5000)");
+
+enum tj_type {
+	TJ_TIMER,
+	TJ_HRTIMER,
+	TJ_DWORK,
+	TJ_NUM_TYPES
+};
+
+static const char * const tj_names[TJ_NUM_TYPES] = {
+	[TJ_TIMER]   = "timer",
+	[TJ_HRTIMER] = "hrtimer",
+	[TJ_DWORK]   = "dwork",
+};
+
+#define TJ_NBUCKETS	32	/* log2(ns) buckets */
+
+/* Only ever updated by the instance's own (serialized) callback */
+struct tj_stats {
+	u64 cnt, early;
+	s64 sum_ns, min_ns, max_ns;
+	u64 late_hist[TJ_NBUCKETS];
+};
+
+struct tj_inst {
+	enum tj_type type;
+	int cpu;
+	union {
+		struct timer_list tmr;
+		struct hrtimer hrt;
+		struct delayed_work dwork;
+	};
+	u64 expected_ns;	/* CLOCK_MONOTONIC */
+	struct tj_stats st;
+};
+
+static struct tj_inst *tj_insts;
+static int tj_ninsts;
+static bool tj_stopping;
+static u64 tj_period_ns;
+static unsigned long tj_period_jiffies;
+
+/* Results of the last run, per mechanism, per CPU */
+static struct tj_result {
+	bool valid;
+	unsigned int period_us, ntimers;
+	struct tj_stats *pcpu;	/* [nr_cpu_ids] */
+} tj_results[TJ_NUM_TYPES];
+
+static DEFINE_MUTEX(tj_mutex);	/* one run at a time; protects tj_results */
+static struct dentry *tj_dbgfs_dir;
+
+static inline int tj_bucket(u64 ns)
+{
+	return ns ? min(fls64(ns) - 1, TJ_NBUCKETS - 1) : 0;
+}
+
+static void tj_record(struct tj_stats *st, s64 jitter)
+{
+	if (!st->cnt || jitter < st->min_ns)
+		st->min_ns = jitter;
+	if (!st->cnt || jitter > st->max_ns)
+		st->max_ns = jitter;
+	st->cnt++;
+	st->sum_ns += jitter;
+	if (jitter < 0)
+		st->early++;
+	else
+		st->late_hist[tj_bucket(jitter)]++;
+}
+
+/*
+ * The (CLOCK_MONOTONIC) time at which jiffies reaches @expires, reckoned from
+ * the time of the current jiffy's tick: the coarse clock is updated along with
+ * jiffies, at the tick.
+ */
+static u64 tj_jiffies_to_ns(unsigned long expires)
+{
+	unsigned long j;
+	u64 t;
+
+	do {
+		j = READ_ONCE(jiffies);
+		t = ktime_get_coarse_ns();
+	} while (j != READ_ONCE(jiffies));
+	return t + (u64)(long)(expires - j) * TICK_NSEC;
+}
+
+/* timer_list: runs in softirq context on inst->cpu (it's pinned) */
+static void tj_timer_fn(struct timer_list *t)
+{
+	struct tj_inst *inst = from_timer(inst, t, tmr);
+	u64 now = ktime_get_ns();
+	unsigned long expires;
+
+	tj_record(&inst->st, (s64)(now - inst->expected_ns));
+	if (READ_ONCE(tj_stopping))
+		return;
+	expires = jiffies + tj_period_jiffies;
+	inst->expected_ns = tj_jiffies_to_ns(expires);
+	mod_timer(&inst->tmr, expires);
+}
+
+/* hrtimer: runs in hardirq context on inst->cpu (it's pinned) */
+static enum hrtimer_restart tj_hrtimer_fn(struct hrtimer *t)
+{
+	struct tj_inst *inst = container_of(t, struct tj_inst, hrt);
+	u64 now = ktime_get_ns();
+
+	tj_record(&inst->st, (s64)(now - ktime_to_ns(hrtimer_get_expires(t))));
+	if (READ_ONCE(tj_stopping))
+		return HRTIMER_NORESTART;
+	hrtimer_forward_now(t, ns_to_ktime(tj_period_ns));
+	return HRTIMER_RESTART;
+}
+
+/* delayed work: runs in process context, in a kworker bound to inst->cpu */
+static void tj_dwork_fn(struct work_struct *work)
+{
+	struct tj_inst *inst = container_of(to_delayed_work(work), struct tj_inst, dwork);
+	u64 now = ktime_get_ns();
+
+	tj_record(&inst->st, (s64)(now - inst->expected_ns));
+	if (READ_ONCE(tj_stopping))
+		return;
+	inst->expected_ns = tj_jiffies_to_ns(jiffies + tj_period_jiffies);
+	queue_delayed_work_on(inst->cpu, system_wq, &inst->dwork, tj_period_jiffies);
+}
+
+/* An hrtimer is (pinned) on the CPU it's started on; so start it there */
+static void tj_hrtimer_arm(void *arg)
+{
+	struct tj_inst *inst = arg;
+
+	hrtimer_start(&inst->hrt, ns_to_ktime(tj_period_ns), HRTIMER_MODE_REL_PINNED);
+}
+
+static void tj_arm(struct tj_inst *inst)
+{
+	switch (inst->type) {
+	case TJ_TIMER:
+		/* pinned: else mod_timer() may move it (NOHZ timer migration) */
+		timer_setup(&inst->tmr, tj_timer_fn, TIMER_PINNED);
+		inst->tmr.expires = jiffies + tj_period_jiffies;
+		inst->expected_ns = tj_jiffies_to_ns(inst->tmr.expires);
+		add_timer_on(&inst->tmr, inst->cpu);
+		break;
+	case TJ_HRTIMER:
+		hrtimer_init(&inst->hrt, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+		inst->hrt.function = tj_hrtimer_fn;
+		smp_call_function_single(inst->cpu, tj_hrtimer_arm, inst, 1);
+		break;
+	case TJ_DWORK:
+		INIT_DELAYED_WORK(&inst->dwork, tj_dwork_fn);
+		inst->expected_ns = tj_jiffies_to_ns(jiffies + tj_period_jiffies);
+		queue_delayed_work_on(inst->cpu, system_wq, &inst->dwork, tj_period_jiffies);
+		break;
+	default:
+		break;
+	}
+}
+
+/* tj_stopping's set, so the callbacks no longer re-arm; wait them out */
+static void tj_disarm(struct tj_inst *inst)
+{
+	switch (inst->type) {
+	case TJ_TIMER:
+		del_timer_sync(&inst->tmr);
+		break;
+	case TJ_HRTIMER:
+		hrtimer_cancel(&inst->hrt);
+		break;
+	case TJ_DWORK:
+		cancel_delayed_work_sync(&inst->dwork);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Is mechanism @type selected via the 'mechs' module parameter? */
+static bool tj_selected(enum tj_type type)
+{
+	const char *p = mechs;
+	size_t len = strlen(tj_names[type]);
+
+	if (!p || !strcmp(p, "all"))
+		return true;
+	while (p && *p) {
+		if (!strncmp(p, tj_names[type], len) && (p[len] == ',' || p[len] == '\0' ||
+							 p[len] == '\n'))
+			return true;
+		p = strchr(p, ',');
+		if (p)
+			p++;
+	}
+	return false;
+}
+
+static int tj_run(void)
+{
+	struct tj_inst *inst;
+	enum tj_type type;
+	int cpu, i, n = 0;
+
+	if (period_us < 10 || !ntimers) {
+		pr_warn("period_us must be >= 10 and ntimers >= 1\n");
+		return -EINVAL;
+	}
+	tj_period_ns = (u64)period_us * NSEC_PER_USEC;
+	tj_period_jiffies = max(usecs_to_jiffies(period_us), 1UL);
+
+	for (type = 0; type < TJ_NUM_TYPES; type++) {
+		tj_results[type].valid = false;
+		if (tj_selected(type))
+			n += num_online_cpus() * ntimers;
+	}
+	if (!n)
+		return -EINVAL;
+	tj_insts = kcalloc(n, sizeof(*tj_insts), GFP_KERNEL);
+	if (!tj_insts)
+		return -ENOMEM;
+
+	cpus_read_lock();
+	for (type = 0; type < TJ_NUM_TYPES; type++) {
+		if (!tj_selected(type))
+			continue;
+		for_each_online_cpu(cpu) {
+			for (i = 0; i < ntimers && tj_ninsts < n; i++) {
+				inst = &tj_insts[tj_ninsts++];
+				inst->type = type;
+				inst->cpu = cpu;
+			}
+		}
+	}
+
+	pr_info("running: %d CPUs x %u instance(s) per mechanism, period %u us (%lu jiffies), for %u ms\n",
+		num_online_cpus(), ntimers, period_us, tj_period_jiffies, duration_ms);
+	WRITE_ONCE(tj_stopping, false);
+	for (i = 0; i < tj_ninsts; i++)
+		tj_arm(&tj_insts[i]);
+	cpus_read_unlock();
+
+	msleep(duration_ms);
+
+	WRITE_ONCE(tj_stopping, true);
+	for (i = 0; i < tj_ninsts; i++)
+		tj_disarm(&tj_insts[i]);
+
+	/* Fold the per-instance stats into per-CPU results */
+	for (type = 0; type < TJ_NUM_TYPES; type++) {
+		struct tj_result *res = &tj_results[type];
+
+		if (!tj_selected(type))
+			continue;
+		memset(res->pcpu, 0, nr_cpu_ids * sizeof(*res->pcpu));
+		res->period_us = period_us;
+		res->ntimers = ntimers;
+		res->valid = true;
+	}
+	for (i = 0; i < tj_ninsts; i++) {
+		struct tj_stats *src = &tj_insts[i].st;
+		struct tj_stats *dst = &tj_results[tj_insts[i].type].pcpu[tj_insts[i].cpu];
+		int b;
+
+		if (!src->cnt)
+			continue;
+		if (!dst->cnt || src->min_ns < dst->min_ns)
+			dst->min_ns = src->min_ns;
+		if (!dst->cnt || src->max_ns > dst->max_ns)
+			dst->max_ns = src->max_ns;
+		dst->cnt += src->cnt;
+		dst->early += src->early;
+		dst->sum_ns += src->sum_ns;
+		for (b = 0; b < TJ_NBUCKETS; b++)
+			dst->late_hist[b] += src->late_hist[b];
+	}
+
+	kfree(tj_insts);
+	tj_insts = NULL;
+	tj_ninsts = 0;
+	pr_info("done; see the debugfs results file\n");
+	return 0;
+}
+
+/* The (upper bound of the) bucket in which the pct'th percentile falls */
+static u64 tj_pctile(const struct tj_stats *st, unsigned int pct)
+{
+	u64 want = div_u64(st->cnt * pct + 99, 100), seen = st->early;
+	int b;
+
+	if (seen >= want)
+		return 0;	/* in the 'early' region */
+	for (b = 0; b < TJ_NBUCKETS; b++) {
+		seen += st->late_hist[b];
+		if (seen >= want)
+			return 1ULL << (b + 1);
+	}
+	return U64_MAX;
+}
+
+static int tj_results_show(struct seq_file *seq, void *v)
+{
+	enum tj_type type;
+	int cpu, b;
+
+	mutex_lock(&tj_mutex);
+	for (type = 0; type < TJ_NUM_TYPES; type++) {
+		struct tj_result *res = &tj_results[type];
+
+		if (!res->valid)
+			continue;
+		seq_printf(seq, "%s: period %u us, %u per CPU; jitter = actual - expected (ns)\n",
+			   tj_names[type], res->period_us, res->ntimers);
+		seq_printf(seq, "  # %4s %8s %6s %10s %10s %10s %10s %10s\n", "cpu", "expiries",
+			   "early", "min", "avg", "max", "p50<=", "p99<=");
+		for_each_possible_cpu(cpu) {
+			struct tj_stats *st = &res->pcpu[cpu];
+
+			if (!st->cnt)
+				continue;
+			seq_printf(seq, "    %4d %8llu %6llu %10lld %10lld %10lld %10llu %10llu\n",
+				   cpu, st->cnt, st->early, st->min_ns,
+				   div64_s64(st->sum_ns, st->cnt), st->max_ns,
+				   tj_pctile(st, 50), tj_pctile(st, 99));
+			seq_puts(seq, "      late (ns):");
+			for (b = 0; b < TJ_NBUCKETS; b++)
+				if (st->late_hist[b])
+					seq_printf(seq, " [%llu-%llu):%llu", b ? 1ULL << b : 0,
+						   1ULL << (b + 1), st->late_hist[b]);
+			seq_puts(seq, "\n");
+		}
+	}
+	mutex_unlock(&tj_mutex);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(tj_results);
+
+static ssize_t tj_run_write(struct file *filp, const char __user *ubuf, size_t count,
+			    loff_t *fpos)
+{
+	int ret;
+
+	if (!mutex_trylock(&tj_mutex))
+		return -EBUSY;
+	ret = tj_run();
+	mutex_unlock(&tj_mutex);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations tj_run_fops = {
+	.write = tj_run_write,
+};
+
+static int __init timer_jitter_init(void)
+{
+	enum tj_type type;
+	int ret;
+
+	if (!IS_ENABLED(CONFIG_DEBUG_FS)) {
+		pr_warn("debugfs unsupported! Aborting ...\n");
+		return -EINVAL;
+	}
+
+	for (type = 0; type < TJ_NUM_TYPES; type++) {
+		tj_results[type].pcpu = kcalloc(nr_cpu_ids, sizeof(struct tj_stats), GFP_KERNEL);
+		if (!tj_results[type].pcpu) {
+			ret = -ENOMEM;
+			goto out_free;
+		}
+	}
+
+	tj_dbgfs_dir = debugfs_create_dir(KBUILD_MODNAME, NULL);
+	if (IS_ERR_OR_NULL(tj_dbgfs_dir)) {
+		pr_info("debugfs_create_dir failed, aborting...\n");
+		ret = tj_dbgfs_dir ? PTR_ERR(tj_dbgfs_dir) : -ENOMEM;
+		goto out_free;
+	}
+	debugfs_create_file("run", 0200, tj_dbgfs_dir, NULL, &tj_run_fops);
+	debugfs_create_file("results", 0444, tj_dbgfs_dir, NULL, &tj_results_fops);
+
+	pr_info("loaded; write to <debugfs>/%s/run to start, read results from <debugfs>/%s/results\n",
+		KBUILD_MODNAME, KBUILD_MODNAME);
+	return 0;		/* success */
+
+ out_free:
+	for (type = 0; type < TJ_NUM_TYPES; type++)
+		kfree(tj_results[type].pcpu);
+	return ret;
+}
+
+static void __exit timer_jitter_exit(void)
+{
+	enum tj_type type;
+
+	debugfs_remove_recursive(tj_dbgfs_dir);
+	for (type = 0; type < TJ_NUM_TYPES; type++)
+		kfree(tj_results[type].pcpu);
+	pr_info("removed\n");
+}
+
+module_init(timer_jitter_init);
+module_exit(timer_jitter_exit);
@@ -13,10 +13,42 @@
  * Brief Description:
  * This code is originally from my earlier LKP-2 book, here:
  * https://github.com/PacktPublishing/Linux-Kernel-Programming-Part-2/tree/main/ch5/workq_simple
- * To simulate a workqueue stall, we insert a couple of lines of CPU-intensive
- * code in our kernel-default workqueue work function.
- * The kernel's workqueue stall etection code detects this - via the WQ watchdog
- * - and calls BUG() !
+ * It now runs in one of these modes (module parameter 'mode'):
+ *
+ *  mode=0 : stall (the default). To simulate a workqueue stall, we insert a
+ *           couple of lines of CPU-intensive code in our kernel-default
+ *           workqueue work function. The kernel's workqueue stall detection
+ *           code detects this - via the WQ watchdog - and calls BUG() !
+ *  mode=1 : profile. Nothing stalls; instead, on every online CPU a bound
+ *           'producer' kthread enqueues work, 'rate_hz' times a second for
+ *           'duration_ms', onto each of the system, system_unbound,
+ *           system_highpri and a custom (per-CPU) workqueue. Every work
+ *           item timestamps when it was queued; the work function records
+ *           the queue-to-execute latency into a per-CPU (the CPU the work
+ *           ran on), per-workqueue log2 histogram. If a producer finds its
+ *           previous item on a workqueue still not run when the next one's
+ *           due, it counts a 'miss' - a sign of worker pool starvation.
+ *           Results: <debugfs>/workq_stall/results (live) and, summarized,
+ *           the kernel log on module removal.
+ *  mode=2 : inject. A controlled, bounded stall: after 'settle_ms', a work
+ *           item queued on the 'stall_wq' workqueue on CPU 'stall_cpu' hogs
+ *           that worker pool for 'stall_ms'. Meanwhile the mode=1 probe
+ *           workload runs on that CPU, its latencies accounted separately
+ *           for before, during and after the stall. We also timestamp when
+ *           (if at all) the workqueue watchdog reports "BUG: workqueue
+ *           lockup" (threshold: the workqueue.watchdog_thresh boot param,
+ *           default 30 s). Note that all bound workqueues without
+ *           WQ_HIGHPRI share a CPU's normal worker pool, so stalling
+ *           'system' delays 'custom' too (and vice-versa), while the
+ *           highpri pool is separate. 'system_unbound' can't be stalled:
+ *           unbound pools aren't concurrency-managed (a busy worker never
+ *           holds up the others), so it's rejected.
+ *           Since 6.5, a work item that hogs the CPU for longer than
+ *           workqueue.cpu_intensive_thresh_us (10 ms by default) is marked
+ *           CPU_INTENSIVE and no longer holds up its pool - so no lockup.
+ *           Raise it above stall_ms first, f.e. for 40 s:
+ *            echo 41000000 > /sys/module/workqueue/parameters/cpu_intensive_thresh_us
+ *           If the pool ran other work during the stall anyway, we say so.
  *
  * Original comment:
  * A demo of a simple workqueue in action. We use the default kernel-global
@@ -40,15 +72,60 @@
 #include <linux/workqueue.h>
 #include <linux/timer.h>
 #include <linux/delay.h>
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
+#include <linux/percpu.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/version.h>
 #include "../../convenient.h"
+#include "../console_watch.h"
 
 #define INITIAL_VALUE	3
 
 MODULE_AUTHOR("[insert name]");
-MODULE_DESCRIPTION("a LKM to demo a simple workqueue stall");
+MODULE_DESCRIPTION("a LKM to demo a simple workqueue stall, and to profile workqueue latency");
 MODULE_LICENSE("Dual MIT/GPL");	// or whatever
-MODULE_VERSION("0.1");
+MODULE_VERSION("0.2");
+
+enum wq_mode {
+	MODE_STALL,
+	MODE_PROFILE,
+	MODE_INJECT,
+};
+
+static int mode = MODE_STALL;
+module_param(mode, int, 0444);
+MODULE_PARM_DESC(mode, "0 = stall (default): lock up a kworker; 1 = profile: measure queue-to-execute latency; 2 = inject: a bounded stall, measuring its impact");
+
+static unsigned int rate_hz = 1000;
+module_param(rate_hz, uint, 0444);
+MODULE_PARM_DESC(rate_hz, "[profile] work items queued per second, per CPU, per workqueue (default 1000, max 100000)");
+
+static unsigned int duration_ms = 10000;
+module_param(duration_ms, uint, 0444);
+MODULE_PARM_DESC(duration_ms, "[profile] how long to keep queueing work, in ms (default 10000)");
+
+static char *stall_wq = "system";
+module_param(stall_wq, charp, 0444);
+MODULE_PARM_DESC(stall_wq, "[inject] the workqueue whose worker pool to hog: system (default), system_highpri, custom (system_unbound can't be stalled)");
+
+static int stall_cpu;
+module_param(stall_cpu, int, 0444);
+MODULE_PARM_DESC(stall_cpu, "[inject] the CPU whose worker pool to hog (default 0)");
+
+static unsigned int stall_ms = 40000;
+module_param(stall_ms, uint, 0444);
+MODULE_PARM_DESC(stall_ms, "[inject] how long to hog the worker pool, in ms (default 40000; the workqueue watchdog threshold is 30 s by default)");
+
+static unsigned int settle_ms = 2000;
+module_param(settle_ms, uint, 0444);
+MODULE_PARM_DESC(settle_ms, "[inject] how long to probe before and after the stall, in ms (default 2000)");
 
+/*----------------------------- mode=0 : stall -----------------------------*/
 static struct st_ctx {
 	struct work_struct work;
 	struct timer_list tmr;
@@ -101,15 +178,8 @@ static void work_func(struct work_struct *work)
 		i += 3;
 }
 
-static int __init workq_simple_init(void)
+static int stall_start(void)
 {
-	u64 i = 0;
-
-	pr_info("Deliberately locking up the cpu now!\n");
-	while (1)
-		i ++;
-	
-
 	ctx.data = INITIAL_VALUE;
 
 	/* Initialize our workqueue */
@@ -123,10 +193,10 @@ static int __init workq_simple_init(void)
 	pr_info("Work queue initialized, timer set to expire in %ld ms\n", exp_ms);
 	add_timer(&ctx.tmr); /* Arm it; lets get going! */
 
-	return 0;		/* success */
+	return 0;
 }
 
-static void __exit workq_simple_exit(void)
+static void stall_stop(void)
 {
 	// Wait for any pending work (queue) to finish
 	if (cancel_work_sync(&ctx.work))
@@ -136,6 +206,484 @@ static void __exit workq_simple_exit(void)
 
 	// Wait for possible timeouts to complete... and then delete the timer
 	del_timer_sync(&ctx.tmr);
+}
+
+/*------------------------- mode=1,2 : profile, inject ---------------------*/
+enum wqp_type {
+	WQP_SYSTEM,
+	WQP_UNBOUND,
+	WQP_HIGHPRI,
+	WQP_CUSTOM,
+	WQP_NUM_TYPES
+};
+
+static const char * const wqp_names[WQP_NUM_TYPES] = {
+	[WQP_SYSTEM]  = "system",
+	[WQP_UNBOUND] = "system_unbound",
+	[WQP_HIGHPRI] = "system_highpri",
+	[WQP_CUSTOM]  = "custom",
+};
+
+/*
+ * In inject mode the probe work is accounted separately for the time before,
+ * during and after the stall; profile mode only ever uses the first phase.
+ */
+enum wqp_phase {
+	WQP_PH_BEFORE,
+	WQP_PH_STALL,
+	WQP_PH_AFTER,
+	WQP_NUM_PHASES
+};
+
+static const char * const wqp_phase_names[WQP_NUM_PHASES] = {
+	[WQP_PH_BEFORE] = "before stall",
+	[WQP_PH_STALL]  = "during stall",
+	[WQP_PH_AFTER]  = "after stall",
+};
+
+#define WQP_NBUCKETS	32	/* log2(ns) buckets */
+
+struct wqp_hist {
+	u64 cnt, sum_ns, max_ns;
+	u64 bkt[WQP_NBUCKETS];
+};
+
+struct wqp_item {
+	struct work_struct work;
+	enum wqp_type type;
+	enum wqp_phase phase;	/* the phase it was queued in */
+	u64 t_queue;
+	int done;	/* the work function's consumed t_queue etc; ok to requeue */
+};
+
+/* Per-CPU state */
+struct wqp_cpu {
+	/* updated by the work function, indexed by the CPU it *ran* on */
+	struct wqp_hist hist[WQP_NUM_PHASES][WQP_NUM_TYPES];
+	/* updated by this CPU's producer kthread */
+	struct wqp_item item[WQP_NUM_TYPES];
+	u64 queued[WQP_NUM_TYPES], missed[WQP_NUM_PHASES][WQP_NUM_TYPES];
+	struct task_struct *producer;
+};
+
+static DEFINE_PER_CPU(struct wqp_cpu, wqp_pcpu);
+static struct workqueue_struct *wqp_wq[WQP_NUM_TYPES];
+static struct workqueue_struct *wqp_custom_wq;
+static atomic_t wqp_running;
+static struct dentry *wqp_dbgfs_dir;
+
+/* inject mode state */
+static enum wqp_phase wqp_cur_phase;
+static enum wqp_type wqi_type;
+static struct work_struct wqi_stall_work;
+static u64 wqi_t_queue, wqi_t_start, wqi_t_end;
+/* probe work that ran on the stalled pool while it was meant to be stalled */
+static atomic_t wqi_ran_during;
+
+static struct cw_pattern wqi_pats[] = {
+	{ .substr = "BUG: workqueue lockup", .label = "workqueue watchdog" },
+};
+
+static inline int wqp_bucket(u64 ns)
+{
+	return ns ? min(fls64(ns) - 1, WQP_NBUCKETS - 1) : 0;
+}
+
+/* Which of a CPU's worker pools does this workqueue use? */
+static inline int wqp_pool(enum wqp_type type)
+{
+	switch (type) {
+	case WQP_HIGHPRI:
+		return 1;
+	case WQP_UNBOUND:
+		return 2;
+	default:
+		return 0;	/* system, custom: the normal pool */
+	}
+}
+
+static void wqp_work_func(struct work_struct *work)
+{
+	struct wqp_item *it = container_of(work, struct wqp_item, work);
+	u64 lat = ktime_get_mono_fast_ns() - it->t_queue;
+	enum wqp_phase phase = it->phase;
+	enum wqp_type type = it->type;
+	struct wqp_hist *h;
+
+	/*
+	 * Once 'done' is released the sampler may requeue the item, with a new
+	 * phase; so only our snapshot of it is used from here on.
+	 */
+	smp_store_release(&it->done, 1);
+
+	if (mode == MODE_INJECT && READ_ONCE(wqp_cur_phase) == WQP_PH_STALL &&
+	    wqp_pool(type) == wqp_pool(wqi_type) && raw_smp_processor_id() == stall_cpu)
+		atomic_inc(&wqi_ran_during);
+
+	/* kworkers on a CPU can preempt each other; keep the update atomic wrt that */
+	h = &get_cpu_var(wqp_pcpu).hist[phase][type];
+	h->cnt++;
+	h->sum_ns += lat;
+	if (lat > h->max_ns)
+		h->max_ns = lat;
+	h->bkt[wqp_bucket(lat)]++;
+	put_cpu_var(wqp_pcpu);
+}
+
+/*
+ * The misbehaving work item: it hogs its worker for stall_ms. It never
+ * sleeps, so the pool's concurrency management doesn't wake another worker and
+ * everything queued behind it on this pool waits (unless, 6.5 on, the worker's
+ * marked CPU_INTENSIVE; see the header comment). We do cond_resched() every
+ * ms though, so that on a non-preemptible kernel it's the workqueue watchdog
+ * - not the soft lockup detector - that notices.
+ */
+static void wqi_stall_func(struct work_struct *work)
+{
+	u64 end;
+
+	wqi_t_start = ktime_get_mono_fast_ns();
+	WRITE_ONCE(wqp_cur_phase, WQP_PH_STALL);
+	pr_info("hogging the %s worker pool on cpu %d for %u ms now\n",
+		wqp_names[wqi_type], smp_processor_id(), stall_ms);
+
+	end = wqi_t_start + (u64)stall_ms * NSEC_PER_MSEC;
+	while (ktime_get_mono_fast_ns() < end) {
+		spin_ms(1);
+		cond_resched();
+	}
+	wqi_t_end = ktime_get_mono_fast_ns();
+	WRITE_ONCE(wqp_cur_phase, WQP_PH_AFTER);
+}
+
+/* Keep producing? In inject mode: settle_ms before and after the stall */
+static bool wqp_keep_going(u64 t_begin)
+{
+	u64 now = ktime_get_mono_fast_ns();
+
+	if (kthread_should_stop())
+		return false;
+	if (mode == MODE_PROFILE)
+		return now < t_begin + (u64)duration_ms * NSEC_PER_MSEC;
+
+	/* time to inject the stall? */
+	if (!wqi_t_queue && now >= t_begin + (u64)settle_ms * NSEC_PER_MSEC) {
+		wqi_t_queue = now;
+		queue_work_on(stall_cpu, wqp_wq[wqi_type], &wqi_stall_work);
+	}
+	return READ_ONCE(wqp_cur_phase) != WQP_PH_AFTER ||
+		now < READ_ONCE(wqi_t_end) + (u64)settle_ms * NSEC_PER_MSEC;
+}
+
+static int wqp_producer(void *arg)
+{
+	struct wqp_cpu *pc = arg;
+	int cpu = smp_processor_id();
+	unsigned long period_us = USEC_PER_SEC / rate_hz;
+	u64 t_begin = ktime_get_mono_fast_ns();
+	enum wqp_type type;
+
+	while (wqp_keep_going(t_begin)) {
+		enum wqp_phase phase = READ_ONCE(wqp_cur_phase);
+
+		for (type = 0; type < WQP_NUM_TYPES; type++) {
+			struct wqp_item *it = &pc->item[type];
+
+			/* the previous one's still pending or not yet begun running? */
+			if (!smp_load_acquire(&it->done)) {
+				pc->missed[phase][type]++;
+				continue;
+			}
+			it->done = 0;
+			it->phase = phase;
+			it->t_queue = ktime_get_mono_fast_ns();
+			queue_work_on(cpu, wqp_wq[type], &it->work);
+			pc->queued[type]++;
+		}
+		usleep_range(period_us, period_us + period_us / 8 + 1);
+	}
+	if (atomic_dec_and_test(&wqp_running))
+		pr_info("%s done; see <debugfs>/%s/results\n",
+			mode == MODE_PROFILE ? "profiling" : "stall injection", KBUILD_MODNAME);
+
+	/* wait here for kthread_stop() */
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+	}
+	return 0;
+}
+
+static void wqp_show_hist(struct seq_file *seq, const u64 *bkt)
+{
+	int b;
+
+	seq_puts(seq, "      latency (ns):");
+	for (b = 0; b < WQP_NBUCKETS; b++)
+		if (bkt[b])
+			seq_printf(seq, " [%llu-%llu):%llu", b ? 1ULL << b : 0,
+				   1ULL << (b + 1), bkt[b]);
+	seq_puts(seq, "\n");
+}
+
+static void wqi_show_stall(struct seq_file *seq)
+{
+	u64 wd_ns = READ_ONCE(wqi_pats[0].first_ns);
+
+	seq_printf(seq, "# stall: %s pool, cpu %d, %u ms; settle %u ms\n",
+		   wqp_names[wqi_type], stall_cpu, stall_ms, settle_ms);
+	if (!wqi_t_start) {
+		seq_puts(seq, "#  stall work not yet begun\n");
+		return;
+	}
+	seq_printf(seq, "#  queue-to-start %llu us, ran for %llu ms\n",
+		   (wqi_t_start - wqi_t_queue) / NSEC_PER_USEC,
+		   wqi_t_end ? (wqi_t_end - wqi_t_start) / NSEC_PER_MSEC : 0);
+	if (wd_ns)
+		seq_printf(seq, "#  %s reported %llu ms after the stall began\n",
+			   wqi_pats[0].label, (wd_ns - wqi_t_start) / NSEC_PER_MSEC);
+	else
+		seq_printf(seq, "#  %s hasn't reported\n", wqi_pats[0].label);
+	if (atomic_read(&wqi_ran_during))
+		seq_printf(seq, "#  NOT stalled: the pool ran %d probe items meanwhile (CPU_INTENSIVE? raise workqueue.cpu_intensive_thresh_us)\n",
+			   atomic_read(&wqi_ran_during));
+}
+
+static int wqp_results_show(struct seq_file *seq, void *v)
+{
+	enum wqp_phase phase;
+	enum wqp_type type;
+	int cpu;
+
+	if (mode == MODE_PROFILE)
+		seq_printf(seq, "# %d CPU(s) x %u Hz x %u ms; %s\n", num_online_cpus(), rate_hz,
+			   duration_ms, atomic_read(&wqp_running) ? "running" : "done");
+	else
+		wqi_show_stall(seq);
+
+	for (phase = 0; phase < WQP_NUM_PHASES; phase++) {
+		if (mode == MODE_PROFILE && phase != WQP_PH_BEFORE)
+			break;
+		if (mode == MODE_INJECT)
+			seq_printf(seq, "=== %s ===\n", wqp_phase_names[phase]);
+		for (type = 0; type < WQP_NUM_TYPES; type++) {
+			u64 missed = 0;
+
+			for_each_possible_cpu(cpu)
+				missed += per_cpu(wqp_pcpu, cpu).missed[phase][type];
+			seq_printf(seq, "%s: missed (previous item still pending) %llu\n",
+				   wqp_names[type], missed);
+			seq_printf(seq, "  # %4s %10s %12s %12s\n", "cpu", "runs", "avg ns", "max ns");
+			for_each_possible_cpu(cpu) {
+				struct wqp_hist *h = &per_cpu(wqp_pcpu, cpu).hist[phase][type];
+
+				if (!h->cnt)
+					continue;
+				seq_printf(seq, "    %4d %10llu %12llu %12llu\n", cpu, h->cnt,
+					   div64_u64(h->sum_ns, h->cnt), h->max_ns);
+				wqp_show_hist(seq, h->bkt);
+			}
+		}
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(wqp_results);
+
+/* A one-line-per-workqueue (and phase) summary, for the kernel log */
+static void wqp_summary(void)
+{
+	enum wqp_phase phase;
+	enum wqp_type type;
+	int cpu;
+
+	for (phase = 0; phase < WQP_NUM_PHASES; phase++) {
+		if (mode == MODE_PROFILE && phase != WQP_PH_BEFORE)
+			break;
+		for (type = 0; type < WQP_NUM_TYPES; type++) {
+			u64 cnt = 0, sum = 0, max_ns = 0, missed = 0;
+
+			for_each_possible_cpu(cpu) {
+				struct wqp_cpu *pc = &per_cpu(wqp_pcpu, cpu);
+
+				cnt += pc->hist[phase][type].cnt;
+				sum += pc->hist[phase][type].sum_ns;
+				max_ns = max(max_ns, pc->hist[phase][type].max_ns);
+				missed += pc->missed[phase][type];
+			}
+			pr_info("%s%s%-15s: runs %llu, latency avg %llu ns, max %llu ns; missed %llu\n",
+				mode == MODE_INJECT ? wqp_phase_names[phase] : "",
+				mode == MODE_INJECT ? ": " : "",
+				wqp_names[type], cnt, cnt ? div64_u64(sum, cnt) : 0, max_ns, missed);
+		}
+	}
+	if (mode == MODE_INJECT && wqi_pats[0].first_ns && wqi_t_start)
+		pr_info("%s reported %llu ms after the stall began\n", wqi_pats[0].label,
+			(wqi_pats[0].first_ns - wqi_t_start) / NSEC_PER_MSEC);
+	if (mode == MODE_INJECT && atomic_read(&wqi_ran_during))
+		pr_warn("the %s pool wasn't stalled: it ran %d probe items during the stall; the stall worker was likely marked CPU_INTENSIVE (raise workqueue.cpu_intensive_thresh_us above stall_ms)\n",
+			wqp_names[wqi_type], atomic_read(&wqi_ran_during));
+}
+
+static void profile_stop(void)
+{
+	enum wqp_type type;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct wqp_cpu *pc = &per_cpu(wqp_pcpu, cpu);
+
+		if (pc->producer) {
+			kthread_stop(pc->producer);
+			put_task_struct(pc->producer);
+			pc->producer = NULL;
+		}
+		for (type = 0; type < WQP_NUM_TYPES; type++)
+			cancel_work_sync(&pc->item[type].work);
+	}
+	if (mode == MODE_INJECT) {
+		cancel_work_sync(&wqi_stall_work);
+		console_watch_stop();
+	}
+	if (wqp_custom_wq) {
+		destroy_workqueue(wqp_custom_wq);
+		wqp_custom_wq = NULL;
+	}
+}
+
+static int wqp_start_producer(int cpu)
+{
+	struct wqp_cpu *pc = &per_cpu(wqp_pcpu, cpu);
+	struct task_struct *t;
+
+	t = kthread_create(wqp_producer, pc, "lkd/wqprof/%d", cpu);
+	if (IS_ERR(t)) {
+		pr_warn("kthread_create on cpu %d failed (%ld)\n", cpu, PTR_ERR(t));
+		return PTR_ERR(t);
+	}
+	get_task_struct(t);
+	kthread_bind(t, cpu);
+	pc->producer = t;
+	wake_up_process(t);
+	return 0;
+}
+
+static int profile_start(void)
+{
+	enum wqp_type type;
+	int cpu, ret = 0;
+
+	if (!rate_hz || rate_hz > 100000) {
+		pr_warn("rate_hz (%u) must be in [1..100000]\n", rate_hz);
+		return -EINVAL;
+	}
+	if (mode == MODE_INJECT) {
+		wqi_type = WQP_NUM_TYPES;
+		for (type = 0; type < WQP_NUM_TYPES; type++)
+			if (!strcmp(stall_wq, wqp_names[type]))
+				wqi_type = type;
+		if (wqi_type == WQP_NUM_TYPES) {
+			pr_warn("unknown stall_wq '%s'\n", stall_wq);
+			return -EINVAL;
+		}
+		if (wqi_type == WQP_UNBOUND) {
+			/* stall_cpu would only be a hint, and a busy worker never holds up the others */
+			pr_warn("stall_wq system_unbound can't be stalled: unbound pools aren't concurrency-managed\n");
+			return -EINVAL;
+		}
+		if (stall_cpu < 0 || stall_cpu >= nr_cpu_ids || !cpu_online(stall_cpu)) {
+			pr_warn("stall_cpu %d isn't online\n", stall_cpu);
+			return -EINVAL;
+		}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+		/* the threshold's not exported; all we can do is remind */
+		pr_notice("the stall worker turns CPU_INTENSIVE (and stops blocking its pool) after workqueue.cpu_intensive_thresh_us; raise it above stall_ms first: echo %llu > /sys/module/workqueue/parameters/cpu_intensive_thresh_us\n",
+			  ((u64)stall_ms + 1000) * USEC_PER_MSEC);
+#endif
+	}
+
+	wqp_custom_wq = alloc_workqueue("lkd_wq_prof", 0, 0);
+	if (!wqp_custom_wq)
+		return -ENOMEM;
+	wqp_wq[WQP_SYSTEM] = system_wq;
+	wqp_wq[WQP_UNBOUND] = system_unbound_wq;
+	wqp_wq[WQP_HIGHPRI] = system_highpri_wq;
+	wqp_wq[WQP_CUSTOM] = wqp_custom_wq;
+
+	for_each_possible_cpu(cpu) {
+		struct wqp_cpu *pc = &per_cpu(wqp_pcpu, cpu);
+
+		for (type = 0; type < WQP_NUM_TYPES; type++) {
+			INIT_WORK(&pc->item[type].work, wqp_work_func);
+			pc->item[type].type = type;
+			pc->item[type].done = 1;
+		}
+	}
+
+	if (IS_ENABLED(CONFIG_DEBUG_FS)) {
+		wqp_dbgfs_dir = debugfs_create_dir(KBUILD_MODNAME, NULL);
+		if (!IS_ERR_OR_NULL(wqp_dbgfs_dir))
+			debugfs_create_file("results", 0444, wqp_dbgfs_dir, NULL,
+					    &wqp_results_fops);
+	}
+
+	if (mode == MODE_INJECT) {
+		INIT_WORK(&wqi_stall_work, wqi_stall_func);
+		/* not fatal; we just won't know when the watchdog fired */
+		console_watch_start(wqi_pats, ARRAY_SIZE(wqi_pats));
+
+		/* the probe workload runs only on the stalled CPU */
+		atomic_set(&wqp_running, 1);
+		ret = wqp_start_producer(stall_cpu);
+		if (ret)
+			goto out_fail;
+		pr_info("probing %d workqueues on cpu %d @ %u Hz; stalling the %s pool in %u ms\n",
+			WQP_NUM_TYPES, stall_cpu, rate_hz, wqp_names[wqi_type], settle_ms);
+		return 0;
+	}
+
+	atomic_set(&wqp_running, num_online_cpus());
+	for_each_online_cpu(cpu) {
+		ret = wqp_start_producer(cpu);
+		if (ret)
+			goto out_fail;
+	}
+	pr_info("profiling %d CPU(s) x %d workqueues @ %u Hz for %u ms\n",
+		num_online_cpus(), WQP_NUM_TYPES, rate_hz, duration_ms);
+	return 0;
+
+ out_fail:
+	/* the ones never started won't decrement it */
+	atomic_set(&wqp_running, 0);
+	profile_stop();
+	debugfs_remove_recursive(wqp_dbgfs_dir);
+	return ret;
+}
+
+static int __init workq_simple_init(void)
+{
+	switch (mode) {
+	case MODE_STALL:
+		return stall_start();
+	case MODE_PROFILE:
+	case MODE_INJECT:
+		return profile_start();
+	default:
+		pr_warn("invalid mode %d\n", mode);
+		return -EINVAL;
+	}
+}
+
+static void __exit workq_simple_exit(void)
+{
+	if (mode == MODE_STALL)
+		stall_stop();
+	else {
+		debugfs_remove_recursive(wqp_dbgfs_dir);
+		profile_stop();
+		wqp_summary();
+	}
 	pr_info("removed\n");
 }
 
@@ -0,0 +1,454 @@
+/*
+ * ch5/alloc_bench/alloc_bench.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Debugging"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+ *
+ * From: Ch 5: Debugging kernel memory issues
+ ****************************************************************
+ * Brief Description:
+ * The kmembugs_test and miscdrv_rdwr code use kmalloc(), kzalloc(), vmalloc()
+ * and kvmalloc() without a second thought; which one is actually cheapest for
+ * a given size? This module measures the alloc and free latency (and thus the
+ * throughput) of the kernel's memory allocators:
+ *  kmalloc, a dedicated kmem_cache (slab), alloc_pages (page allocator),
+ *  vmalloc, kvmalloc and mempool (backed by kmalloc)
+ * sweeping both the allocation size and the number of CPUs allocating
+ * concurrently (1, 2, 4, ... up to all online CPUs).
+ *
+ * On each participating CPU a bound kernel thread allocates a batch of objects
+ * and then frees them, over and over; we time the alloc and the free halves
+ * separately.
+ *
+ * Usage (debugfs):
+ *  echo 1 > /sys/kernel/debug/alloc_bench/run     # blocks until done
+ *  cat /sys/kernel/debug/alloc_bench/results
+ * Tune the run via the module parameters (sizes, iters, batch, max_cpus); they
+ * are writable at runtime under /sys/module/alloc_bench/parameters/ .
+ *
+ * For details, please refer the book, Ch 5.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/mempool.h>
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
+#include <linux/wait.h>
+#include <linux/completion.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "../../convenient.h"
+
+MODULE_AUTHOR("<insert your name here>");
+MODULE_DESCRIPTION("LKD book:ch5/alloc_bench: kernel memory allocator latency/throughput microbenchmark");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+#define AB_MAX_SIZES	16
+static unsigned int sizes[AB_MAX_SIZES] = { 32, 256, 1024, 4096, 16384, 65536 };
+static int nr_sizes = 6;
+module_param_array(sizes, uint, &nr_sizes, 0644);
+MODULE_PARM_DESC(sizes, "Allocation sizes (bytes) to sweep (comma-separated; default 32,256,1024,4096,16384,65536)");
+
+static unsigned int iters = 20000;
+module_param(iters, uint, 0644);
+MODULE_PARM_DESC(iters, "# of alloc+free operations per CPU, per allocator and size (default 20000)");
+
+static unsigned int batch = 32;
+module_param(batch, uint, 0644);
+MODULE_PARM_DESC(batch, "# of objects allocated before freeing them all (default 32)");
+
+static unsigned int max_cpus;
+module_param(max_cpus, uint, 0644);
+MODULE_PARM_DESC(max_cpus, "Max # of CPUs to sweep up to (default 0: all online CPUs)");
+
+enum ab_type {
+	AB_KMALLOC,
+	AB_KMEM_CACHE,
+	AB_ALLOC_PAGES,
+	AB_VMALLOC,
+	AB_KVMALLOC,
+	AB_MEMPOOL,
+	AB_NUM_TYPES
+};
+
+static const char * const ab_names[AB_NUM_TYPES] = {
+	[AB_KMALLOC]     = "kmalloc",
+	[AB_KMEM_CACHE]  = "kmem_cache",
+	[AB_ALLOC_PAGES] = "alloc_pages",
+	[AB_VMALLOC]     = "vmalloc",
+	[AB_KVMALLOC]    = "kvmalloc",
+	[AB_MEMPOOL]     = "mempool",
+};
+
+struct ab_stat {
+	int cpu;
+	u64 alloc_ns, free_ns, ops;
+	unsigned long fails;
+};
+
+/* One of these per (allocator, size, # of CPUs) run; kept for the results file */
+struct ab_result {
+	struct list_head list;
+	enum ab_type type;
+	size_t size;
+	int ncpus;
+	struct ab_stat stat[];	/* [ncpus] */
+};
+
+/* Shared by all the threads of a given run */
+struct ab_ctx {
+	enum ab_type type;
+	size_t size;
+	unsigned int order;
+	struct kmem_cache *cache;
+	mempool_t *pool;
+	unsigned int iters, batch;
+	bool go;
+	wait_queue_head_t wq;
+	atomic_t running;
+	struct completion done;
+};
+
+struct ab_thr {
+	struct ab_ctx *ctx;
+	struct ab_stat *st;
+	void **objs;
+};
+
+static LIST_HEAD(ab_results);
+static DEFINE_MUTEX(ab_mutex);	/* one run at a time; protects ab_results */
+static struct dentry *ab_dbgfs_dir;
+
+static inline void *ab_alloc(struct ab_ctx *ctx)
+{
+	switch (ctx->type) {
+	case AB_KMALLOC:
+		return kmalloc(ctx->size, GFP_KERNEL);
+	case AB_KMEM_CACHE:
+		return kmem_cache_alloc(ctx->cache, GFP_KERNEL);
+	case AB_ALLOC_PAGES:
+		return alloc_pages(GFP_KERNEL, ctx->order);
+	case AB_VMALLOC:
+		return vmalloc(ctx->size);
+	case AB_KVMALLOC:
+		return kvmalloc(ctx->size, GFP_KERNEL);
+	case AB_MEMPOOL:
+		return mempool_alloc(ctx->pool, GFP_KERNEL);
+	default:
+		return NULL;
+	}
+}
+
+static inline void ab_free(struct ab_ctx *ctx, void *obj)
+{
+	switch (ctx->type) {
+	case AB_KMALLOC:
+		kfree(obj);
+		break;
+	case AB_KMEM_CACHE:
+		kmem_cache_free(ctx->cache, obj);
+		break;
+	case AB_ALLOC_PAGES:
+		__free_pages((struct page *)obj, ctx->order);
+		break;
+	case AB_VMALLOC:
+		vfree(obj);
+		break;
+	case AB_KVMALLOC:
+		kvfree(obj);
+		break;
+	case AB_MEMPOOL:
+		mempool_free(obj, ctx->pool);
+		break;
+	default:
+		break;
+	}
+}
+
+/* The per-CPU worker: alloc a batch, free the batch; repeat */
+static int ab_thread(void *arg)
+{
+	struct ab_thr *thr = arg;
+	struct ab_ctx *ctx = thr->ctx;
+	struct ab_stat *st = thr->st;
+	unsigned int done, i, n;
+	u64 t0, t1, t2;
+
+	/* Wait for all the threads of this run to be ready, then go together */
+	wait_event(ctx->wq, READ_ONCE(ctx->go));
+
+	for (done = 0; done < ctx->iters; done += n) {
+		n = min(ctx->batch, ctx->iters - done);
+
+		t0 = ktime_get_ns();
+		for (i = 0; i < n; i++)
+			thr->objs[i] = ab_alloc(ctx);
+		t1 = ktime_get_ns();
+		for (i = 0; i < n; i++) {
+			if (likely(thr->objs[i]))
+				ab_free(ctx, thr->objs[i]);
+			else
+				st->fails++;
+		}
+		t2 = ktime_get_ns();
+
+		st->alloc_ns += t1 - t0;
+		st->free_ns += t2 - t1;
+		st->ops += n;
+		cond_resched();
+	}
+
+	if (atomic_dec_and_test(&ctx->running))
+		complete(&ctx->done);
+	return 0;
+}
+
+/* Run allocator @type at @size on the first @ncpus online CPUs */
+static int ab_run_one(enum ab_type type, size_t size, int ncpus)
+{
+	struct ab_ctx ctx = {
+		.type = type,
+		.size = size,
+		.order = get_order(size),
+		.iters = iters,
+		.batch = batch,
+	};
+	struct ab_result *res;
+	struct ab_thr *thr;
+	int cpu, i = 0, started = 0, ret = 0;
+
+	res = kzalloc(struct_size(res, stat, ncpus), GFP_KERNEL);
+	thr = kcalloc(ncpus, sizeof(*thr), GFP_KERNEL);
+	if (!res || !thr) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+	res->type = type;
+	res->size = size;
+	res->ncpus = ncpus;
+	init_waitqueue_head(&ctx.wq);
+	init_completion(&ctx.done);
+
+	if (type == AB_KMEM_CACHE) {
+		ctx.cache = kmem_cache_create("alloc_bench", size, 0, 0, NULL);
+		if (!ctx.cache) {
+			ret = -ENOMEM;
+			goto out_free;
+		}
+	} else if (type == AB_MEMPOOL) {
+		/* enough reserved elements to cover every in-flight batch */
+		ctx.pool = mempool_create_kmalloc_pool(batch * ncpus, size);
+		if (!ctx.pool) {
+			ret = -ENOMEM;
+			goto out_free;
+		}
+	}
+
+	for_each_online_cpu(cpu) {
+		struct task_struct *t;
+
+		if (i >= ncpus)
+			break;
+		thr[i].ctx = &ctx;
+		thr[i].st = &res->stat[i];
+		thr[i].st->cpu = cpu;
+		thr[i].objs = kcalloc(batch, sizeof(void *), GFP_KERNEL);
+		if (!thr[i].objs) {
+			ret = -ENOMEM;
+			break;
+		}
+		t = kthread_create(ab_thread, &thr[i], "ab/%d", cpu);
+		if (IS_ERR(t)) {
+			ret = PTR_ERR(t);
+			break;
+		}
+		kthread_bind(t, cpu);
+		atomic_inc(&ctx.running);
+		wake_up_process(t);
+		started++;
+		i++;
+	}
+
+	/* Release the threads (even on error, so that the started ones finish) */
+	WRITE_ONCE(ctx.go, true);
+	wake_up_all(&ctx.wq);
+	if (started)
+		wait_for_completion(&ctx.done);
+
+	if (!ret) {
+		list_add_tail(&res->list, &ab_results);
+		res = NULL;
+	}
+
+	for (i = 0; i < ncpus; i++)
+		kfree(thr[i].objs);
+	if (ctx.pool)
+		mempool_destroy(ctx.pool);
+	if (ctx.cache)
+		kmem_cache_destroy(ctx.cache);
+ out_free:
+	kfree(thr);
+	kfree(res);
+	return ret;
+}
+
+static void ab_free_results(void)
+{
+	struct ab_result *res, *tmp;
+
+	list_for_each_entry_safe(res, tmp, &ab_results, list) {
+		list_del(&res->list);
+		kfree(res);
+	}
+}
+
+static int ab_run_all(void)
+{
+	int ncpus, maxc = num_online_cpus(), si, ret = 0;
+	enum ab_type type;
+
+	if (max_cpus && max_cpus < maxc)
+		maxc = max_cpus;
+	if (!iters || !batch || !nr_sizes) {
+		pr_warn("iters, batch and sizes must be non-zero\n");
+		return -EINVAL;
+	}
+
+	ab_free_results();
+	pr_info("running: %d sizes, up to %d cpus, %u iters/cpu, batch %u\n",
+		nr_sizes, maxc, iters, batch);
+	for (type = 0; type < AB_NUM_TYPES; type++) {
+		for (si = 0; si < nr_sizes; si++) {
+			/* 1, 2, 4, ... and finally all of them */
+			for (ncpus = 1; ; ncpus = min(ncpus * 2, maxc)) {
+				ret = ab_run_one(type, sizes[si], ncpus);
+				if (ret) {
+					pr_warn("%s, %u bytes, %d cpus: failed (%d)\n",
+						ab_names[type], sizes[si], ncpus, ret);
+					return ret;
+				}
+				if (ncpus == maxc)
+					break;
+			}
+		}
+	}
+	pr_info("done; see the debugfs results file\n");
+	return 0;
+}
+
+/* ops per second, given @ops operations in @ns nanoseconds */
+static inline u64 ab_rate(u64 ops, u64 ns)
+{
+	return ns ? div64_u64(ops * NSEC_PER_SEC, ns) : 0;
+}
+
+static int ab_results_show(struct seq_file *seq, void *v)
+{
+	struct ab_result *res;
+	int i;
+
+	mutex_lock(&ab_mutex);
+	seq_printf(seq, "# alloc_bench: %u iters/cpu, batch %u; latencies are per op (ns)\n"
+		   "# %-12s %8s %5s %12s %9s %9s %6s\n",
+		   iters, batch, "allocator", "size", "ncpu", "total op/s",
+		   "alloc-ns", "free-ns", "fails");
+	list_for_each_entry(res, &ab_results, list) {
+		u64 ops = 0, ans = 0, fns = 0, rate = 0;
+		unsigned long fails = 0;
+
+		for (i = 0; i < res->ncpus; i++) {
+			struct ab_stat *st = &res->stat[i];
+
+			ops += st->ops;
+			ans += st->alloc_ns;
+			fns += st->free_ns;
+			fails += st->fails;
+			rate += ab_rate(st->ops, st->alloc_ns + st->free_ns);
+		}
+		seq_printf(seq, "  %-12s %8zu %5d %12llu %9llu %9llu %6lu\n",
+			   ab_names[res->type], res->size, res->ncpus, rate,
+			   ops ? div64_u64(ans, ops) : 0, ops ? div64_u64(fns, ops) : 0, fails);
+		if (res->ncpus == 1)
+			continue;
+		for (i = 0; i < res->ncpus; i++) {
+			struct ab_stat *st = &res->stat[i];
+
+			seq_printf(seq, "     cpu %3d %21s %12llu %9llu %9llu %6lu\n",
+				   st->cpu, "", ab_rate(st->ops, st->alloc_ns + st->free_ns),
+				   st->ops ? div64_u64(st->alloc_ns, st->ops) : 0,
+				   st->ops ? div64_u64(st->free_ns, st->ops) : 0, st->fails);
+		}
+	}
+	mutex_unlock(&ab_mutex);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ab_results);
+
+static ssize_t ab_run_write(struct file *filp, const char __user *ubuf, size_t count,
+			    loff_t *fpos)
+{
+	int ret;
+
+	if (!mutex_trylock(&ab_mutex))
+		return -EBUSY;
+	ret = ab_run_all();
+	mutex_unlock(&ab_mutex);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations ab_run_fops = {
+	.write = ab_run_write,
+};
+
+static int __init alloc_bench_init(void)
+{
+	if (!IS_ENABLED(CONFIG_DEBUG_FS)) {
+		pr_warn("debugfs unsupported! Aborting ...\n");
+		return -EINVAL;
+	}
+	if (nr_sizes <= 0) {
+		pr_warn("pass at least one allocation size\n");
+		return -EINVAL;
+	}
+
+	ab_dbgfs_dir = debugfs_create_dir(KBUILD_MODNAME, NULL);
+	if (IS_ERR_OR_NULL(ab_dbgfs_dir)) {
+		pr_info("debugfs_create_dir failed, aborting...\n");
+		return ab_dbgfs_dir ? PTR_ERR(ab_dbgfs_dir) : -ENOMEM;
+	}
+	debugfs_create_file("run", 0200, ab_dbgfs_dir, NULL, &ab_run_fops);
+	debugfs_create_file("results", 0444, ab_dbgfs_dir, NULL, &ab_results_fops);
+
+	pr_info("loaded; write to <debugfs>/%s/run to start, read results from <debugfs>/%s/results\n",
+		KBUILD_MODNAME, KBUILD_MODNAME);
+	return 0;		/* success */
+}
+
+static void __exit alloc_bench_exit(void)
+{
+	debugfs_remove_recursive(ab_dbgfs_dir);
+	mutex_lock(&ab_mutex);
+	ab_free_results();
+	mutex_unlock(&ab_mutex);
+	pr_info("removed\n");
+}
+
+module_init(alloc_bench_init);
+module_exit(alloc_bench_exit);
@@ -73,6 +73,7 @@ void test_ubsan_object_size_mismatch(void);
 
 noinline void oob_copy_user_test(void);	// testcase 9
 int umr_slub(void);		// SLUB debug testcase, testcase 10
+int usercopy_bench(void);	// usercopy throughput benchmark, testcase 11
 //----------------------------------------------
 
 struct dentry *gparent;
@@ -160,6 +161,8 @@ static ssize_t dbgfs_run_testcase(struct file *filp, const char __user *ubuf, si
 		oob_copy_user_test();
 	else if (!strncmp(udata, "10", 3))
 		umr_slub();
+	else if (!strncmp(udata, "11", 3))
+		usercopy_bench();
 	else
 		pr_warn("Invalid testcase # (%s) passed\n", udata);
 
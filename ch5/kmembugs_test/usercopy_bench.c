@@ -0,0 +1,217 @@
+/*
+ * ch5/kmembugs_test/usercopy_bench.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Debugging"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+ *
+ * From: Ch 5: Debugging kernel memory issues
+ ****************************************************************
+ * Brief Description:
+ * A sibling of the oob_copy_user_test() testcase (#9): instead of deliberately
+ * overflowing the kernel buffer, we benchmark the very same user <-> kernel
+ * copy routines - [__]copy_{from,to}_user[_inatomic]() and strncpy_from_user() -
+ * sweeping the transfer size from 8 bytes to 1 MB. For each API and size we
+ * report the throughput (GB/s) and the cost in CPU cycles per byte.
+ *
+ * The hardened usercopy checks (CONFIG_HARDENED_USERCOPY, the
+ * check_object_size() call) are performed by all the [__]copy_*_user*()
+ * wrappers; to see what they cost, we also time the underlying arch-specific
+ * raw_copy_{from,to}_user() routines, which skip them.
+ *
+ * Run it via the debugfs file, as testcase 11:
+ *  echo 11 > /sys/kernel/debug/test_kmembugs/lkd_dbgfs_run_testcase
+ * The user memory is vm_mmap()'ed into the address space of the process
+ * writing to the debugfs file (just as with testcase 9).
+ *
+ * For details, please refer the book, Ch 5.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/timex.h>	/* get_cycles() */
+#include <linux/uaccess.h>
+#include <uapi/asm-generic/mman-common.h>
+#include <uapi/linux/mman.h>
+
+#define UCB_MINSZ		8
+#define UCB_MAXSZ		(1024 * 1024)
+/* Copy (about) this many bytes per API per size; keeps each run short */
+#define UCB_BYTES_PER_RUN	(16 * 1024 * 1024)
+#define UCB_MINITER		16
+#define UCB_MAXITER		(1024 * 1024)
+
+enum ucb_api {
+	UCB_COPY_FROM_USER,
+	UCB___COPY_FROM_USER,
+	UCB___COPY_FROM_USER_INATOMIC,
+	UCB_RAW_COPY_FROM_USER,
+	UCB_COPY_TO_USER,
+	UCB___COPY_TO_USER,
+	UCB___COPY_TO_USER_INATOMIC,
+	UCB_RAW_COPY_TO_USER,
+	UCB_STRNCPY_FROM_USER,
+	UCB_NUM_APIS
+};
+
+static const struct {
+	const char *name;
+	bool hardened;	/* does it go via check_object_size() ? */
+} ucb_apis[UCB_NUM_APIS] = {
+	[UCB_COPY_FROM_USER]		= { "copy_from_user", true },
+	[UCB___COPY_FROM_USER]		= { "__copy_from_user", true },
+	[UCB___COPY_FROM_USER_INATOMIC]	= { "__copy_from_user_inatomic", true },
+	[UCB_RAW_COPY_FROM_USER]	= { "raw_copy_from_user", false },
+	[UCB_COPY_TO_USER]		= { "copy_to_user", true },
+	[UCB___COPY_TO_USER]		= { "__copy_to_user", true },
+	[UCB___COPY_TO_USER_INATOMIC]	= { "__copy_to_user_inatomic", true },
+	[UCB_RAW_COPY_TO_USER]		= { "raw_copy_to_user", false },
+	[UCB_STRNCPY_FROM_USER]		= { "strncpy_from_user", false },
+};
+
+/*
+ * Loop @iters times over @stmt; a macro (and not a function pointer) as most
+ * of these APIs are inline, and an indirect call would swamp the small sizes.
+ */
+#define UCB_LOOP(iters, stmt) do {          \
+	unsigned long __i;                      \
+	for (__i = 0; __i < (iters); __i++) {   \
+		stmt;                               \
+	}                                       \
+} while (0)
+
+/*
+ * Time @iters copies of @n bytes via API @api; returns the # of bytes that
+ * could not be copied (should be 0), the time taken in @ns and @cycles.
+ */
+static unsigned long ucb_run(enum ucb_api api, void *kmem, void __user *umem,
+			     size_t n, unsigned long iters, u64 *ns, u64 *cycles)
+{
+	unsigned long left = 0;
+	cycles_t c0, c1;
+	u64 t0, t1;
+
+	t0 = ktime_get_ns();
+	c0 = get_cycles();
+	switch (api) {
+	case UCB_COPY_FROM_USER:
+		UCB_LOOP(iters, left += copy_from_user(kmem, umem, n));
+		break;
+	case UCB___COPY_FROM_USER:
+		UCB_LOOP(iters, left += __copy_from_user(kmem, umem, n));
+		break;
+	case UCB___COPY_FROM_USER_INATOMIC:
+		pagefault_disable();
+		UCB_LOOP(iters, left += __copy_from_user_inatomic(kmem, umem, n));
+		pagefault_enable();
+		break;
+	case UCB_RAW_COPY_FROM_USER:
+		UCB_LOOP(iters, left += raw_copy_from_user(kmem, umem, n));
+		break;
+	case UCB_COPY_TO_USER:
+		UCB_LOOP(iters, left += copy_to_user(umem, kmem, n));
+		break;
+	case UCB___COPY_TO_USER:
+		UCB_LOOP(iters, left += __copy_to_user(umem, kmem, n));
+		break;
+	case UCB___COPY_TO_USER_INATOMIC:
+		pagefault_disable();
+		UCB_LOOP(iters, left += __copy_to_user_inatomic(umem, kmem, n));
+		pagefault_enable();
+		break;
+	case UCB_RAW_COPY_TO_USER:
+		UCB_LOOP(iters, left += raw_copy_to_user(umem, kmem, n));
+		break;
+	case UCB_STRNCPY_FROM_USER:
+		/* the user buffer has no NUL, so it always copies all n bytes */
+		UCB_LOOP(iters, left += (strncpy_from_user(kmem, umem, n) < 0 ? n : 0));
+		break;
+	default:
+		break;
+	}
+	c1 = get_cycles();
+	t1 = ktime_get_ns();
+
+	*ns = t1 - t0;
+	*cycles = (u64)(c1 - c0);
+	return left;
+}
+
+/*
+ * usercopy_bench(): testcase 11
+ * MUST be called from process context (with a user address space); we're
+ * invoked via a write to our debugfs file, so that's fine.
+ */
+int usercopy_bench(void)
+{
+	char *kmem;
+	char __user *usermem;
+	size_t sz;
+	int api, ret = 0;
+
+	if (!current->mm) {
+		pr_warn("no user address space (kernel thread?), aborting\n");
+		return -EINVAL;
+	}
+	kmem = kmalloc(UCB_MAXSZ, GFP_KERNEL);
+	if (unlikely(!kmem))
+		return -ENOMEM;
+	memset(kmem, 'x', UCB_MAXSZ);
+
+	/* Prefault the user pages, so that the _inatomic() variants don't fail */
+	usermem = (char __user *)vm_mmap(NULL, 0, UCB_MAXSZ,
+					 PROT_READ | PROT_WRITE,
+					 MAP_ANONYMOUS | MAP_PRIVATE | MAP_POPULATE, 0);
+	if (IS_ERR(usermem)) {
+		pr_err("Failed to allocate user memory\n");
+		kfree(kmem);
+		return PTR_ERR(usermem);
+	}
+	/* No NUL anywhere in the user buffer (for strncpy_from_user()) */
+	if (copy_to_user(usermem, kmem, UCB_MAXSZ)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	pr_info("testcase 11: usercopy throughput, %d to %d bytes (CONFIG_HARDENED_USERCOPY %s)\n",
+		UCB_MINSZ, UCB_MAXSZ,
+		IS_ENABLED(CONFIG_HARDENED_USERCOPY) ? "configured" : "NOT configured");
+	pr_info("%-26s %8s %8s %8s %10s %10s\n",
+		"api", "hardened", "size", "iters", "GB/s", "cycles/B");
+
+	for (api = 0; api < UCB_NUM_APIS; api++) {
+		for (sz = UCB_MINSZ; sz <= UCB_MAXSZ; sz <<= 1) {
+			unsigned long iters = clamp_t(unsigned long, UCB_BYTES_PER_RUN / sz,
+						      UCB_MINITER, UCB_MAXITER);
+			u64 ns, cycles, bytes = (u64)sz * iters, gbps, cpb;
+
+			/* warm up the caches and TLB */
+			ucb_run(api, kmem, usermem, sz, 1, &ns, &cycles);
+			if (ucb_run(api, kmem, usermem, sz, iters, &ns, &cycles)) {
+				pr_warn("%s(): %zu bytes: partial copy!\n", ucb_apis[api].name, sz);
+				ret = -EFAULT;
+				goto out;
+			}
+			/* bytes per ns is GB/s; keep two decimal places */
+			gbps = div64_u64(bytes * 100, ns ? ns : 1);
+			/* cycles per byte, three decimal places */
+			cpb = div64_u64(cycles * 1000, bytes);
+
+			pr_info("%-26s %8s %8zu %8lu %7llu.%02llu %6llu.%03llu\n",
+				ucb_apis[api].name, ucb_apis[api].hardened ? "yes" : "no",
+				sz, iters, gbps / 100, gbps % 100, cpb / 1000, cpb % 1000);
+			cond_resched();
+		}
+	}
+ out:
+	vm_munmap((unsigned long)usermem, UCB_MAXSZ);
+	kfree(kmem);
+	return ret;
+}
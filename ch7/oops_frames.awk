@@ -0,0 +1,90 @@
+# ch7/oops_frames.awk
+# ***************************************************************
+# This program is part of the source code released for the book
+#  "Linux Kernel Debugging"
+#  (c) Author: Kaiwan N Billimoria
+#  Publisher:  Packt
+#  GitHub repository:
+#  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+#
+# From: Ch 7: Oops! Interpreting the kernel bug diagnostic
+#***************************************************************
+# Brief Description:
+# Common awk functions for our Oops tooling (oops_symbolize.sh and friends):
+# recognizing the 'symbol+offset/size [module]' frames the kernel emits in
+# Oops, BUG, WARN and KASAN reports - in the Call Trace, the RIP:/pc : lines
+# and the like - and a little hex arithmetic.
+# Portable awk: no gawk extensions (mawk has no strtonum(), and its numbers
+# are doubles; so 64-bit addresses are handled as strings).
+#
+# For details, please refer the book, Ch 7.
+#------------------------------------------------------------------------------
+
+# frame_parse(line)
+# If @line holds a kernel 'symbol+0xoff/0xsize [module]' frame, return 1 and
+# set:
+#  FR_SYM   : the symbol
+#  FR_OFF   : the offset, hex, no '0x'
+#  FR_SIZE  : the symbol's size, hex, no '0x'
+#  FR_MOD   : the module ('vmlinux' if none)
+#  FR_UNREL : 1 if it's an unreliable ('? ' prefixed) frame
+#  FR_TOKEN : the matched text
+# else return 0.
+function frame_parse(line,    tok, n, parts, plus)
+{
+	if (!match(line, /[A-Za-z_.$][A-Za-z0-9_.$]*\+0x[0-9a-f]+\/0x[0-9a-f]+( \[[A-Za-z0-9_-]+\])?/))
+		return 0
+	tok = substr(line, RSTART, RLENGTH)
+	FR_TOKEN = tok
+	FR_UNREL = (RSTART > 2 && substr(line, RSTART - 2, 2) == "? ")
+	FR_MOD = "vmlinux"
+	n = index(tok, " [")
+	if (n) {
+		FR_MOD = substr(tok, n + 2, length(tok) - n - 2)
+		gsub(/-/, "_", FR_MOD)
+		tok = substr(tok, 1, n - 1)
+	}
+	plus = index(tok, "+0x")
+	FR_SYM = substr(tok, 1, plus - 1)
+	split(substr(tok, plus + 3), parts, "/0x")
+	FR_OFF = parts[1]
+	FR_SIZE = parts[2]
+	return 1
+}
+
+# hex_norm(h) : lowercase, no '0x', no leading zeros ("0" for zero)
+function hex_norm(h)
+{
+	h = tolower(h)
+	sub(/^0x/, "", h)
+	sub(/^0+/, "", h)
+	return h == "" ? "0" : h
+}
+
+# hex2num(h) : hex string -> number; exact only up to 13 hex digits (2^53)
+function hex2num(h,    i, n)
+{
+	h = hex_norm(h)
+	n = 0
+	for (i = 1; i <= length(h); i++)
+		n = n * 16 + index("0123456789abcdef", substr(h, i, 1)) - 1
+	return n
+}
+
+# hex_add(a, b) : a + b, both hex strings, a up to 64 bits, b < 2^32;
+# returns a normalized hex string
+function hex_add(a, b,    hi, lo)
+{
+	a = hex_norm(a)
+	while (length(a) < 16)
+		a = "0" a
+	hi = hex2num(substr(a, 1, 8))
+	lo = hex2num(substr(a, 9, 8)) + hex2num(b)
+	while (lo >= 4294967296) {
+		lo -= 4294967296
+		hi++
+	}
+	if (hi >= 4294967296)
+		hi -= 4294967296
+	return hex_norm(sprintf("%08x%08x", hi, lo))
+}
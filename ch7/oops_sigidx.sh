@@ -0,0 +1,256 @@
+#!/bin/bash
+# ch7/oops_sigidx.sh
+# ***************************************************************
+# This program is part of the source code released for the book
+#  "Linux Kernel Debugging"
+#  (c) Author: Kaiwan N Billimoria
+#  Publisher:  Packt
+#  GitHub repository:
+#  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+#
+# From: Ch 7: Oops! Interpreting the kernel bug diagnostic
+#***************************************************************
+# Brief Description:
+# Crash report de-duplication. Splits kernel log(s) into individual Oops /
+# BUG / WARNING / KASAN / UBSAN / panic reports and computes a stable
+# signature for each:
+#  - the fault type: the report's first line, with addresses, numbers and
+#    frame offsets normalized away;
+#  - the context: process (or process/wq, when a 'Workqueue:' line is
+#    present), softirq, irq or nmi - from the <SOFTIRQ>/<IRQ>/<NMI> markers
+#    in the call trace;
+#  - the top N (default 5) reliable frames (the RIP/pc function first),
+#    as 'symbol [module]', with compiler suffixes (.isra.0, .cold, ...)
+#    and the report/exception machinery (dump_stack, __warn, kasan_report,
+#    asm_exc_*, ...) dropped.
+# The signatures are kept in an on-disk index - a TSV file, one line per
+# bucket:
+#  signature count first-seen last-seen type context frames example
+# (times are epoch seconds: the time of the indexing run, or -t). Each run
+# makes a single pass over the log(s), so triaging a large corpus is linear;
+# it prints the unique buckets seen in this run, busiest first.
+# Works on the output of our ch7 Oops generators (oops_tryv1/v2 and
+# oops_inirqv3) as on any other kernel log.
+# The 'Kernel panic - not syncing: ...' that follows a report (panic_on_oops)
+# is taken as part of it. Regression check: testdata/test_oops_sigidx.sh
+#
+# For details, please refer the book, Ch 7.
+#------------------------------------------------------------------------------
+name=$(basename $0)
+LIB=$(dirname $0)/oops_frames.awk
+
+die()
+{
+ echo "${name}: $@" 1>&2
+ exit 1
+}
+
+usage()
+{
+ echo "Usage: ${name} [options] [logfile ...]
+ Bucket the crash reports in the given log file(s) (or stdin) by signature.
+  -i index : the signature index file (default: ~/.cache/lkd_oops/sigidx.tsv)
+  -n N     : # of frames in the signature (default 5)
+  -t epoch : the time to record as seen (default: now)
+  -l       : just list the whole index, busiest first
+  -q       : quiet; only update the index
+  -h       : this help"
+}
+
+INDEX=${HOME}/.cache/lkd_oops/sigidx.tsv
+NFRAMES=5
+NOW=$(date +%s)
+LIST=0
+QUIET=0
+
+while getopts "i:n:t:lqh" opt; do
+  case "${opt}" in
+    i) INDEX=${OPTARG} ;;
+    n) NFRAMES=${OPTARG} ;;
+    t) NOW=${OPTARG} ;;
+    l) LIST=1 ;;
+    q) QUIET=1 ;;
+    h) usage ; exit 0 ;;
+    *) usage ; exit 1 ;;
+  esac
+done
+shift $((OPTIND-1))
+
+[ -f ${LIB} ] || die "can't find ${LIB}"
+mkdir -p $(dirname ${INDEX}) || die "can't create $(dirname ${INDEX})"
+[ -f ${INDEX} ] || : > ${INDEX}
+
+if [ ${LIST} -eq 1 ] ; then
+  sort -t"	" -k2,2nr ${INDEX}
+  exit 0
+fi
+
+TMP=$(mktemp -d /tmp/${name}.XXXXXX) || die "mktemp failed"
+trap 'rm -rf ${TMP}' EXIT
+
+cat > ${TMP}/sig.awk << 'EOF'
+# A (cheap, stable) string hash: two 24-bit FNV-style halves, as 12 hex digits
+function sig_hash(s,    i, c, h1, h2) {
+	if (!ord_init) {
+		for (i = 0; i < 256; i++)
+			ord[sprintf("%c", i)] = i
+		ord_init = 1
+	}
+	h1 = 2166136; h2 = 7919
+	for (i = 1; i <= length(s); i++) {
+		c = ord[substr(s, i, 1)]
+		h1 = (h1 * 31 + c) % 16777213
+		h2 = (h2 * 131 + c) % 16777199
+	}
+	return sprintf("%06x%06x", h1, h2)
+}
+function strip_ts(line) {
+	sub(/^<[0-9]+>/, "", line)
+	sub(/^\[ *[0-9]+\.[0-9]+\] */, "", line)
+	sub(/^\[ *[A-Z]?[0-9]+\] */, "", line)		# [T123] / [C1] caller ids
+	return line
+}
+function norm_sym(s) {
+	# f.e. foo.isra.0, foo.constprop.0.cold, foo.part.0
+	while (sub(/\.(isra|constprop|part|cold|lto_priv|llvm)(\.[0-9]+)?$/, "", s))
+		;
+	return s
+}
+function norm_type(line,    t) {
+	t = line
+	while (frame_parse(t))
+		t = substr(t, 1, RSTART - 1) norm_sym(FR_SYM) substr(t, RSTART + RLENGTH)
+	gsub(/0x[0-9a-fA-F]+/, "X", t)
+	gsub(/[0-9a-fA-F][0-9a-fA-F][0-9a-fA-F][0-9a-fA-F][0-9a-fA-F][0-9a-fA-F][0-9a-fA-F][0-9a-fA-F]+/, "X", t)
+	gsub(/[0-9]+/, "N", t)
+	gsub(/  +/, " ", t)
+	return t
+}
+function is_header(line) {
+	return line ~ /^(BUG: |Oops|general protection fault|WARNING: |kernel BUG at |Unable to handle kernel |Internal error: |UBSAN: |Kernel panic - )/
+}
+# the headers that (also) follow a first one in the same report; f.e.
+# 'BUG: unable to handle page fault ...' and then 'Oops: 0000 [#1] ...'
+function is_followon(line) {
+	return line ~ /^(Oops|general protection fault|Internal error: |Kernel panic - )/
+}
+function new_report(line) {
+	finish_report()
+	in_rep = 1
+	r_type = norm_type(line)
+	r_ctx = "process"
+	r_wq = 0
+	r_nfr = 0
+	r_frames = ""
+	r_last = ""
+	r_where = FILENAME ":" FNR
+}
+function add_frame(sym, mod,    f) {
+	if (r_nfr >= NFRAMES)
+		return
+	sym = norm_sym(sym)
+	if (sym ~ SKIP)
+		return
+	f = sym (mod == "vmlinux" ? "" : " [" mod "]")
+	if (f == r_last)
+		return
+	r_last = f
+	r_frames = r_frames (r_nfr ? "," : "") f
+	r_nfr++
+}
+function finish_report(    ctx, key, s) {
+	if (!in_rep)
+		return
+	in_rep = 0
+	ctx = r_ctx (r_ctx == "process" && r_wq ? "/wq" : "")
+	key = r_type "|" ctx "|" r_frames
+	s = sig_hash(key)
+	run_cnt[s]++
+	if (!(s in cnt)) {
+		cnt[s] = 0
+		first[s] = NOW
+		type[s] = r_type
+		ctx_of[s] = ctx
+		frames[s] = r_frames
+		example[s] = r_where
+		is_new[s] = 1
+	}
+	cnt[s]++
+	last[s] = NOW
+}
+BEGIN {
+	FS = "\t"
+	PANIC_LINES = 20	# how far after a report's end its panic line can be
+	# the report/exception machinery: never part of a signature
+	SKIP = "^(dump_stack|dump_stack_lvl|show_stack|show_regs|show_trace_log_lvl|__warn|warn_slowpath_fmt|report_bug|handle_bug|exc_[a-z_]+|asm_exc_[a-z_]+|do_trap|do_error_trap|die|__die|__die_body|oops_end|oops_begin|page_fault_oops|kernelmode_fixup_or_oops|no_context|__bad_area_nosemaphore|bad_area_nosemaphore|do_user_addr_fault|do_kern_addr_fault|handle_page_fault|kasan_report|__kasan_report|print_report|print_address_description|kasan_check_range|__asan_[a-z0-9_]+|__kasan_[a-z0-9_]+|ubsan_[a-z0-9_]+|__ubsan_[a-z0-9_]+|panic|bug_handler|do_mem_abort|el1_[a-z0-9_]+|__do_kernel_fault|die_kernel_fault)$"
+}
+FILENAME == INDEX {
+	if (NF < 8)
+		next
+	cnt[$1] = $2; first[$1] = $3; last[$1] = $4
+	type[$1] = $5; ctx_of[$1] = $6; frames[$1] = $7; example[$1] = $8
+	next
+}
+{
+	line = strip_ts($0)
+	if (is_header(line)) {
+		# the 'Kernel panic - not syncing: Fatal exception' that (soon)
+		# follows a report's end marker is part of that report
+		if (line ~ /^Kernel panic - / && !in_rep && end_file == FILENAME &&
+		    FNR - end_fnr <= PANIC_LINES)
+			next
+		# a report's own follow-on headers (f.e. 'Oops: ...' after 'BUG: ...')
+		# don't start a new one; once its call trace has begun, they do. Any
+		# other header does: the report so far (frames or not) is finished
+		if (in_rep && !r_nfr && is_followon(line))
+			next
+		new_report(line)
+		next
+	}
+	if (!in_rep)
+		next
+	if (line ~ /^---\[ end trace/ || (line ~ /^==========/ && r_nfr)) {
+		finish_report()
+		end_file = FILENAME
+		end_fnr = FNR
+		next
+	}
+	if (line ~ /^Workqueue: /)
+		r_wq = 1
+	else if (line ~ /<NMI>/)
+		r_ctx = "nmi"
+	else if (line ~ /<IRQ>/ && r_ctx != "nmi")
+		r_ctx = "irq"
+	else if (line ~ /<SOFTIRQ>/ && r_ctx == "process")
+		r_ctx = "softirq"
+	else if (line ~ /^(RIP: |pc : |PC is at |NIP |epc : )/ && frame_parse(line))
+		add_frame(FR_SYM, FR_MOD)
+	else if (frame_parse(line) && !FR_UNREL && line !~ /^(lr : |LR is at |RA: )/)
+		add_frame(FR_SYM, FR_MOD)
+}
+END {
+	finish_report()
+	for (s in cnt)
+		printf "%s\t%d\t%s\t%s\t%s\t%s\t%s\t%s\n", s, cnt[s], first[s], last[s],
+			type[s], ctx_of[s], frames[s], example[s] > NEWINDEX
+	for (s in run_cnt)
+		printf "%d\t%d\t%s\t%s\t%s\t%s\t%s\n", run_cnt[s], cnt[s],
+			(s in is_new) ? "NEW" : "known", s, ctx_of[s], type[s], frames[s] > RUNOUT
+}
+EOF
+
+[ $# -eq 0 ] && set -- -
+awk -f ${LIB} -f ${TMP}/sig.awk -v INDEX=${INDEX} -v NFRAMES=${NFRAMES} \
+	-v NOW=${NOW} -v NEWINDEX=${TMP}/index -v RUNOUT=${TMP}/run ${INDEX} "$@" \
+	|| die "awk failed"
+# replace the index atomically (well, as atomically as mv is)
+cp ${TMP}/index ${INDEX}.tmp && mv ${INDEX}.tmp ${INDEX} || die "couldn't update ${INDEX}"
+
+[ ${QUIET} -eq 1 ] && exit 0
+[ -s ${TMP}/run ] || { echo "${name}: no crash reports found" ; exit 0 ; }
+nrep=$(awk -F"\t" '{ n += $1 } END { print n }' ${TMP}/run)
+echo "${nrep} report(s), $(wc -l < ${TMP}/run) unique bucket(s); index: ${INDEX}"
+printf "# %6s %7s %-5s %-12s %-10s %s\n#  %s\n" "run" "total" "" "signature" "context" "type" "frames"
+sort -t"	" -k1,1nr ${TMP}/run | awk -F"\t" '{
+	printf "  %6d %7d %-5s %-12s %-10s %s\n     %s\n", $1, $2, $3, $4, $5, $6, $7 }'
+exit 0
@@ -0,0 +1,318 @@
+#!/bin/bash
+# ch7/oops_symbolize.sh
+# ***************************************************************
+# This program is part of the source code released for the book
+#  "Linux Kernel Debugging"
+#  (c) Author: Kaiwan N Billimoria
+#  Publisher:  Packt
+#  GitHub repository:
+#  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+#
+# From: Ch 7: Oops! Interpreting the kernel bug diagnostic
+#***************************************************************
+# Brief Description:
+# Batch-decode kernel Oops / BUG / WARN / KASAN reports: every
+# 'symbol+0xoff/0xsize [module]' frame in the log(s) is resolved to
+# function, source file:line (and the inlined-by chain), optionally with the
+# source line itself - against vmlinux and the modules' .ko files.
+#
+# Unlike the kernel's scripts/decode_stacktrace.sh (and doing it by hand with
+# addr2line / gdb per frame), it's built for volume:
+#  - one pass over the log collects all the frames;
+#  - each object's symbol table (objdump -t) is extracted once and cached on
+#    disk, keyed by the object's path, size and mtime;
+#  - addresses are resolved with ONE addr2line run per object (and section),
+#    fed all the addresses at once; the results are cached too, so later runs
+#    only ever resolve addresses they've not seen before;
+#  - the annotation pass reads each source file at most once.
+# Frame addresses come from symbol+offset (not the raw - KASLR'd - address),
+# so it works on logs from any boot of the same build.
+#
+# For details, please refer the book, Ch 7.
+#------------------------------------------------------------------------------
+name=$(basename $0)
+LIB=$(dirname $0)/oops_frames.awk
+
+die()
+{
+ echo "${name}: $@" 1>&2
+ exit 1
+}
+
+usage()
+{
+ echo "Usage: ${name} [options] [logfile ...]
+ Decode Oops/BUG/KASAN frames in the given log file(s) (or stdin).
+  -k vmlinux    : the vmlinux (with debug info) to resolve core kernel frames
+                  (default: /usr/lib/debug/boot/vmlinux-$(uname -r), else
+                  /lib/modules/$(uname -r)/build/vmlinux)
+  -m dir        : search dir (recursively) for module .ko files; repeatable
+                  (default: . and /lib/modules/$(uname -r))
+  -s            : also show the source line(s)
+  -S srcdir     : where to look for the sources, if not at the path recorded
+                  in the debug info (f.e. the kernel source tree)
+  -c cachedir   : the symbol/address cache (default: ~/.cache/lkd_oops)
+  -h            : this help"
+}
+
+VMLINUX=""
+MODDIRS=()
+SHOWSRC=0
+SRCDIR=""
+CACHE=${HOME}/.cache/lkd_oops
+
+while getopts "k:m:sS:c:h" opt; do
+  case "${opt}" in
+    k) VMLINUX=${OPTARG} ;;
+    m) MODDIRS+=("${OPTARG}") ;;
+    s) SHOWSRC=1 ;;
+    S) SRCDIR=${OPTARG} ;;
+    c) CACHE=${OPTARG} ;;
+    h) usage ; exit 0 ;;
+    *) usage ; exit 1 ;;
+  esac
+done
+shift $((OPTIND-1))
+
+[ -f ${LIB} ] || die "can't find ${LIB}"
+for tool in objdump addr2line awk ; do
+  which ${tool} >/dev/null 2>&1 || die "${tool} not installed? (binutils)"
+done
+if [ -z "${VMLINUX}" ] ; then
+  for f in /usr/lib/debug/boot/vmlinux-$(uname -r) /lib/modules/$(uname -r)/build/vmlinux ; do
+    [ -f ${f} ] && { VMLINUX=${f} ; break ; }
+  done
+fi
+[ ${#MODDIRS[@]} -eq 0 ] && MODDIRS=(. /lib/modules/$(uname -r))
+mkdir -p ${CACHE} || die "can't create cache dir ${CACHE}"
+
+TMP=$(mktemp -d /tmp/${name}.XXXXXX) || die "mktemp failed"
+trap 'rm -rf ${TMP}' EXIT
+
+# The log: file(s) or stdin; we need two passes over it
+cat "$@" > ${TMP}/log || die "couldn't read the log"
+
+#--- Pass 1: the unique frames; fields: module symbol offset size
+cat > ${TMP}/frames.awk << 'EOF'
+frame_parse($0) {
+	k = FR_MOD " " FR_SYM " " FR_OFF " " FR_SIZE
+	if (!(k in seen)) {
+		seen[k] = 1
+		print k
+	}
+}
+EOF
+awk -f ${LIB} -f ${TMP}/frames.awk ${TMP}/log > ${TMP}/frames
+[ -s ${TMP}/frames ] || {
+  echo "${name}: no kernel frames (symbol+0xoff/0xsize) found" 1>&2
+  cat ${TMP}/log
+  exit 0
+}
+
+#--- Locate the objects: vmlinux and the .ko's (module name: '-' -> '_')
+declare -A OBJ
+[ -n "${VMLINUX}" ] && OBJ[vmlinux]=${VMLINUX}
+for mod in $(awk '$1 != "vmlinux" {print $1}' ${TMP}/frames | sort -u) ; do
+  [ -n "${OBJ[${mod}]}" ] && continue
+  modpat=$(echo ${mod} | sed 's/_/[-_]/g')
+  ko=$(find "${MODDIRS[@]}" \( -name "${modpat}.ko" -o -name "${modpat}.ko.debug" \) \
+	-print -quit 2>/dev/null)
+  [ -n "${ko}" ] && OBJ[${mod}]=${ko}
+done
+
+# objdump -t -> the symbol index; fields: symbol size section address
+# (sizes and addresses normalized hex; only symbols in code sections)
+cat > ${TMP}/syms.awk << 'EOF'
+{
+	t = index($0, "\t")
+	if (!t)
+		next
+	nf = split(substr($0, 1, t - 1), a, " ")
+	sec = a[nf]
+	if (sec !~ /text/)
+		next
+	split(substr($0, t + 1), b, " ")
+	print b[2], hex_norm(b[1]), sec, hex_norm(a[1])
+}
+EOF
+
+# Given the symbol index, the frames and the address cache, emit:
+#  ${TMP}/map.<mod> : module key section address  (key: sym+0xoff/0xsize)
+#  ${TMP}/miss.<mod>: section address   - not yet in the cache
+# For a .ko the symbol's address is relative to its section, so is ours:
+# which is just what 'addr2line -j <section>' wants.
+cat > ${TMP}/map.awk << 'EOF'
+FILENAME == SYMS {
+	k = $1 " " $2
+	if (!(k in addr)) {
+		addr[k] = $4; sec[k] = $3
+	}
+	if (!($1 in addr1)) {
+		addr1[$1] = $4; sec1[$1] = $3
+	}
+	next
+}
+FILENAME == A2L {
+	split($0, f, "\t")
+	have[f[1] " " f[2]] = 1
+	next
+}
+$1 == MOD {
+	k = $2 " " hex_norm($4)
+	if (k in addr) {
+		a = addr[k]; s = sec[k]
+	} else if ($2 in addr1) {	# size mismatch; take it anyway
+		a = addr1[$2]; s = sec1[$2]
+	} else
+		next
+	a = hex_add(a, $3)
+	print MOD, $2 "+0x" $3 "/0x" $4, s, a > MAP
+	if (!((s " " a) in have) && !((s " " a) in asked)) {
+		asked[s " " a] = 1
+		print s, a > MISS
+	}
+}
+EOF
+
+# addr2line -a -p -f -i output -> address cache lines: section TAB address TAB resolution
+# (an address's inlined-by lines are joined with " | ")
+cat > ${TMP}/a2l.awk << 'EOF'
+function flush() {
+	if (cur != "")
+		printf "%s\t%s\t%s\n", SEC, cur, res
+	cur = ""
+}
+/^0x[0-9a-f]+: / {
+	flush()
+	cur = hex_norm(substr($1, 1, length($1) - 1))
+	res = substr($0, length($1) + 2)
+	next
+}
+/^ *\(inlined by\) / {
+	sub(/^ */, "")
+	res = res " | " $0
+}
+END { flush() }
+EOF
+
+: > ${TMP}/resolved
+for mod in "${!OBJ[@]}" ; do
+  obj=${OBJ[${mod}]}
+  [ -f "${obj}" ] || continue
+  key=$(echo "$(readlink -f ${obj}) $(stat -c '%s %Y' ${obj})" | md5sum | cut -c1-16)
+  SYMS=${CACHE}/${key}.syms
+  A2L=${CACHE}/${key}.a2l
+  if [ ! -s ${SYMS} ] ; then
+    objdump -t ${obj} 2>/dev/null | awk -f ${LIB} -f ${TMP}/syms.awk > ${SYMS}.tmp && \
+	mv ${SYMS}.tmp ${SYMS}
+  fi
+  [ -f ${A2L} ] || : > ${A2L}
+
+  awk -f ${LIB} -f ${TMP}/map.awk -v MOD=${mod} -v SYMS=${SYMS} -v A2L=${A2L} \
+	-v MAP=${TMP}/map.${mod} -v MISS=${TMP}/miss.${mod} \
+	${SYMS} ${A2L} ${TMP}/frames
+  [ -f ${TMP}/map.${mod} ] || continue
+
+  # The one addr2line run per section of this object, for all its new addresses
+  if [ -s ${TMP}/miss.${mod} ] ; then
+    for sec in $(awk '{print $1}' ${TMP}/miss.${mod} | sort -u) ; do
+      if [ "${mod}" = "vmlinux" ] ; then
+        secopt=""
+      else
+        secopt="-j ${sec}"
+      fi
+      awk -v s="${sec}" '$1 == s {print "0x" $2}' ${TMP}/miss.${mod} | \
+	addr2line -e ${obj} ${secopt} -a -p -f -i -C 2>/dev/null | \
+	awk -f ${LIB} -f ${TMP}/a2l.awk -v SEC="${sec}" >> ${A2L}
+    done
+  fi
+
+  # module key TAB resolution
+  awk -v A2L=${A2L} '
+	FILENAME == A2L { split($0, f, "\t"); r[f[1] " " f[2]] = f[3]; next }
+	(($3 " " $4) in r) { printf "%s %s\t%s\n", $1, $2, r[$3 " " $4] }' \
+	${A2L} ${TMP}/map.${mod} >> ${TMP}/resolved
+done
+
+#--- Pass 2: annotate the log
+cat > ${TMP}/annotate.awk << 'EOF'
+# Find (once) and load (once) a source file; return 1 if we have it
+function load_src(file,    path, rest, line, n) {
+	if (file in src_ok)
+		return src_ok[file]
+	path = ""
+	if ((getline line < file) > 0)
+		path = file
+	close(file)
+	if (path == "" && SRCDIR != "") {
+		# try under SRCDIR, dropping leading path components one by one
+		rest = file
+		sub(/^\/+/, "", rest)
+		while (rest != "") {
+			if ((getline line < (SRCDIR "/" rest)) > 0)
+				path = SRCDIR "/" rest
+			close(SRCDIR "/" rest)
+			if (path != "" || !sub(/^[^\/]*\/+/, "", rest))
+				break
+		}
+	}
+	n = 0
+	if (path != "") {
+		while ((getline line < path) > 0)
+			src[file, ++n] = line
+		close(path)
+	}
+	src_ok[file] = (n > 0)
+	return src_ok[file]
+}
+# "func at file:line [(discriminator N)]" -> print the source line
+function show_src(where,    file, n, p) {
+	p = index(where, " at ")
+	if (!p)
+		return
+	file = substr(where, p + 4)
+	sub(/ \(discriminator [0-9]+\)$/, "", file)
+	n = file
+	sub(/.*:/, "", n)
+	sub(/:[0-9?]+$/, "", file)
+	if (n !~ /^[0-9]+$/ || !load_src(file))
+		return
+	if ((file, n + 0) in src)
+		printf "%s      | %5d: %s\n", INDENT, n, src[file, n + 0]
+}
+FILENAME == RESOLVED {
+	t = index($0, "\t")
+	res[substr($0, 1, t - 1)] = substr($0, t + 1)
+	next
+}
+{
+	if (!frame_parse($0)) {
+		print
+		next
+	}
+	k = FR_MOD " " FR_SYM "+0x" FR_OFF "/0x" FR_SIZE
+	if (!(k in res)) {
+		print
+		next
+	}
+	n = split(res[k], lvl, " \\| ")
+	INDENT = substr($0, 1, RSTART - 1)
+	gsub(/[^ \t]/, " ", INDENT)
+	# the innermost (maybe inlined) function first, as addr2line -i reports it
+	print $0 "  " lvl[1]
+	if (SHOWSRC)
+		show_src(lvl[1])
+	for (i = 2; i <= n; i++) {
+		print INDENT "  " lvl[i]
+		if (SHOWSRC)
+			show_src(lvl[i])
+	}
+}
+EOF
+awk -f ${LIB} -f ${TMP}/annotate.awk -v RESOLVED=${TMP}/resolved -v SHOWSRC=${SHOWSRC} \
+	-v SRCDIR="${SRCDIR}" ${TMP}/resolved ${TMP}/log
+
+for mod in $(awk '{print $1}' ${TMP}/frames | sort -u) ; do
+  [ -z "${OBJ[${mod}]}" ] && echo "${name}: note: no object found for '${mod}' (see -k / -m)" 1>&2
+done
+exit 0
@@ -0,0 +1,40 @@
+#!/bin/bash
+# ch7/testdata/test_oops_sigidx.sh
+# ***************************************************************
+# This program is part of the source code released for the book
+#  "Linux Kernel Debugging"
+#  (c) Author: Kaiwan N Billimoria
+#  Publisher:  Packt
+#  GitHub repository:
+#  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+#
+# From: Ch 7: Oops! Interpreting the kernel bug diagnostic
+#***************************************************************
+# Brief Description:
+# Regression check for ../oops_sigidx.sh, on the sample log(s) here.
+#  oops_x2_panic.log : the same NULL-pointer Oops twice, each followed (with
+#    panic_on_oops) by 'Kernel panic - not syncing: Fatal exception'. Must
+#    give a single bucket, seen twice, typed by the BUG: line (the panic line
+#    mustn't open a report of its own, nor swallow the next crash's header).
+#
+# For details, please refer the book, Ch 7.
+#------------------------------------------------------------------------------
+name=$(basename $0)
+DIR=$(dirname $0)
+
+die()
+{
+ echo "${name}: FAIL: $@" 1>&2
+ exit 1
+}
+
+IDX=$(mktemp /tmp/${name}.XXXXXX) || die "mktemp failed"
+trap 'rm -f ${IDX}' EXIT
+
+${DIR}/../oops_sigidx.sh -q -i ${IDX} -t 1000 ${DIR}/oops_x2_panic.log || die "oops_sigidx.sh failed"
+[ $(wc -l < ${IDX}) -eq 1 ] || die "oops_x2_panic.log: expected 1 bucket, got $(wc -l < ${IDX})"
+awk -F"\t" '$2 == 2 && $5 ~ /^BUG: kernel NULL pointer dereference/ &&
+  $7 ~ /^try_oops_init \[oops_tryv2\],do_one_initcall/ { ok = 1 }
+  END { exit !ok }' ${IDX} || die "oops_x2_panic.log: wrong bucket: $(cat ${IDX})"
+echo "${name}: PASS"
+exit 0
@@ -15,6 +15,28 @@
  * writes on the same address; KCSAN should catch it! So, of course, we assume
  * you're running this on a KCSAN-enabled debug kernel.
  *
+ * Scaled-up mode: pass the 'pattern' module parameter and we instead spawn
+ * 'nthreads' kernel threads (default: one per online CPU, each bound to its
+ * CPU), all hammering the st_ctx structure with the chosen access pattern:
+ *  plain-plain     : plain writes to the same address (a data race)
+ *  plain-atomic    : half the threads do plain writes, half do atomic xchg()'s
+ *                    on the same address (still a data race)
+ *  once            : READ_ONCE()/WRITE_ONCE() only (marked; no data race)
+ *  marked-unmarked : half the threads WRITE_ONCE(), half do plain reads and
+ *                    writes on the same address (a data race)
+ *  falseshare      : each thread writes its own adjacent field of st_ctx
+ *                    (x, y, z, data); no race with <= 4 threads, just
+ *                    cache line contention. The threads then repeat the run
+ *                    on a copy of those fields, each padded out to its own
+ *                    cache line (____cacheline_aligned_in_smp), and we report
+ *                    the slowdown due to false sharing. By default this
+ *                    pattern uses min(4, # online CPUs) threads.
+ * Once all threads are done, the ops/sec - per thread and in total - is
+ * reported. This can be used both to tune KCSAN's sampling (how many loops
+ * does it take to catch a race?) and, on a non-KCSAN kernel, to measure the
+ * cost of marked versus unmarked accesses at scale. F.e.:
+ *  sudo insmod ./kcsan_datarace.ko pattern=once iters=10000000
+ *
  * For details, please refer the book, Ch 8.
  */
 #define pr_fmt(fmt) "%s:%s():%d: " fmt, KBUILD_MODNAME, __func__, __LINE__
@@ -26,6 +48,11 @@
 #include <linux/random.h>
 #include <linux/workqueue.h>
 #include <linux/delay.h>
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include "../../convenient.h"
 
 MODULE_AUTHOR("<insert your name here>");
@@ -45,11 +72,57 @@ static int iter2 = 10000;
 module_param(iter2, int, 0644);
 MODULE_PARM_DESC(iter2, "# of times to loop in workfunc 2");
 
+static char *pattern;
+module_param(pattern, charp, 0444);
+MODULE_PARM_DESC(pattern, "Scaled-up mode: access pattern, one of plain-plain, plain-atomic, once, marked-unmarked, falseshare");
+
+static int nthreads;
+module_param(nthreads, int, 0444);
+MODULE_PARM_DESC(nthreads, "Scaled-up mode: # of kernel threads (default 0: one per online CPU)");
+
+static ulong iters = 1000000;
+module_param(iters, ulong, 0444);
+MODULE_PARM_DESC(iters, "Scaled-up mode: # of loops in each kernel thread (default 1000000)");
+
 static struct st_ctx {
 	struct work_struct work1, work2;
 	u64 x, y, z, data;
 } *gctx; /* careful, pointers have no memory! */
 
+/* The same fields as st_ctx, but each on its own cache line */
+static struct st_ctx_padded {
+	u64 x ____cacheline_aligned_in_smp;
+	u64 y ____cacheline_aligned_in_smp;
+	u64 z ____cacheline_aligned_in_smp;
+	u64 data ____cacheline_aligned_in_smp;
+} *gpad;
+
+enum race_pattern {
+	PAT_PLAIN_PLAIN,
+	PAT_PLAIN_ATOMIC,
+	PAT_ONCE,
+	PAT_MARKED_UNMARKED,
+	PAT_FALSESHARE,
+	PAT_NUM
+};
+static const char * const pat_names[PAT_NUM] = {
+	[PAT_PLAIN_PLAIN]     = "plain-plain",
+	[PAT_PLAIN_ATOMIC]    = "plain-atomic",
+	[PAT_ONCE]            = "once",
+	[PAT_MARKED_UNMARKED] = "marked-unmarked",
+	[PAT_FALSESHARE]      = "falseshare",
+};
+static int gpat = -1;
+
+static struct race_thr {
+	struct task_struct *task;
+	int idx, cpu;
+	u64 ns;
+	u64 ns_padded;	/* falseshare pattern only */
+} *gthr;
+static int gnthr;
+static atomic_t nrunning, nphase1;
+
 /*
  * Our workqueue callback function #1
  */
@@ -82,6 +155,180 @@ static void do_the_work2(struct work_struct *work2)
 	}
 }
 
+/* Where the falseshare pattern's thread @idx writes: adjacent fields of st_ctx */
+static u64 *falseshare_field(int idx)
+{
+	u64 *fields[] = { &gctx->x, &gctx->y, &gctx->z, &gctx->data };
+
+	return fields[idx % ARRAY_SIZE(fields)];
+}
+
+static u64 *padded_field(int idx)
+{
+	u64 *fields[] = { &gpad->x, &gpad->y, &gpad->z, &gpad->data };
+
+	return fields[idx % ARRAY_SIZE(fields)];
+}
+
+static void report_falseshare(void)
+{
+	u64 rate, rate_pad, total = 0, total_pad = 0, ratio;
+	int i;
+
+	for (i = 0; i < gnthr; i++) {
+		rate = gthr[i].ns ? div64_u64((u64)iters * NSEC_PER_SEC, gthr[i].ns) : 0;
+		rate_pad = gthr[i].ns_padded ?
+			div64_u64((u64)iters * NSEC_PER_SEC, gthr[i].ns_padded) : 0;
+		pr_info(" thread %3d (cpu %3d): adjacent %llu ops/sec, padded %llu ops/sec\n",
+			i, gthr[i].cpu, rate, rate_pad);
+		total += rate;
+		total_pad += rate_pad;
+	}
+	/* slowdown = padded throughput / adjacent throughput, 2 decimal places */
+	ratio = total ? div64_u64(total_pad * 100, total) : 0;
+	pr_info("pattern %s: %d threads: adjacent fields (sizeof %zu): total %llu ops/sec\n",
+		pat_names[gpat], gnthr, sizeof(struct st_ctx), total);
+	pr_info("pattern %s: %d threads: padded fields   (sizeof %zu): total %llu ops/sec\n",
+		pat_names[gpat], gnthr, sizeof(struct st_ctx_padded), total_pad);
+	pr_info("false sharing slowdown: %llu.%02llux\n", ratio / 100, ratio % 100);
+}
+
+static void report_results(void)
+{
+	u64 rate, total = 0;
+	int i;
+
+	if (gpat == PAT_FALSESHARE) {
+		report_falseshare();
+		return;
+	}
+	for (i = 0; i < gnthr; i++) {
+		rate = gthr[i].ns ? div64_u64((u64)iters * NSEC_PER_SEC, gthr[i].ns) : 0;
+		pr_info(" thread %3d (cpu %3d): %lu ops in %llu ns = %llu ops/sec\n",
+			i, gthr[i].cpu, iters, gthr[i].ns, rate);
+		total += rate;
+	}
+	pr_info("pattern %s: %d threads: total %llu ops/sec\n",
+		pat_names[gpat], gnthr, total);
+}
+
+/*
+ * Our (per-CPU) kernel thread: loop over the chosen access pattern.
+ * The barrier()'s ensure the compiler can't collapse the loops into a single
+ * access (a real concern on a non-KCSAN kernel, where plain accesses aren't
+ * instrumented).
+ */
+static int race_kthread(void *arg)
+{
+	struct race_thr *thr = arg;
+	u64 *mine = falseshare_field(thr->idx);
+	u64 t0, i;
+
+	t0 = ktime_get_ns();
+	switch (gpat) {
+	case PAT_PLAIN_PLAIN:
+		for (i = 0; i < iters; i++) {
+			gctx->data = i; /* unprotected plain write on global */
+			barrier();
+		}
+		break;
+	case PAT_PLAIN_ATOMIC:
+		for (i = 0; i < iters; i++) {
+			if (thr->idx & 1)
+				xchg(&gctx->data, i);
+			else
+				gctx->data = i;
+			barrier();
+		}
+		break;
+	case PAT_ONCE:
+		for (i = 0; i < iters; i++)
+			WRITE_ONCE(gctx->data, READ_ONCE(gctx->data) + 1);
+		break;
+	case PAT_MARKED_UNMARKED:
+		for (i = 0; i < iters; i++) {
+			if (thr->idx & 1)
+				WRITE_ONCE(gctx->data, i);
+			else
+				gctx->data++;
+			barrier();
+		}
+		break;
+	case PAT_FALSESHARE:
+		for (i = 0; i < iters; i++) {
+			(*mine)++;
+			barrier();
+		}
+		thr->ns = ktime_get_ns() - t0;
+
+		/* Wait for all threads to finish phase 1, then redo it padded */
+		atomic_dec(&nphase1);
+		while (atomic_read(&nphase1))
+			cond_resched();
+		mine = padded_field(thr->idx);
+		t0 = ktime_get_ns();
+		for (i = 0; i < iters; i++) {
+			(*mine)++;
+			barrier();
+		}
+		thr->ns_padded = ktime_get_ns() - t0;
+		break;
+	}
+	if (gpat != PAT_FALSESHARE)
+		thr->ns = ktime_get_ns() - t0;
+
+	if (atomic_dec_and_test(&nrunning))
+		report_results();
+
+	/* Hang around until the module's removed (it kthread_stop()'s us) */
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+	}
+	return 0;
+}
+
+static int setup_kthreads(void)
+{
+	int i, cpu = -1;
+
+	gnthr = nthreads > 0 ? nthreads : num_online_cpus();
+	if (gpat == PAT_FALSESHARE && nthreads <= 0)
+		gnthr = min(gnthr, 4);
+	gthr = kcalloc(gnthr, sizeof(struct race_thr), GFP_KERNEL);
+	if (!gthr)
+		return -ENOMEM;
+
+	/* Create them all first, then wake them, so that they start ~together */
+	atomic_set(&nrunning, gnthr);
+	atomic_set(&nphase1, gnthr);
+	for (i = 0; i < gnthr; i++) {
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+		gthr[i].idx = i;
+		gthr[i].cpu = cpu;
+		gthr[i].task = kthread_create(race_kthread, &gthr[i], "race/%d", i);
+		if (IS_ERR(gthr[i].task)) {
+			int ret = PTR_ERR(gthr[i].task);
+
+			pr_err("kthread creation failed (%d)\n", ret);
+			while (--i >= 0)
+				kthread_stop(gthr[i].task);
+			kfree(gthr);
+			gthr = NULL;
+			return ret;
+		}
+		kthread_bind(gthr[i].task, cpu);
+	}
+	for (i = 0; i < gnthr; i++)
+		wake_up_process(gthr[i].task);
+
+	return 0;
+}
+
 static int setup_work(void)
 {
 	pr_info("global data item address: 0x%px\n", &gctx->data);
@@ -99,15 +346,42 @@ static int setup_work(void)
 
 static int __init kcsan_datarace_init(void)
 {
-	if (!race_2plain_w) {
-		pr_info("nothing to do (you're expected to set the module param race_2plain_w to True!)\n");
+	int ret;
+
+	if (pattern) {
+		gpat = match_string(pat_names, PAT_NUM, pattern);
+		if (gpat < 0) {
+			pr_info("invalid pattern \"%s\"\n", pattern);
+			return -EINVAL;
+		}
+	} else if (!race_2plain_w) {
+		pr_info("nothing to do (you're expected to set the module param race_2plain_w to True, or pass a pattern!)\n");
 		return -EINVAL;
 	}
 
 	gctx = kzalloc(sizeof(struct st_ctx), GFP_KERNEL);
 	if (!gctx)
 		return -ENOMEM;
-	
+
+	if (gpat >= 0) {
+		if (gpat == PAT_FALSESHARE) {
+			gpad = kzalloc(sizeof(struct st_ctx_padded), GFP_KERNEL);
+			if (!gpad) {
+				kfree(gctx);
+				return -ENOMEM;
+			}
+		}
+		pr_info("global data item address: 0x%px\n", &gctx->data);
+		ret = setup_kthreads();
+		if (ret) {
+			kfree(gpad);
+			kfree(gctx);
+			return ret;
+		}
+		pr_info("pattern %s: %d threads x %lu loops\n", pat_names[gpat], gnthr, iters);
+		return 0;
+	}
+
 	gctx->data = 1;
 	pr_info("Setting up a deliberate data race via our workqueue functions:\n");
 	if (race_2plain_w == 1)
@@ -119,6 +393,18 @@ static int __init kcsan_datarace_init(void)
 
 static void __exit kcsan_datarace_exit(void)
 {
+	int i;
+
+	if (gthr) {
+		for (i = 0; i < gnthr; i++)
+			kthread_stop(gthr[i].task);
+		kfree(gthr);
+	} else {
+		/* the work items may not have run yet */
+		cancel_work_sync(&gctx->work1);
+		cancel_work_sync(&gctx->work2);
+	}
+	kfree(gpad);
 	kfree(gctx);
 	pr_info("Goodbye\n");
 }
@@ -0,0 +1,573 @@
+/*
+ * ch8/lock_bench/lock_bench.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Debugging"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+ *
+ * From: Ch 8: Lock Debugging
+ ****************************************************************
+ * Brief Description:
+ * Our kcsan_datarace module shows what happens with no protection at all; the
+ * kprobes and kthread_stuck demos use a spinlock. But which synchronization
+ * primitive should a hot path use? This module benchmarks:
+ *  spinlock, raw spinlock, rwlock, mutex, rwsem, seqlock, RCU, atomic64 and
+ *  percpu_counter
+ * under a configurable read/write mix and number of CPUs. On each CPU a bound
+ * kernel thread runs, for 'duration_ms', operations on a shared counter:
+ * with probability 'write_pct' % it updates it (the 'write' side of the
+ * primitive), else it reads it (the 'read' side). We report ops/sec (total,
+ * reads, writes and the per-thread spread) plus log2 histograms of the time
+ * taken to acquire ("wait") and the time held ("hold"); these are sampled
+ * once every 64 ops to keep the clock reads from dominating the cheap ops.
+ *
+ * Usage (debugfs):
+ *  echo 1 > /sys/kernel/debug/lock_bench/run      # blocks until done
+ *  cat /sys/kernel/debug/lock_bench/results
+ * Tune the run via the module parameters (they're writable at runtime under
+ * /sys/module/lock_bench/parameters/).
+ *
+ * For details, please refer the book, Ch 8.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
+#include <linux/spinlock.h>
+#include <linux/rwlock.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
+#include <linux/atomic.h>
+#include <linux/percpu_counter.h>
+#include <linux/sched/clock.h>	/* local_clock() */
+#include <linux/wait.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "../../convenient.h"
+
+MODULE_AUTHOR("<insert your name here>");
+MODULE_DESCRIPTION("LKD book:ch8/lock_bench: synchronization primitive scalability benchmark");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+static char *prims = "all";
+module_param(prims, charp, 0644);
+MODULE_PARM_DESC(prims, "Primitives to benchmark, comma-separated (default 'all'): spinlock,raw_spinlock,rwlock,mutex,rwsem,seqlock,rcu,atomic64,percpu_counter");
+
+static unsigned int write_pct = 10;
+module_param(write_pct, uint, 0644);
+MODULE_PARM_DESC(write_pct, "Percentage of operations that are writes/updates (default 10)");
+
+static unsigned int nthreads;
+module_param(nthreads, uint, 0644);
+MODULE_PARM_DESC(nthreads, "# of threads, one per CPU (default 0: all online CPUs)");
+
+static unsigned int duration_ms = 1000;
+module_param(duration_ms, uint, 0644);
+MODULE_PARM_DESC(duration_ms, "How long to run each primitive, in ms (default 1000)");
+
+static unsigned int cs_loops;
+module_param(cs_loops, uint, 0644);
+MODULE_PARM_DESC(cs_loops, "Extra 'work' loops inside each critical section (default 0)");
+
+enum lb_type {
+	LB_SPINLOCK,
+	LB_RAW_SPINLOCK,
+	LB_RWLOCK,
+	LB_MUTEX,
+	LB_RWSEM,
+	LB_SEQLOCK,
+	LB_RCU,
+	LB_ATOMIC64,
+	LB_PERCPU_COUNTER,
+	LB_NUM_TYPES
+};
+
+static const char * const lb_names[LB_NUM_TYPES] = {
+	[LB_SPINLOCK]       = "spinlock",
+	[LB_RAW_SPINLOCK]   = "raw_spinlock",
+	[LB_RWLOCK]         = "rwlock",
+	[LB_MUTEX]          = "mutex",
+	[LB_RWSEM]          = "rwsem",
+	[LB_SEQLOCK]        = "seqlock",
+	[LB_RCU]            = "rcu",
+	[LB_ATOMIC64]       = "atomic64",
+	[LB_PERCPU_COUNTER] = "percpu_counter",
+};
+
+#define LB_SAMPLE_SHIFT	6	/* time one op in 64 */
+#define LB_NBUCKETS	32	/* log2(ns) buckets */
+
+/* The RCU-protected data; the others protect lb.data */
+struct lb_rcu_data {
+	u64 val;
+	struct rcu_head rcu;
+};
+
+static struct {
+	spinlock_t spin;
+	raw_spinlock_t raw;
+	rwlock_t rw;
+	struct mutex mtx;
+	struct rw_semaphore rwsem;
+	seqlock_t seq;
+	spinlock_t rcu_wlock;	/* serializes the RCU updaters */
+	struct lb_rcu_data __rcu *rcu_data;
+	atomic64_t a64;
+	struct percpu_counter pcc;
+	u64 data;
+} lb;
+
+struct lb_thr {
+	struct lb_ctx *ctx;
+	int cpu;
+	u64 seed;
+	u64 ops, writes, ns;
+	u64 wait_hist[LB_NBUCKETS], hold_hist[LB_NBUCKETS];
+};
+
+/* Shared by all the threads of a given run */
+struct lb_ctx {
+	enum lb_type type;
+	bool go;
+	wait_queue_head_t wq;
+	atomic_t running;
+	struct completion done;
+};
+
+/* Results of the last run, per primitive */
+static struct lb_result {
+	bool valid;
+	int nthr;
+	unsigned int write_pct;
+	u64 ops, writes, ns, min_ops, max_ops;
+	u64 wait_hist[LB_NBUCKETS], hold_hist[LB_NBUCKETS];
+} lb_results[LB_NUM_TYPES];
+
+static DEFINE_MUTEX(lb_mutex);	/* one run at a time; protects lb_results */
+static struct dentry *lb_dbgfs_dir;
+
+/* A cheap per-thread PRNG (LCG); good enough to pick read vs write */
+static inline u32 lb_rand(u64 *seed)
+{
+	*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (u32)(*seed >> 33);
+}
+
+static inline int lb_bucket(u64 ns)
+{
+	return ns ? min(fls64(ns) - 1, LB_NBUCKETS - 1) : 0;
+}
+
+/* The critical section proper */
+static inline u64 lb_cs(u64 *p, bool write)
+{
+	unsigned int i;
+	u64 v;
+
+	if (write)
+		v = ++(*p);
+	else
+		v = READ_ONCE(*p);
+	for (i = 0; i < cs_loops; i++)
+		barrier();
+	return v;
+}
+
+/* Timestamp the acquisition: the end of the wait, the start of the hold */
+static inline void lb_acquired(bool timed, u64 *t1)
+{
+	if (timed)
+		*t1 = local_clock();
+}
+
+static void lb_op(struct lb_thr *thr, bool write, bool timed)
+{
+	struct lb_rcu_data *p, *old;
+	u64 t0 = 0, t1 = 0;
+	unsigned int seq;
+
+	/* the RCU writer's new copy: allocated outside the timed region */
+	if (thr->ctx->type == LB_RCU && write) {
+		p = kmalloc(sizeof(*p), GFP_KERNEL);
+		if (unlikely(!p))
+			return;		/* nothing done; nothing to record */
+	}
+	if (timed)
+		t0 = local_clock();
+
+	switch (thr->ctx->type) {
+	case LB_SPINLOCK:
+		spin_lock(&lb.spin);
+		lb_acquired(timed, &t1);
+		lb_cs(&lb.data, write);
+		spin_unlock(&lb.spin);
+		break;
+	case LB_RAW_SPINLOCK:
+		raw_spin_lock(&lb.raw);
+		lb_acquired(timed, &t1);
+		lb_cs(&lb.data, write);
+		raw_spin_unlock(&lb.raw);
+		break;
+	case LB_RWLOCK:
+		if (write) {
+			write_lock(&lb.rw);
+			lb_acquired(timed, &t1);
+			lb_cs(&lb.data, true);
+			write_unlock(&lb.rw);
+		} else {
+			read_lock(&lb.rw);
+			lb_acquired(timed, &t1);
+			lb_cs(&lb.data, false);
+			read_unlock(&lb.rw);
+		}
+		break;
+	case LB_MUTEX:
+		mutex_lock(&lb.mtx);
+		lb_acquired(timed, &t1);
+		lb_cs(&lb.data, write);
+		mutex_unlock(&lb.mtx);
+		break;
+	case LB_RWSEM:
+		if (write) {
+			down_write(&lb.rwsem);
+			lb_acquired(timed, &t1);
+			lb_cs(&lb.data, true);
+			up_write(&lb.rwsem);
+		} else {
+			down_read(&lb.rwsem);
+			lb_acquired(timed, &t1);
+			lb_cs(&lb.data, false);
+			up_read(&lb.rwsem);
+		}
+		break;
+	case LB_SEQLOCK:
+		if (write) {
+			write_seqlock(&lb.seq);
+			lb_acquired(timed, &t1);
+			lb_cs(&lb.data, true);
+			write_sequnlock(&lb.seq);
+		} else {
+			/*
+			 * 'acquired' is the read_seqbegin() of the pass that
+			 * succeeds: t1's reset on every pass, so the failed
+			 * passes (retries) count as wait, not hold
+			 */
+			do {
+				seq = read_seqbegin(&lb.seq);
+				lb_acquired(timed, &t1);
+				lb_cs(&lb.data, false);
+			} while (read_seqretry(&lb.seq, seq));
+		}
+		break;
+	case LB_RCU:
+		if (write) {
+			spin_lock(&lb.rcu_wlock);
+			lb_acquired(timed, &t1);
+			old = rcu_dereference_protected(lb.rcu_data,
+							lockdep_is_held(&lb.rcu_wlock));
+			p->val = old->val + 1;
+			rcu_assign_pointer(lb.rcu_data, p);
+			spin_unlock(&lb.rcu_wlock);
+			kfree_rcu(old, rcu);
+		} else {
+			rcu_read_lock();
+			lb_acquired(timed, &t1);
+			p = rcu_dereference(lb.rcu_data);
+			lb_cs(&p->val, false);
+			rcu_read_unlock();
+		}
+		break;
+	case LB_ATOMIC64:
+		lb_acquired(timed, &t1);
+		if (write)
+			atomic64_inc(&lb.a64);
+		else
+			atomic64_read(&lb.a64);
+		break;
+	case LB_PERCPU_COUNTER:
+		lb_acquired(timed, &t1);
+		if (write)
+			percpu_counter_inc(&lb.pcc);
+		else
+			percpu_counter_read(&lb.pcc);
+		break;
+	default:
+		break;
+	}
+
+	if (timed) {
+		u64 t2 = local_clock();
+
+		thr->wait_hist[lb_bucket(t1 - t0)]++;
+		thr->hold_hist[lb_bucket(t2 - t1)]++;
+	}
+}
+
+static int lb_thread(void *arg)
+{
+	struct lb_thr *thr = arg;
+	struct lb_ctx *ctx = thr->ctx;
+	unsigned long end;
+	u64 t0;
+	int i;
+
+	wait_event(ctx->wq, READ_ONCE(ctx->go));
+
+	end = jiffies + msecs_to_jiffies(duration_ms);
+	t0 = ktime_get_ns();
+	do {
+		for (i = 0; i < 256; i++) {
+			bool write = (lb_rand(&thr->seed) % 100) < write_pct;
+
+			lb_op(thr, write, !(thr->ops & ((1 << LB_SAMPLE_SHIFT) - 1)));
+			thr->ops++;
+			if (write)
+				thr->writes++;
+		}
+		cond_resched();
+	} while (time_before(jiffies, end));
+	thr->ns = ktime_get_ns() - t0;
+
+	if (atomic_dec_and_test(&ctx->running))
+		complete(&ctx->done);
+	return 0;
+}
+
+static int lb_run_one(enum lb_type type, int nthr)
+{
+	struct lb_ctx ctx = { .type = type };
+	struct lb_result *res = &lb_results[type];
+	struct lb_thr *thr;
+	int cpu, i = 0, b, ret = 0;
+
+	thr = kcalloc(nthr, sizeof(*thr), GFP_KERNEL);
+	if (!thr)
+		return -ENOMEM;
+	init_waitqueue_head(&ctx.wq);
+	init_completion(&ctx.done);
+
+	for_each_online_cpu(cpu) {
+		struct task_struct *t;
+
+		if (i >= nthr)
+			break;
+		thr[i].ctx = &ctx;
+		thr[i].cpu = cpu;
+		thr[i].seed = cpu + 1;
+		t = kthread_create(lb_thread, &thr[i], "lb/%d", cpu);
+		if (IS_ERR(t)) {
+			ret = PTR_ERR(t);
+			break;
+		}
+		kthread_bind(t, cpu);
+		atomic_inc(&ctx.running);
+		wake_up_process(t);
+		i++;
+	}
+	nthr = i;
+
+	/* Release the threads (even on error, so that the started ones finish) */
+	WRITE_ONCE(ctx.go, true);
+	wake_up_all(&ctx.wq);
+	if (nthr)
+		wait_for_completion(&ctx.done);
+
+	memset(res, 0, sizeof(*res));
+	if (!ret && nthr) {
+		res->valid = true;
+		res->nthr = nthr;
+		res->write_pct = write_pct;
+		res->min_ops = U64_MAX;
+		for (i = 0; i < nthr; i++) {
+			res->ops += thr[i].ops;
+			res->writes += thr[i].writes;
+			res->ns = max(res->ns, thr[i].ns);
+			res->min_ops = min(res->min_ops, thr[i].ops);
+			res->max_ops = max(res->max_ops, thr[i].ops);
+			for (b = 0; b < LB_NBUCKETS; b++) {
+				res->wait_hist[b] += thr[i].wait_hist[b];
+				res->hold_hist[b] += thr[i].hold_hist[b];
+			}
+		}
+	}
+	kfree(thr);
+	return ret;
+}
+
+/* Is primitive @type selected via the 'prims' module parameter? */
+static bool lb_selected(enum lb_type type)
+{
+	const char *p = prims;
+	size_t len = strlen(lb_names[type]);
+
+	if (!p || !strcmp(p, "all"))
+		return true;
+	while (p && *p) {
+		if (!strncmp(p, lb_names[type], len) && (p[len] == ',' || p[len] == '\0' ||
+							 p[len] == '\n'))
+			return true;
+		p = strchr(p, ',');
+		if (p)
+			p++;
+	}
+	return false;
+}
+
+static int lb_run_all(void)
+{
+	int nthr = num_online_cpus(), ret;
+	enum lb_type type;
+
+	if (nthreads && nthreads < nthr)
+		nthr = nthreads;
+	if (write_pct > 100) {
+		pr_warn("write_pct must be 0..100\n");
+		return -EINVAL;
+	}
+
+	pr_info("running: %d threads, %u%% writes, %u ms per primitive\n",
+		nthr, write_pct, duration_ms);
+	for (type = 0; type < LB_NUM_TYPES; type++) {
+		lb_results[type].valid = false;
+		if (!lb_selected(type))
+			continue;
+		ret = lb_run_one(type, nthr);
+		if (ret) {
+			pr_warn("%s: failed (%d)\n", lb_names[type], ret);
+			return ret;
+		}
+	}
+	/* let the RCU updaters' kfree_rcu()'s drain */
+	rcu_barrier();
+	pr_info("done; see the debugfs results file\n");
+	return 0;
+}
+
+static void lb_show_hist(struct seq_file *seq, const char *what, u64 *hist)
+{
+	int b;
+
+	seq_printf(seq, "    %s (ns, sampled):", what);
+	for (b = 0; b < LB_NBUCKETS; b++)
+		if (hist[b])
+			seq_printf(seq, " [%llu-%llu):%llu", b ? 1ULL << b : 0,
+				   1ULL << (b + 1), hist[b]);
+	seq_puts(seq, "\n");
+}
+
+static int lb_results_show(struct seq_file *seq, void *v)
+{
+	enum lb_type type;
+
+	mutex_lock(&lb_mutex);
+	seq_printf(seq, "# %-15s %5s %6s %12s %12s %12s %12s %12s\n",
+		   "primitive", "nthr", "write%", "total op/s", "read op/s",
+		   "write op/s", "min thr ops", "max thr ops");
+	for (type = 0; type < LB_NUM_TYPES; type++) {
+		struct lb_result *res = &lb_results[type];
+		u64 ns;
+
+		if (!res->valid)
+			continue;
+		ns = res->ns ? res->ns : 1;
+		seq_printf(seq, "  %-15s %5d %6u %12llu %12llu %12llu %12llu %12llu\n",
+			   lb_names[type], res->nthr, res->write_pct,
+			   div64_u64(res->ops * NSEC_PER_SEC, ns),
+			   div64_u64((res->ops - res->writes) * NSEC_PER_SEC, ns),
+			   div64_u64(res->writes * NSEC_PER_SEC, ns),
+			   res->min_ops, res->max_ops);
+		lb_show_hist(seq, "wait", res->wait_hist);
+		lb_show_hist(seq, "hold", res->hold_hist);
+	}
+	mutex_unlock(&lb_mutex);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lb_results);
+
+static ssize_t lb_run_write(struct file *filp, const char __user *ubuf, size_t count,
+			    loff_t *fpos)
+{
+	int ret;
+
+	if (!mutex_trylock(&lb_mutex))
+		return -EBUSY;
+	ret = lb_run_all();
+	mutex_unlock(&lb_mutex);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations lb_run_fops = {
+	.write = lb_run_write,
+};
+
+static int __init lock_bench_init(void)
+{
+	struct lb_rcu_data *p;
+	int ret;
+
+	if (!IS_ENABLED(CONFIG_DEBUG_FS)) {
+		pr_warn("debugfs unsupported! Aborting ...\n");
+		return -EINVAL;
+	}
+
+	spin_lock_init(&lb.spin);
+	raw_spin_lock_init(&lb.raw);
+	rwlock_init(&lb.rw);
+	mutex_init(&lb.mtx);
+	init_rwsem(&lb.rwsem);
+	seqlock_init(&lb.seq);
+	spin_lock_init(&lb.rcu_wlock);
+	atomic64_set(&lb.a64, 0);
+	p = kzalloc(sizeof(*p), GFP_KERNEL);
+	if (!p)
+		return -ENOMEM;
+	RCU_INIT_POINTER(lb.rcu_data, p);
+	ret = percpu_counter_init(&lb.pcc, 0, GFP_KERNEL);
+	if (ret)
+		goto out_free;
+
+	lb_dbgfs_dir = debugfs_create_dir(KBUILD_MODNAME, NULL);
+	if (IS_ERR_OR_NULL(lb_dbgfs_dir)) {
+		pr_info("debugfs_create_dir failed, aborting...\n");
+		ret = lb_dbgfs_dir ? PTR_ERR(lb_dbgfs_dir) : -ENOMEM;
+		goto out_pcc;
+	}
+	debugfs_create_file("run", 0200, lb_dbgfs_dir, NULL, &lb_run_fops);
+	debugfs_create_file("results", 0444, lb_dbgfs_dir, NULL, &lb_results_fops);
+
+	pr_info("loaded; write to <debugfs>/%s/run to start, read results from <debugfs>/%s/results\n",
+		KBUILD_MODNAME, KBUILD_MODNAME);
+	return 0;		/* success */
+
+ out_pcc:
+	percpu_counter_destroy(&lb.pcc);
+ out_free:
+	kfree(p);
+	return ret;
+}
+
+static void __exit lock_bench_exit(void)
+{
+	debugfs_remove_recursive(lb_dbgfs_dir);
+	rcu_barrier();
+	percpu_counter_destroy(&lb.pcc);
+	kfree(rcu_dereference_protected(lb.rcu_data, 1));
+	pr_info("removed\n");
+}
+
+module_init(lock_bench_init);
+module_exit(lock_bench_exit);
@@ -0,0 +1,217 @@
+#!/bin/bash
+# ch9/ftrace/fgraph_agg.sh
+# ***************************************************************
+# This program is part of the source code released for the book
+#  "Linux Kernel Debugging"
+#  (c) Author: Kaiwan N Billimoria
+#  Publisher:  Packt
+#  GitHub repository:
+#  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+#
+# From: Ch 9: Tracing the kernel flow
+#***************************************************************
+# Brief Description:
+# 'Where did the time go?' - for a function_graph trace report (as saved by
+# our ping_ftrace.sh / ftrc_1s.sh, f.e. ping_ftrace_report.txt), without
+# reading through it.
+# In a single streaming pass, we rebuild the call trees - per CPU and task
+# (the funcgraph-proc column; per CPU if it's absent) - from the
+#  func() {  /  func();  /  } /* func */
+# lines and their durations, and aggregate, per function and per call path:
+#  - # of calls,
+#  - inclusive time (the function and all it called),
+#  - exclusive (self) time: the inclusive time less that of its children.
+# Output:
+#  - the top N functions by exclusive (or, -i, inclusive) time, and the top
+#    N call paths, as tables;
+#  - a folded-stack file - one 'task;func1;func2;...;funcN <self-time-ns>'
+#    line per call path - ready for flamegraph.pl:
+#     flamegraph.pl --countname=ns ping.folded > ping.svg
+# Works with or without the funcgraph-abstime, funcgraph-proc, funcgraph-tail
+# and latency-format columns. Calls that began before the trace did only
+# have their tail; they're rooted at the function itself. Recursive
+# functions' inclusive time is counted at every level.
+#
+# For details, please refer the book, Ch 9.
+#------------------------------------------------------------------------------
+name=$(basename $0)
+
+die()
+{
+ echo "${name}: $@" 1>&2
+ exit 1
+}
+
+usage()
+{
+ echo "Usage: ${name} [options] [function_graph-report ...]
+ Aggregate function_graph trace report(s) (or stdin) into per-function and
+ per-call-path times, and a folded-stack (flame graph) file.
+  -n N      : show the top N functions and paths (default 20)
+  -i        : sort the function table by inclusive time (default: exclusive)
+  -o folded : write the folded stacks here (default: <report>.folded, or
+              fgraph.folded when reading stdin)
+  -T        : don't root the folded stacks at the task name
+  -h        : this help"
+}
+
+TOPN=20
+SORTCOL=3
+FOLDED=""
+TASKROOT=1
+
+while getopts "n:io:Th" opt; do
+  case "${opt}" in
+    n) TOPN=${OPTARG} ;;
+    i) SORTCOL=2 ;;
+    o) FOLDED=${OPTARG} ;;
+    T) TASKROOT=0 ;;
+    h) usage ; exit 0 ;;
+    *) usage ; exit 1 ;;
+  esac
+done
+shift $((OPTIND-1))
+
+if [ -z "${FOLDED}" ] ; then
+  [ $# -ge 1 ] && FOLDED=${1%.txt}.folded || FOLDED=fgraph.folded
+fi
+[ $# -eq 0 ] && set -- -
+
+TMP=$(mktemp -d /tmp/${name}.XXXXXX) || die "mktemp failed"
+trap 'rm -rf ${TMP}' EXIT
+
+cat > ${TMP}/agg.awk << 'EOF'
+# us (as a string; "1.234") -> ns
+function us2ns(s) {
+	return int(s * 1000 + 0.5)
+}
+function record(fname, path, incl, excl) {
+	if (excl < 0)		# rounding; the durations are in 1 ns units
+		excl = 0
+	calls[fname]++
+	fincl[fname] += incl
+	fexcl[fname] += excl
+	if (incl > fmax[fname])
+		fmax[fname] = incl
+	pcalls[path]++
+	pincl[path] += incl
+	pexcl[path] += excl
+	nrec++
+}
+BEGIN {
+	FS = "|"
+}
+/^#/ || NF < 2 {
+	next
+}
+{
+	fn = $NF
+	sub(/^ +/, "", fn)
+	sub(/ +$/, "", fn)
+	if (fn ~ /^\/\*/)		# trace_printk() / events / markers
+		next
+
+	pre = $1
+	for (i = 2; i < NF; i++)
+		pre = pre "|" $i
+	if (!match(pre, /[0-9]+\)/))
+		next
+	cpu = substr(pre, RSTART, RLENGTH - 1)
+	rest = substr(pre, RSTART + RLENGTH)
+	task = ""
+	if (match(rest, /[^ |]+-[0-9]+/))
+		task = substr(rest, RSTART, RLENGTH)
+	k = cpu SUBSEP task
+	if (!(k in depth)) {
+		depth[k] = 0
+		comm = task
+		sub(/-[0-9]+$/, "", comm)
+		root[k] = (TASKROOT && comm != "") ? comm ";" : ""
+		nkeys++
+	}
+
+	dur = -1
+	if (match($(NF - 1), /[0-9]+(\.[0-9]+)? us/))
+		dur = us2ns(substr($(NF - 1), RSTART, RLENGTH - 3))
+
+	if (fn ~ /\(\) \{$/) {			# entry
+		fname = substr(fn, 1, length(fn) - 4)
+		d = ++depth[k]
+		st[k, d] = fname
+		path[k, d] = (d > 1 ? path[k, d - 1] ";" : root[k]) fname
+		cs[k, d] = 0
+	} else if (fn ~ /\(\);$/) {		# leaf
+		if (dur < 0)
+			next
+		fname = substr(fn, 1, length(fn) - 3)
+		d = depth[k]
+		record(fname, (d ? path[k, d] ";" : root[k]) fname, dur, dur)
+		cs[k, d] += dur
+	} else if (fn ~ /^\}/) {		# exit
+		fname = ""
+		if (match(fn, /\/\* .* \*\//))
+			fname = substr(fn, RSTART + 3, RLENGTH - 6)
+		d = depth[k]
+		# lost entries/exits (overruns, or the trace began mid-call): resync
+		if (fname != "" && d && st[k, d] != fname) {
+			for (j = d - 1; j > 0; j--)
+				if (st[k, j] == fname)
+					break
+			if (j > 0) {
+				d = depth[k] = j
+				unmatched++
+			} else
+				d = 0
+		}
+		if (d) {
+			depth[k]--
+			if (dur >= 0) {
+				record(st[k, d], path[k, d], dur, dur - cs[k, d])
+				cs[k, d - 1] += dur
+			}
+		} else {
+			# a call that began before the trace did
+			if (fname == "")
+				fname = "?"
+			if (dur >= 0)
+				record(fname, root[k] fname, dur, dur - cs[k, 0])
+			cs[k, 0] = 0
+			partial++
+		}
+	}
+}
+END {
+	for (f in calls)
+		printf "%d\t%.3f\t%.3f\t%.3f\t%.3f\t%s\n", calls[f], fincl[f] / 1000,
+			fexcl[f] / 1000, fincl[f] / calls[f] / 1000, fmax[f] / 1000, f > FUNCS
+	for (p in pcalls) {
+		printf "%d\t%.3f\t%.3f\t%s\n", pcalls[p], pincl[p] / 1000,
+			pexcl[p] / 1000, p > PATHS
+		if (pexcl[p] > 0)
+			printf "%s %d\n", p, pexcl[p] > FOLDED
+	}
+	printf "%d calls aggregated; %d CPU/task stream(s); %d partial (began before the trace), %d resync(s)\n",
+		nrec, nkeys, partial, unmatched
+}
+EOF
+
+awk -f ${TMP}/agg.awk -v TASKROOT=${TASKROOT} -v FUNCS=${TMP}/funcs \
+	-v PATHS=${TMP}/paths -v FOLDED=${TMP}/folded "$@" || die "awk failed"
+[ -s ${TMP}/funcs ] || die "no function_graph entries found"
+sort ${TMP}/folded > ${FOLDED} || die "couldn't write ${FOLDED}"
+
+echo
+echo "Top ${TOPN} functions, by $([ ${SORTCOL} -eq 3 ] && echo exclusive || echo inclusive) time (us):"
+printf "%9s %13s %13s %11s %11s  %s\n" "calls" "incl" "excl" "avg-incl" "max-incl" "function"
+sort -t"	" -k${SORTCOL},${SORTCOL}nr ${TMP}/funcs | head -n ${TOPN} | \
+  awk -F"\t" '{ printf "%9d %13s %13s %11s %11s  %s\n", $1, $2, $3, $4, $5, $6 }'
+
+echo
+echo "Top ${TOPN} call paths, by inclusive time (us):"
+printf "%9s %13s %13s  %s\n" "calls" "incl" "excl" "path"
+sort -t"	" -k2,2nr ${TMP}/paths | head -n ${TOPN} | \
+  awk -F"\t" '{ printf "%9d %13s %13s  %s\n", $1, $2, $3, $4 }'
+
+echo
+echo "Folded stacks (self time, ns): ${FOLDED}"
+exit 0
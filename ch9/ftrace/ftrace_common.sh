@@ -21,13 +21,66 @@ die()
  exit 1
 }
 
+# The tracefs mount point; the top-level trace 'instance' lives here
+TRACEFS=/sys/kernel/tracing
+[ -d ${TRACEFS}/instances ] || TRACEFS=/sys/kernel/debug/tracing
+# Function lists are global (not per instance)
+AVAIL_FUNCS=${TRACEFS}/available_filter_functions
+
+# instance_enter()
+# cd to the tracefs dir, or - with a name - to the trace instance of that
+# name: instances/<name>, created if it doesn't yet exist. An instance is a
+# tracing session of its own: its own ring buffers (and sizes), tracer,
+# options, function, event and PID filters; several can run at once, and
+# alongside the top-level one, without interfering with each other.
+# (Some things remain global - f.e. available_filter_functions,
+# max_graph_depth, set_graph_function; also, older kernels allow only the
+# function (not function_graph) tracer in an instance).
+# Parameters:
+#  $1 : the instance name [optional; default: the top-level]
+instance_enter()
+{
+cd ${TRACEFS} || die "can't cd to ${TRACEFS} (tracefs not mounted?)"
+[ -z "$1" ] && return
+if [ ! -d instances/$1 ] ; then
+  mkdir instances/$1 || die "creating trace instance $1 failed"
+  echo "[+] created trace instance $1"
+fi
+cd instances/$1 || die "can't cd to instances/$1"
+}
+
+# instance_remove()
+# Remove the named trace instance, freeing its buffers. Fails (EBUSY) while
+# something has its files open.
+instance_remove()
+{
+[ -z "$1" ] && return
+[ -d ${TRACEFS}/instances/$1 ] || return
+rmdir ${TRACEFS}/instances/$1 || echo "removing trace instance $1 failed (in use?)"
+}
+
+# in_instance(): are we in a trace instance (not the top-level) dir?
+in_instance()
+{
+[ "$(basename $(dirname $(pwd)))" = "instances" ]
+}
+
+# reset_ftrace()
+# Reset the trace session we're in (the cwd): the top-level one, or an
+# instance. In an instance only its own files are touched, so whatever other
+# sessions are running aren't clobbered; files that don't exist here (the
+# global ones, or those of tracers not built in) are skipped.
 reset_ftrace()
 {
-local f
+local f opt
 
+if in_instance ; then
+  echo nop > current_tracer
+  echo > set_event
+  [ -f set_event_pid ] && echo > set_event_pid
 # Check: if trace-cmd is installed, use it to reset
 # But it doesn't auto reset everything we want, so let the other stuff also get reset
-if which trace-cmd >/dev/null ; then
+elif which trace-cmd >/dev/null ; then
   echo "trace-cmd reset    (patience, pl...)"
   trace-cmd reset
 fi
@@ -41,60 +94,42 @@ echo > trace
 # Causes trace to fail... as a value of 0x0 as cpu bitmask effectively disables
 # tracing!
 
-for f in set_ftrace_filter set_ftrace_notrace set_ftrace_notrace_pid set_ftrace_pid
+for f in set_ftrace_filter set_ftrace_notrace set_ftrace_notrace_pid set_ftrace_pid \
+  set_graph_function set_graph_notrace
 do
+ [ -f $f ] || continue
  echo "resetting $f"
  echo > $f 
 done
 
 # trace_options to defaults (as of 5.10.60)
+# (some are global - f.e. trace_printk, record-cmd - and so aren't there in
+# an instance's options/)
 echo "resetting trace_options to defaults (as of 5.10.60)"
-echo print-parent > trace_options 
-echo nosym-offset > trace_options
-echo nosym-addr > trace_options
-echo noverbose > trace_options
-echo noraw > trace_options
-echo nohex > trace_options
-echo nobin > trace_options
-echo noblock > trace_options
-echo trace_printk > trace_options
-echo annotate > trace_options
-echo nouserstacktrace > trace_options
-echo nosym-userobj > trace_options
-echo noprintk-msg-only > trace_options
-echo context-info > trace_options
-echo nolatency-format > trace_options
-echo record-cmd > trace_options
-echo norecord-tgid > trace_options
-echo overwrite > trace_options
-echo nodisable_on_free > trace_options
-echo irq-info > trace_options
-echo markers > trace_options
-echo noevent-fork > trace_options
-echo nopause-on-trace > trace_options
-echo function-trace > trace_options
-echo nofunction-fork > trace_options
-echo nodisplay-graph > trace_options
-echo nostacktrace > trace_options
+for opt in print-parent nosym-offset nosym-addr noverbose noraw nohex nobin \
+  noblock trace_printk annotate nouserstacktrace nosym-userobj \
+  noprintk-msg-only context-info nolatency-format record-cmd norecord-tgid \
+  overwrite nodisable_on_free irq-info markers noevent-fork nopause-on-trace \
+  function-trace nofunction-fork nodisplay-graph nostacktrace
+do
+ [ -f options/${opt#no} ] && echo ${opt} > trace_options
+done
 #echo notest_nop_accept > trace_options
 #echo notest_nop_refuse > trace_options
 
 # options/funcgraph-*  to defaults
 echo "resetting options/funcgraph-*"
-echo 0 > options/funcgraph-abstime
-echo 1 > options/funcgraph-cpu
-echo 1 > options/funcgraph-duration
-echo 1 > options/funcgraph-irqs
-echo 1 > options/funcgraph-overhead
-echo 0 > options/funcgraph-overrun
-echo 0 > options/funcgraph-proc
-echo 0 > options/funcgraph-tail
-
-echo 0 > max_graph_depth
-
-# perf-tools ftrace reset script 
+for opt in abstime:0 cpu:1 duration:1 irqs:1 overhead:1 overrun:0 proc:0 tail:0
+do
+ f=options/funcgraph-${opt%:*}
+ [ -f $f ] && echo ${opt#*:} > $f
+done
+
+[ -f max_graph_depth ] && echo 0 > max_graph_depth
+
+# perf-tools ftrace reset script (top-level only)
 f=$(which reset-ftrace-perf)
-[ ! -z "$f" ] && {
+[ ! -z "$f" ] && ! in_instance && {
   echo "running '$f -q' now..."
   $f -q
 }
@@ -107,6 +142,174 @@ echo 0 > tracing_on
 echo > trace
 }
 
+# calibrate_bufsize()
+# Size the per-CPU ring buffers from the *measured* event rate, instead of a
+# fixed guess: trace, with the tracer and filters as they're currently set up,
+# for a calibration run; then, from per_cpu/cpuN/stats, get each CPU's event
+# count (entries + overrun) and mean event size (bytes / entries), and set
+# per_cpu/cpuN/buffer_size_kb to hold that rate for the given duration (plus
+# 25% headroom; 100% when calibrated on a command, as runs vary). Idle CPUs
+# (or those not in tracing_cpumask) get the minimum.
+# The calibration run is best done with the actual workload: pass the command
+# that runs it (under the PID filter; f.e. via trc_launch, with its -T so that
+# it switches tracing on and off); the duration then defaults to how long it
+# took. Without one, we just trace for a window of the given length.
+# If that's more than the memory cap, the sizes are scaled down to fit, and we
+# report how many events to expect to lose. If next to nothing was seen (the
+# workload didn't show up, or wasn't given), we fall back to the old
+# heuristic: the cap percent of MemAvailable, per CPU (at least 2 MB).
+# Run in the tracefs (or instance) dir, after setting up the tracer and
+# filters, with tracing off. Leaves the trace buffer empty.
+# Parameters:
+#  $1 : duration (seconds) the real trace will run for; 0 : as long as the
+#       calibration command took [required]
+#  $2 : calibration window, seconds, when no command's given [default 1]
+#  $3 : memory cap, in percent of MemAvailable, all CPUs [optional; default 5]
+#  $4... : the calibration command [optional]
+calibrate_bufsize()
+{
+[ $# -lt 1 ] && return
+local dur=$1 win=${2:-1} pct=${3:-5}
+local availkb capkb t1 t2 headroom=1.25
+
+shift 3 2>/dev/null || shift $#
+availkb=$(grep "^MemAvailable" /proc/meminfo |awk '{print $2}')
+capkb=$((availkb*pct/100))
+echo > trace
+if [ $# -ge 1 ] ; then
+  echo "[+] calibrating the buffer size: a run of '$*' ..."
+  t1=$(date +%s%N)
+  "$@" >/dev/null 2>&1
+  t2=$(date +%s%N)
+  echo 0 > tracing_on
+  headroom=2
+  win=$(awk -v NS=$((t2-t1)) 'BEGIN { printf "%.3f", (NS > 1000000 ? NS : 1000000) / 1e9 }')
+else
+  [ ${dur} = "0" ] && { echo "calibrate_bufsize: no duration and no command" ; return ; }
+  echo "[+] calibrating the buffer size: tracing for ${win}s ..."
+  echo 1 > tracing_on ; sleep ${win} ; echo 0 > tracing_on
+fi
+[ ${dur} = "0" ] && dur=${win}
+
+awk -v DUR=${dur} -v WIN=${win} -v CAPKB=${capkb} -v PCT=${pct} -v AVAILKB=${availkb} \
+    -v HEADROOM=${headroom} '
+/^entries:/ { cpu = FILENAME; sub(/.*cpu/, "", cpu); sub(/\/.*/, "", cpu)
+              cpu += 0; ent[cpu] = $2; if (cpu > maxcpu) maxcpu = cpu }
+/^overrun:/ { ovr[cpu] = $2 }
+/^bytes:/   { byt[cpu] = $2 }
+END {
+	MINKB = 64
+	NEARZERO = 100		# events, all CPUs
+	if (WIN <= 0)
+		WIN = 1
+	for (c in ent) {
+		ev = ent[c] + ovr[c]
+		avg = ent[c] ? byt[c] / ent[c] : 0
+		rate[c] = ev / WIN			# events/s
+		need[c] = int(ev * avg / WIN * DUR * HEADROOM / 1024) + 1
+		if (need[c] < MINKB)
+			need[c] = MINKB
+		total += need[c]
+		evtotal += rate[c] * DUR
+		evseen += ev
+	}
+	if (evseen < NEARZERO) {
+		# nothing to go by: the old fixed heuristic, per CPU
+		kb = int(AVAILKB * PCT / 100)
+		if (kb < 2048)
+			kb = 2048
+		for (c = 0; c <= maxcpu; c++)
+			if (c in ent)
+				printf "%s %d\n", c, kb
+		printf "  only %d events seen in %ss: can'\''t calibrate; using %d KB per CPU (%d%% of MemAvailable)\n",
+			evseen, WIN, kb, PCT > "/dev/stderr"
+		exit
+	}
+	scale = (total > CAPKB) ? CAPKB / total : 1
+	for (c = 0; c <= maxcpu; c++) {
+		if (!(c in ent))
+			continue
+		kb = int(need[c] * scale)
+		if (kb < MINKB)
+			kb = MINKB
+		printf "%s %d\n", c, kb
+		printf "  cpu%-3s %10.0f events/s -> %8d KB\n", c, rate[c], kb > "/dev/stderr"
+	}
+	if (scale < 1)
+		printf "  capped at %d%% of MemAvailable (%d KB, need %d KB): expect to lose ~%.0f events (%.0f%%) over %ss\n",
+			PCT, CAPKB, total, evtotal * (1 - scale), (1 - scale) * 100, DUR > "/dev/stderr"
+	else
+		printf "  total %d KB, for ~%.0f events over %ss: no overruns expected\n",
+			total, evtotal, DUR > "/dev/stderr"
+}' per_cpu/cpu*/stats | while read cpu kb ; do
+  echo ${kb} > per_cpu/cpu${cpu}/buffer_size_kb || echo "setting cpu${cpu} buffer size failed"
+done
+echo > trace
+}
+
+# cpu_online <cpu>: is this CPU # online (per /sys/devices/system/cpu/online,
+# a list like 0-3,6)?
+cpu_online()
+{
+[[ "$1" =~ ^[0-9]+$ ]] || return 1
+awk -F, -v C=$1 '{
+	for (i = 1; i <= NF; i++) {
+		n = split($i, r, "-")
+		if (C >= r[1] + 0 && C <= r[n] + 0)
+			found = 1
+	}
+} END { exit !found }' /sys/devices/system/cpu/online
+}
+
+# cpumask_of <cpu>: the mask with just this CPU set, as tracing_cpumask takes
+# it: comma-separated 32-bit hex words, most significant first (a shift into a
+# single number would wrap at CPU 64)
+cpumask_of()
+{
+local w mask
+
+mask=$(printf "%x" $((1 << ($1 % 32))))
+for ((w = $1 / 32; w > 0; w--)) ; do
+  mask="${mask},00000000"
+done
+echo ${mask}
+}
+
+# trace_drops()
+# Was the trace complete? Reads per_cpu/cpuN/stats and reports, per CPU, the
+# events lost: 'overrun' (overwritten before being read; overwrite mode),
+# 'dropped events' (discarded as the buffer was full; no-overwrite mode) and
+# 'commit overrun' (nested writers overflowing a page). Run in the tracefs
+# (or instance) dir, after tracing's stopped and before the buffer's cleared.
+# Returns 0 if nothing was lost, 1 if the trace is lossy.
+trace_drops()
+{
+awk '
+/^entries:/        { cpu = FILENAME; sub(/.*cpu/, "", cpu); sub(/\/.*/, "", cpu)
+                     ent[cpu] = $2 }
+/^overrun:/        { ovr[cpu] = $2 }
+/^commit overrun:/ { cov[cpu] = $3 }
+/^dropped events:/ { drp[cpu] = $3 }
+END {
+	for (c in ent) {
+		lost = ovr[c] + cov[c] + drp[c]
+		if (!lost)
+			continue
+		if (!n++)
+			printf "%6s %12s %12s %12s %12s\n", "cpu", "entries", "overrun",
+				"commit-ovr", "dropped"
+		printf "%6s %12d %12d %12d %12d  (%.1f%% lost)\n", "cpu" c, ent[c],
+			ovr[c], cov[c], drp[c], lost * 100 / (ent[c] + lost)
+		tlost += lost
+	}
+	if (n) {
+		printf "*** WARNING: the trace is LOSSY: %d events lost on %d CPU(s) ***\n", tlost, n
+		exit 1
+	}
+	print "[+] no events lost: the trace is complete"
+}' per_cpu/cpu*/stats
+}
+
 runcmd()
 {
 	[ $# -eq 0 ] && return
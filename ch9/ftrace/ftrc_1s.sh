@@ -13,6 +13,8 @@
 # Brief Description:
 # Very simple (raw) usage of kernel ftrace; traces whatever executes within
 # the kernel for 1 second.
+# With -i <name>, the trace is done in a trace instance of that name (created
+# and, after, removed), so that it doesn't disturb any other ftrace session.
 #
 # For details, please refer the book, Ch 9.
 #------------------------------------------------------------------------------
@@ -28,17 +30,31 @@ source $(dirname $0)/ftrace_common.sh || {
 REPDIR=~/ftrace_reports
 FTRC_REP=${REPDIR}/${name}_$(date +%Y%m%d_%H%M%S).txt
 
-cd /sys/kernel/tracing
+INSTANCE=""
+[ "$1" = "-i" ] && {
+  [ -z "$2" ] && die "Usage: ${name} [-i instance-name]"
+  INSTANCE=$2
+  FTRC_REP=${REPDIR}/${name}_${INSTANCE}_$(date +%Y%m%d_%H%M%S).txt
+}
+
+instance_enter ${INSTANCE}
 reset_ftrace
 
 grep -q -w function_graph available_tracers || die "tracer specified function_graph unavailable"
 echo function_graph > current_tracer || die "setting function_graph plugin failed"
 echo 1 > options/funcgraph-proc
 echo 1 > options/latency-format
+# timestamps: needed to convert the report (../trc2perfetto.sh)
+echo 1 > options/funcgraph-abstime
 
 echo "Tracing with function_graph for 1s ..."
 echo 1 > tracing_on ; sleep 1 ; echo 0 > tracing_on
+trace_drops
 mkdir -p ${REPDIR} 2>/dev/null
 cp trace ${FTRC_REP}
 ls -lh ${FTRC_REP}
+[ -n "${INSTANCE}" ] && {
+  cd ${TRACEFS}
+  instance_remove ${INSTANCE}
+}
 exit 0
@@ -0,0 +1,428 @@
+#!/bin/bash
+# ch9/ftrace/hist_trig.sh
+# ***************************************************************
+# This program is part of the source code released for the book
+#  "Linux Kernel Debugging"
+#  (c) Author: Kaiwan N Billimoria
+#  Publisher:  Packt
+#  GitHub repository:
+#  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+#
+# From: Ch 9: Tracing the kernel flow
+#***************************************************************
+# Brief Description:
+# Aggregate in the kernel, not in a trace report: a frontend to ftrace's
+# histogram ('hist:') triggers (CONFIG_HIST_TRIGGERS). Instead of recording
+# every event into the ring buffer and formatting it as text (as ping_ftrace.sh
+# does), the kernel updates a hash table - keyed as we say, summing the values
+# we say - on every hit; all that's read back is the table.
+# We build the triggers from short specs, install them, run the workload (or
+# wait), collect the events/<sys>/<event>/hist files, remove the triggers
+# and print the tables.
+#
+# Spec syntax (one per -s):
+#  a) an event histogram:
+#      <sys>:<event>:key=k1[.mod][,k2...][:val=v1[,v2...]][:sort=f][:if=filter]
+#     f.e.  net:net_dev_xmit:key=comm,len.log2
+#           kmem:kmalloc:key=call_site.sym:val=bytes_req:sort=bytes_req
+#  b) a latency histogram, between two events: a synthetic event ('lat', in
+#     usecs) is generated when the end event matches a start one (on the
+#     match field(s)), and it's that that's histogrammed:
+#      <sys>:<start-event>-><sys>:<end-event>:match=f[,g][:key=k1,...]
+#                                             [:log2|:buckets=N][:if=filter]
+#     (match=f,g : field f of the start event matches field g of the end one;
+#      key fields are those of the end event; if= applies to it as well)
+#     f.e.  net:net_dev_start_xmit->net:net_dev_xmit:match=skbaddr:key=comm:log2
+#           sched:sched_waking->sched:sched_switch:match=pid,next_pid:key=next_comm:log2
+# Key 'comm' is the task's name (common_pid.execname), unless the event has a
+# 'comm' field of its own; 'pid' is common_pid. Modifiers are as the kernel
+# takes them: .log2 .buckets=N .sym .sym-offset .execname .hex .usecs ...
+# If the hist's 'Dropped' count isn't zero, the table filled up; the
+# aggregation is incomplete.
+#
+# For details, please refer the book, Ch 9.
+#------------------------------------------------------------------------------
+name=$(basename $0)
+[ $(id -u) -ne 0 ] && {
+  echo "${name}: needs root."
+  exit 1
+}
+source $(dirname $0)/ftrace_common.sh || {
+ echo "Couldn't source required file $(dirname $0)/ftrace_common.sh"
+ exit 1
+}
+REPDIR=$(pwd)/ftrace_reports
+
+usage()
+{
+ echo "Usage: ${name} -s spec [-s spec ...] [options] [-- command ...]
+ Install ftrace hist triggers per the spec(s), run the command (or wait),
+ then collect, print and remove them. (See the script header for the spec
+ syntax.)
+  -d secs     : with no command, aggregate for this long (default: till ^C)
+  -i instance : use this ftrace instance (default: the top-level)
+  -n N        : show the top N entries of each table (default 20)
+  -o dir      : save the raw hist files here
+                (default ${REPDIR}/hist_<date_time>)
+  -h          : this help
+ F.e.
+  ${name} -s 'net:net_dev_start_xmit->net:net_dev_xmit:match=skbaddr:key=comm:log2' \\
+     -- ping -c5 packtpub.com"
+}
+
+SPECS=()
+DURATION=0
+INSTANCE=""
+TOPN=20
+OUTDIR=${REPDIR}/hist_$(date +%Y%m%d_%H%M%S)
+
+while getopts "s:d:i:n:o:h" opt; do
+  case "${opt}" in
+    s) SPECS+=("${OPTARG}") ;;
+    d) DURATION=${OPTARG} ;;
+    i) INSTANCE=${OPTARG} ;;
+    n) TOPN=${OPTARG} ;;
+    o) OUTDIR=${OPTARG} ;;
+    h) usage ; exit 0 ;;
+    *) usage ; exit 1 ;;
+  esac
+done
+shift $((OPTIND-1))
+[ ${#SPECS[@]} -eq 0 ] && { usage ; exit 1 ; }
+
+# Installed triggers and synthetic events, in order: "<file>|<definition>";
+# removed in reverse order (an onmatch() trigger before the synthetic event
+# it generates, a synthetic event's hist before the event itself)
+INSTALLED=()
+# The hist files to collect: "<sys>:<event>|<title>"
+HISTS=()
+
+# install <file> <definition>
+install()
+{
+echo "  $2 >> ${1#${TRACEFS}/}"
+echo "$2" >> $1 || {
+  [ -f error_log ] && tail -n3 error_log
+  die "installing '$2' failed (see error_log)"
+}
+INSTALLED+=("$1|$2")
+}
+
+cleanup()
+{
+local i f def
+
+for ((i=${#INSTALLED[@]}-1; i>=0; i--)) ; do
+  f=${INSTALLED[$i]%%|*}
+  def=${INSTALLED[$i]#*|}
+  # a synthetic event's removed by name; a trigger by its full definition
+  [ "${f##*/}" = "synthetic_events" ] && def=${def%% *}
+  echo "!${def}" >> ${f} 2>/dev/null || echo "${name}: warning: couldn't remove '${def}' from ${f}"
+done
+INSTALLED=()
+}
+
+# field_type <sys> <event> <field>: the field's type, as a synthetic event
+# field declaration wants it; empty if the event has no such field (or it's
+# an array of other than char).
+# Synthetic events know only the basic C types (and char arrays): pointers
+# and anything else (size_t, enums, dma_addr_t, ...) become the uN/sN of the
+# same size and signedness (which is what the kernel checks the var against).
+field_type()
+{
+awk -v F="$3" '
+BEGIN {
+	nt = split("s8 u8 s16 u16 s32 u32 s64 u64 char short int long bool pid_t gfp_t " \
+		"unsigned_char unsigned_short unsigned_int unsigned_long " \
+		"long_long unsigned_long_long", tl, " ")
+	for (i = 1; i <= nt; i++) {
+		gsub(/_/, " ", tl[i])
+		known[tl[i]] = 1
+	}
+}
+/^[ \t]*field:/ {
+	d = $0
+	sub(/^[ \t]*field:/, "", d)
+	sub(/;.*/, "", d)
+	n = split(d, w, " ")
+	fname = w[n]
+	arr = ""
+	if (match(fname, /\[.*\]$/)) {
+		arr = substr(fname, RSTART)
+		fname = substr(fname, 1, RSTART - 1)
+	}
+	if (fname != F)
+		next
+	if (w[1] == "__data_loc") {		# a dynamic string
+		print "char[32]"
+		exit
+	}
+	t = w[1]
+	for (i = 2; i < n; i++)
+		t = t " " w[i]
+	sub(/^(const|volatile) /, "", t)
+	if (arr != "" && t == "char") {
+		print t arr
+		exit
+	}
+	if (arr != "" || !(t in known)) {
+		# a pointer, or a type synthetic events don\047t know
+		sz = $0
+		sub(/.*size:/, "", sz)
+		sz = sz + 0
+		if (arr != "" || (sz != 1 && sz != 2 && sz != 4 && sz != 8))
+			exit
+		print ((t !~ /\*/ && $0 ~ /signed:1/) ? "s" : "u") sz * 8
+		exit
+	}
+	print t
+	exit
+}' events/$1/$2/format
+}
+
+# map_key <sys> <event> <key[.mod]>: the special keys; comm and pid
+map_key()
+{
+local base=${3%%.*}
+
+case "${base}" in
+  comm) [ -z "$(field_type $1 $2 comm)" ] && { echo common_pid.execname ; return ; } ;;
+  pid)  [ -z "$(field_type $1 $2 pid)" ] && { echo common_pid${3#pid} ; return ; } ;;
+esac
+echo $3
+}
+
+# spec_event <sys:event-spec>: the hist trigger for an event histogram
+spec_event()
+{
+local sys ev keys="" vals="" sort="" filter="" k def tok
+local IFS=:
+
+set -- $1
+sys=$1 ; ev=$2 ; shift 2
+[ -d events/${sys}/${ev} ] || die "no such event: ${sys}:${ev}"
+for tok in "$@" ; do
+  case "${tok}" in
+    key=*)  keys=${tok#key=} ;;
+    val=*)  vals=${tok#val=} ;;
+    sort=*) sort=${tok#sort=} ;;
+    if=*)   filter=${tok#if=} ;;
+    *) die "spec ${sys}:${ev}: unknown '${tok}'" ;;
+  esac
+done
+[ -z "${keys}" ] && die "spec ${sys}:${ev}: a key= is required"
+
+IFS=,
+def=""
+for k in ${keys} ; do
+  def=${def:+${def},}$(map_key ${sys} ${ev} ${k})
+done
+IFS=" "
+def="hist:keys=${def}"
+[ -n "${vals}" ] && def="${def}:vals=${vals}"
+[ -n "${sort}" ] && def="${def}:sort=${sort}"
+[ -n "${filter}" ] && def="${def} if ${filter}"
+install events/${sys}/${ev}/trigger "${def}"
+HISTS+=("${sys}:${ev}|${sys}:${ev}")
+}
+
+# spec_latency <n> <sys:start->sys:end-spec>: a synthetic event, the two
+# triggers that generate it, and its hist trigger
+spec_latency()
+{
+local n=$1 start end s_sys s_ev e_sys e_ev tok
+local match="" keys="" bucket="" filter="" s_match e_match
+local syn synfields="u64 lat" params="\$lat" hkeys="" hsort="" k base t
+local IFS=:
+
+start=${2%%->*}
+end=${2#*->}
+s_sys=${start%%:*} ; s_ev=${start#*:}
+set -- ${end}
+e_sys=$1 ; e_ev=$2 ; shift 2
+[ -d events/${s_sys}/${s_ev} ] || die "no such event: ${s_sys}:${s_ev}"
+[ -d events/${e_sys}/${e_ev} ] || die "no such event: ${e_sys}:${e_ev}"
+for tok in "$@" ; do
+  case "${tok}" in
+    match=*)   match=${tok#match=} ;;
+    key=*)     keys=${tok#key=} ;;
+    log2)      bucket=.log2 ;;
+    buckets=*) bucket=.${tok} ;;
+    if=*)      filter=${tok#if=} ;;
+    *) die "spec ${s_ev}->${e_ev}: unknown '${tok}'" ;;
+  esac
+done
+[ -z "${match}" ] && die "spec ${s_ev}->${e_ev}: a match= is required"
+s_match=${match%%,*}
+e_match=${match#*,}
+
+# the synthetic event: the latency, plus the end event's key fields
+syn=htrig_lat${n}
+IFS=,
+for k in ${keys} ; do
+  base=${k%%.*}
+  k=$(map_key ${e_sys} ${e_ev} ${k})
+  if [ "${k%%.*}" = "common_pid" ] ; then
+    # the synthetic event fires in the end event's context: same task
+    hkeys=${hkeys:+${hkeys},}${k}
+    continue
+  fi
+  t=$(field_type ${e_sys} ${e_ev} ${base})
+  [ -z "${t}" ] && die "${e_sys}:${e_ev}: no field '${base}', or its type can't go in a synthetic event"
+  case "${t}" in
+    *\[*) synfields="${synfields}; ${t%%\[*} ${base}[${t#*\[}" ;;
+    *)    synfields="${synfields}; ${t} ${base}" ;;
+  esac
+  params="${params},${base}"
+  hkeys=${hkeys:+${hkeys},}${k}
+done
+IFS=" "
+hkeys=${hkeys:+${hkeys},}lat${bucket}
+# (at most 2 sort keys): by the first key, then the latency buckets
+[ "${hkeys%%,*}" != "lat${bucket}" ] && hsort=${hkeys%%[.,]*},
+hsort=${hsort}lat
+
+install ${TRACEFS}/synthetic_events "${syn} ${synfields}"
+install events/${s_sys}/${s_ev}/trigger "hist:keys=${s_match}:ts0=common_timestamp.usecs"
+install events/${e_sys}/${e_ev}/trigger \
+  "hist:keys=${e_match}:lat=common_timestamp.usecs-\$ts0:onmatch(${s_sys}.${s_ev}).${syn}(${params})${filter:+ if ${filter}}"
+install events/synthetic/${syn}/trigger "hist:keys=${hkeys}:sort=${hsort}"
+HISTS+=("synthetic:${syn}|latency (us) ${s_sys}:${s_ev} -> ${e_sys}:${e_ev}")
+}
+
+# show <histfile> <title>: the table, top N by hitcount; log2 and bucket keys
+# also as a distribution, per (rest of the) key
+show()
+{
+echo
+echo "=== $2"
+grep "^# trigger info:" $1 | sed 's/^# trigger info: */  /'
+awk -v TOPN=${TOPN} '
+/^\{/ {
+	k = $0
+	sub(/^\{ */, "", k)
+	v = substr(k, index(k, "}") + 1)
+	k = substr(k, 1, index(k, "}") - 1)
+	gsub(/  +/, " ", k)
+	gsub(/ ,/, ",", k)
+	sub(/ $/, "", k)
+	hits = 0
+	if (match(v, /hitcount: *[0-9]+/)) {
+		hits = substr(v, RSTART, RLENGTH)
+		sub(/hitcount: */, "", hits)
+	}
+	gsub(/  +/, " ", v)
+	sub(/^ /, "", v)
+	n++
+	key[n] = k; val[n] = v; hit[n] = hits + 0
+	# a bucketed key: split into the rest of the key and the bucket
+	if (match(k, /[a-z_0-9]+: ~ 2\^[0-9]+|[a-z_0-9]+: ~ [0-9]+-[0-9]+/)) {
+		b = substr(k, RSTART, RLENGTH)
+		rest = substr(k, 1, RSTART - 1) substr(k, RSTART + RLENGTH)
+		gsub(/^[ ,]+|[ ,]+$/, "", rest)
+		sub(/^[a-z_0-9]+: ~ /, "", b)
+		grp[rest] += hits
+		dist[rest, b] = hits
+		if (!((rest, "list") in dist))
+			dist[rest, "list"] = ""
+		dist[rest, "list"] = dist[rest, "list"] "\t" b
+		bucketed = 1
+	}
+	next
+}
+/^ *Hits:/    { thits = $2 }
+/^ *Entries:/ { tent = $2 }
+/^ *Dropped:/ { tdrop = $2 }
+END {
+	if (!n) {
+		print "  (no hits)"
+		exit
+	}
+	# top N, by hitcount (a simple selection; the tables are small)
+	for (i = 1; i <= n; i++)
+		ord[i] = i
+	for (i = 1; i <= n && i <= TOPN; i++) {
+		m = i
+		for (j = i + 1; j <= n; j++)
+			if (hit[ord[j]] > hit[ord[m]])
+				m = j
+		t = ord[i]; ord[i] = ord[m]; ord[m] = t
+		printf "  %-60s %s\n", key[ord[i]], val[ord[i]]
+	}
+	if (n > TOPN)
+		printf "  ... (%d more)\n", n - TOPN
+	if (bucketed) {
+		for (g in grp) {
+			printf "\n  %s\n", (g == "" ? "(all)" : g)
+			nb = split(dist[g, "list"], bl, "\t")
+			# buckets as ordered in the kernel output; scale the bars
+			mx = 0
+			for (i = 2; i <= nb; i++)
+				if (dist[g, bl[i]] > mx)
+					mx = dist[g, bl[i]]
+			for (i = 2; i <= nb; i++) {
+				c = dist[g, bl[i]]
+				bar = ""
+				for (j = 0; j < int(c * 40 / mx + 0.5); j++)
+					bar = bar "#"
+				printf "    %16s : %9d |%-40s|\n", bl[i], c, bar
+			}
+		}
+	}
+	printf "  hits %d, entries %d, dropped %d\n", thits, tent, tdrop
+	if (tdrop > 0)
+		print "  *** WARNING: entries were dropped (the table was full): the aggregation is incomplete ***"
+}' $1
+}
+
+#--- 'main' here
+instance_enter ${INSTANCE}
+ls events/*/*/trigger >/dev/null 2>&1 || die "no event triggers here; tracefs not mounted?"
+[ -f ${TRACEFS}/synthetic_events ] || \
+  echo "${name}: note: no synthetic_events; latency specs won't work (CONFIG_SYNTH_EVENTS?)"
+mkdir -p ${OUTDIR} || die "mkdir ${OUTDIR} failed"
+
+trap 'cleanup ; exit 1' INT TERM
+trap cleanup EXIT
+
+echo "[+] installing hist triggers:"
+n=0
+for spec in "${SPECS[@]}" ; do
+  n=$((n+1))
+  case "${spec}" in
+    *-\>*) spec_latency ${n} "${spec}" ;;
+    *)     spec_event "${spec}" ;;
+  esac
+done
+for h in "${HISTS[@]}" ; do
+  ev=${h%%|*}
+  [ -f events/${ev/://}/hist ] || die "no events/${ev/://}/hist (CONFIG_HIST_TRIGGERS?)"
+done
+
+t1=$(date +%s%N)
+if [ $# -ge 1 ] ; then
+  echo "[+] running: $*"
+  "$@"
+elif [ ${DURATION} -gt 0 ] ; then
+  echo "[+] aggregating for ${DURATION}s ..."
+  sleep ${DURATION}
+else
+  echo "[+] aggregating ... ^C to stop"
+  trap 'echo' INT
+  sleep infinity
+  trap 'cleanup ; exit 1' INT
+fi
+t2=$(date +%s%N)
+
+# collect all the tables first, then remove the triggers, then show
+for h in "${HISTS[@]}" ; do
+  ev=${h%%|*}
+  cp events/${ev/://}/hist ${OUTDIR}/${ev/:/.}.hist
+done
+cleanup
+echo "[+] aggregated over $(((t2-t1)/1000000)) ms; hist files in ${OUTDIR}/"
+for h in "${HISTS[@]}" ; do
+  ev=${h%%|*}
+  show ${OUTDIR}/${ev/:/.}.hist "${h#*|}"
+done
+exit 0
@@ -38,31 +38,71 @@ source $(dirname $0)/ftrace_common.sh || {
 REPDIR=$(pwd)/ftrace_reports
 FTRC_REP=${REPDIR}/${name}_$(date +%Y%m%d).txt
 #FTRC_REP=${REPDIR}/${name}_$(date +%Y%m%d_%H%M%S).txt
-TOP=$(pwd)
+# our launcher: forks, sets the PID filter to the child, execs (see trc_launch.c)
+LAUNCHER=$(realpath $(dirname $0))/trc_launch
 
 usage() {
- echo "Usage: ${name} function(s)-to-trace
+ echo "Usage: ${name} [-i instance [-k]] [function(s)-to-trace]
+ -i instance : trace in this (new, or existing) ftrace instance - a session of
+               its own - instead of the top-level one; other ftrace sessions
+               can run alongside
+ -k          : keep the instance afterward (default: remove it)
  All available functions are in available_filter_functions.
- You can use globbing; f.e. ${name} kmem_cache*"
+ You can use globbing; f.e. ${name} kmem_cache*
+ Env: CMD (the command to trace; default '${CMD}') and TRC_CPU (the CPU
+ to run and trace it on; default ${TRC_CPU})"
 }
 
-# filterfunc_idx()
-# Index-based filtering! *much* faster than the usual string-based filtering.
-# Filter only these functions (into set_ftrace_filter) using the index
-# position of the function within the available_filter_functions interface.
+# filterfunc_set()
+# Index-based filtering, with the whole include/exclude set computed in user
+# space. Writing a glob (or even a '!glob') to set_ftrace_filter has the kernel
+# scan every traceable function, once per pattern - with 60k+ of them, and a
+# couple of dozen patterns, that's tens of seconds. Instead, we read
+# available_filter_functions just once, evaluate all the patterns against it
+# here (a single awk pass), and write the resulting index positions (their line
+# numbers in available_filter_functions) to set_ftrace_filter in one batch.
 # Parameters:
-#  $1 : function (globs ok) [required]
-#  $2 : description string  [optional]
-filterfunc_idx()
+#  $1 : functions to include: regexes (case-insensitive, matched anywhere in
+#       the function name, as with grep), space-separated [required]
+#  $2 : functions to exclude: globs (as set_ftrace_filter takes them; f.e.
+#       "rcu_*" "*idle*"), space-separated [optional]
+#  $3 : "glob" : the functions to include are globs too (as given on the
+#       command line) [optional]
+filterfunc_set()
 {
 [ $# -lt 1 ] && return
-#[ $# -ge 2 ] && echo "$2" || echo " $1 in available_filter_functions"
+local idx
 
-local func
-for func in "$@"
-do
-  echo $(grep -i -n ${func} available_filter_functions |cut -f1 -d':'|tr '\n' ' ') >> set_ftrace_filter
-done
+idx=$(awk -v INC="$1" -v EXC="$2" -v GLOB=$([ "$3" = "glob" ] && echo 1 || echo 0) '
+function glob2re(g) {
+	gsub(/[.+^$(){}|\\]/, "\\\\&", g)
+	gsub(/\*/, ".*", g)
+	gsub(/\?/, ".", g)
+	return "^" g "$"
+}
+BEGIN {
+	ni = split(GLOB ? INC : tolower(INC), inc, " ")
+	for (i = 1; GLOB && i <= ni; i++)
+		inc[i] = glob2re(inc[i])
+	ne = split(EXC, exc, " ")
+	for (i = 1; i <= ne; i++)
+		exc[i] = glob2re(exc[i])
+}
+{
+	fn = $1		# drop any " [module]" suffix
+	lfn = GLOB ? fn : tolower(fn)
+	for (i = 1; i <= ni; i++)
+		if (lfn ~ inc[i])
+			break
+	if (i > ni)
+		next
+	for (i = 1; i <= ne; i++)
+		if (fn ~ exc[i])
+			next
+	printf "%d ", NR
+}' ${AVAIL_FUNCS})
+[ -z "${idx}" ] && return
+echo ${idx} >> set_ftrace_filter
 }
 
 # Older string-based filtering; works but is much slower (than above index-based filtering)
@@ -70,30 +110,34 @@ filterfunc_str()
 {
 [ $# -lt 1 ] && return
 [ $# -ge 2 ] && echo "$2" || echo " $1 in available_filter_functions"
-echo $(grep -i $1 available_filter_functions) >> set_ftrace_filter
-echo $(grep -i $1 available_filter_functions) >> set_graph_function
-}
-
-# filterfunc_remove()
-# Filter to REMOVE these functions
-# Parameters:  $1 : function (globs ok) [required]
-filterfunc_remove()
-{
-[ $# -lt 1 ] && return
-
-local func
-for func in "$@"
-do
-  echo "!${func}" >> set_ftrace_filter || echo "removing ${func} failed"
-  echo "${func}" >> set_graph_notrace || echo "removing ${func} failed"
-done
+echo $(grep -i $1 ${AVAIL_FUNCS}) >> set_ftrace_filter
+[ -f set_graph_function ] && echo $(grep -i $1 ${AVAIL_FUNCS}) >> set_graph_function
 }
 
+# The command to trace, and the CPU it runs (and is traced) on
+CMD=${CMD:-ping -c1 packtpub.com}
+TRC_CPU=${TRC_CPU:-1}
 
 #--- 'main' here
+[ -x ${LAUNCHER} ] || die "${LAUNCHER} not found; build it first:
+ gcc -O2 -Wall $(dirname $0)/trc_launch.c -o ${LAUNCHER}"
+INSTANCE=""
+KEEP=0
+while getopts "i:kh" opt; do
+  case "${opt}" in
+    i) INSTANCE=${OPTARG} ;;
+    k) KEEP=1 ;;
+    h) usage ; exit 0 ;;
+    *) usage ; exit 1 ;;
+  esac
+done
+shift $((OPTIND-1))
 [ $# -ge 1 ] && FUNC2TRC="$@"
+cpu_online ${TRC_CPU} || die "TRC_CPU=${TRC_CPU}: not an online CPU (online: $(cat /sys/devices/system/cpu/online))"
+[ -n "${INSTANCE}" ] && FTRC_REP=${REPDIR}/${name}_${INSTANCE}_$(date +%Y%m%d).txt
 
-cd /sys/kernel/tracing
+instance_enter ${INSTANCE}
+[ -n "${INSTANCE}" ] && echo "[+] session: trace instance ${INSTANCE} ($(pwd))"
 
 echo "[+] resetting ftrace"
 reset_ftrace
@@ -121,27 +165,13 @@ echo 1 > options/funcgraph-abstime
 #echo 1 > /proc/sys/kernel/stack_tracer_enabled
 
 #--- per cpu buffer size
-# Try and use 5% of available memory
-# TODO/RELOOK:
-# Careful! This isn't well tested... if the amt of RAM isn't v large but the
-# number of CPU cores is, it can lead to problems
+# Sized from the event rate measured on a calibration run of the command, once
+# the filters are set (below): enough for a run of that length, using at most
+# PERCENT2USE % of available memory
 PERCENT2USE=5
-AVAILMEM_KB=$(grep "^MemAvailable" /proc/meminfo |awk '{print $2}')
-BUFSZ_PCPU_KB=$((${AVAILMEM_KB}*${PERCENT2USE}/100))
-BUFSZ_PCPU_MB=$((${BUFSZ_PCPU_KB}/1024))
-[ ${BUFSZ_PCPU_MB} -le 1 ] && BUFSZ_PCPU_MB=2
-echo "[+] setting buffer size to ${BUFSZ_PCPU_MB} MB / cpu"
-echo $((BUFSZ_PCPU_MB*1024)) > buffer_size_kb
 
 #---------------------- Function Filtering ------------------------------------
-# Any specific funcs to trace?
 echo > set_ftrace_filter   # reset
-if [ ! -z "${FUNC2TRC}" ]; then
-  grep -q "${FUNC2TRC}" available_filter_functions || die "function(s) specified aren't available for tracing"
-  echo "[+] setting set_ftrace_filter"
-  echo "${FUNC2TRC}" >> set_ftrace_filter
-  echo "${FUNC2TRC}" >> set_graph_function
-fi
 
 #--- Filtering of functions:
 # Can be done in one of two ways here:
@@ -154,15 +184,38 @@ fi
 # to keep it quick.
 FILTER_VIA_AVAIL_FUNCS=1
 
+#--- Functions we don't want (noise)
+# NOTE: depending on your particular kernel ver and config, this list of funcs
+# to remove can vary.
+EXCLUDE_FUNCS='*idle* tick_nohz_idle_stop_tick rcu_* *__rcu_*
+  *down_write* *up_write* *down_read* *up_read*
+  *get_task_policy* *kthread_blkcg*
+  *IPI* *ipi* *ipc* *xen* *pipe* *cipher* *chip* *__x32*
+  *vma* *__ia32* *__x64* *bpf* *calipso* eaf* setup_object_debug*
+  *alloc* *fail_alloc* *get_page* *prep_new* *numa* *kmem_* vm_*
+  *copy_page* *memcg* tick_* handle_mm* task_work*'
+  #*selinux*
+
+# Any specific funcs to trace? (less the unwanted ones, as for the others)
+if [ ! -z "${FUNC2TRC}" ]; then
+  grep -q "${FUNC2TRC}" ${AVAIL_FUNCS} || die "function(s) specified aren't available for tracing"
+  echo "[+] setting set_ftrace_filter"
+  filterfunc_set "${FUNC2TRC}" "${EXCLUDE_FUNCS}" glob
+  [ -f set_graph_function ] && echo "${FUNC2TRC}" >> set_graph_function
+fi
+
 echo "[+] Function filtering:"
 if [ ${FILTER_VIA_AVAIL_FUNCS} -eq 1 ] ; then
  # Filter on any network functions: (simplistic)
- # 'Inclusive' approach - include and trace only these functions
+ # 'Inclusive' approach - include and trace only these functions, less the
+ # unwanted ones; all computed in one go, in user space
  echo " Regular filtering (via available_filter_functions):
- Setting filters for networking funcs only..."
- # This is pretty FAST and yields good detail!
- filterfunc_idx read write net packet_ sock sk_ tcp udp skb netdev \
-   netif_ napi icmp "^ip_" "xmit$" dev_ qdisc
+ Setting filters for networking funcs only, less unwanted functions..."
+ t1=$(date +%s%N)
+ filterfunc_set "read write net packet_ sock sk_ tcp udp skb netdev
+   netif_ napi icmp ^ip_ xmit$ dev_ qdisc" "${EXCLUDE_FUNCS}"
+ t2=$(date +%s%N)
+ echo " (took $(((t2-t1)/1000000)) ms)"
 
 else # filter via the set_event interface
 
@@ -175,19 +228,10 @@ else # filter via the set_event interface
  # again, at a cost- you can't see the context in which network code is running..
  #echo 'net:* sock:* skb:* tcp:* udp:* napi:* qdisc:* neigh:*' >> set_event
 fi
-
-#--- Get rid of unrequired funcs!
-# NOTE: depending on your particular kernel ver and config, this list of funcs
-# to remove can vary.
-echo "[+] filter: remove unwanted functions          (patience, pl...)"
-filterfunc_remove "*idle*" "tick_nohz_idle_stop_tick" "rcu_*" "*__rcu_*" \
-  "*down_write*" "*up_write*" "*down_read*" "*up_read*" \
-  "*get_task_policy*" "*kthread_blkcg*" "*kthread_blkcg*" \
-  "*IPI*" "*ipi*" "*ipc*" "*xen*" "*pipe*" "*cipher*" "*chip*" "*__x32*" \
-  "*vma*" "*__ia32*" "*__x64*" "*bpf*" "*calipso*" "eaf*" "setup_object_debug*" \
-  "*alloc*" "*fail_alloc*" "*get_page*" "*prep_new*" "*numa*" "*kmem_*" "vm_*" \
-  "*copy_page*" "*memcg*" "tick_*" "handle_mm*" "task_work*"
-  #"*selinux*"
+# In both modes: don't descend into the unwanted functions either (else their
+# children - f.e. the skb* ones under *alloc* - are back in the graph)
+echo "[+] filter: remove unwanted functions (and their subtrees)"
+[ -f set_graph_notrace ] && echo "${EXCLUDE_FUNCS}" >> set_graph_notrace
 
 echo "# of functions now being traced: $(wc -l set_ftrace_filter|cut -f1 -d' ')"
 
@@ -202,38 +246,30 @@ if lsmod|grep ${KMOD} ; then
   echo ":mod:${KMOD}" >> set_ftrace_filter
 fi
 
-#--- Running the target program and tracing it --------------------------------
-echo "[+] Setting up wrapper runner process now..."
-CMD="ping -c1 packtpub.com"
-
-# Keep these vars in sync with the 'runner' script!
-TRIGGER_FILE=/tmp/runner
-CPUMASK=2
-
-${TOP}/runner ${CMD} &
-PID=$(pgrep --newest runner)
-[ -z "${PID}" ] && {
-   rm -f ${TRIGGER_FILE}
-   pkill runner
-   die "Couldn't get PID of runner wrapper process"
-}
+CPUMASK=$(cpumask_of ${TRC_CPU})
 
-# Filter by PID and CPU (1)
+# Filter by PID and CPU
 # trace only what this process (and it's children) do
 echo 0 > set_ftrace_notrace_pid
-echo function-fork >> trace_options  # trace any children as well
-[ ${FILTER_VIA_AVAIL_FUNCS} -eq 1 ] && echo ${PID} > set_ftrace_pid || \
-   echo ${PID} > set_event_pid
+[ ${FILTER_VIA_AVAIL_FUNCS} -eq 1 ] && PIDFILTER=ftrace || PIDFILTER=event
 echo ${CPUMASK} > tracing_cpumask
 
-touch ${TRIGGER_FILE} # doing this triggers the command and it runs
+#--- Buffer sizing: calibrate on a run of the command itself, with the filters
+# (function, PID and CPU) all in place; so, the command runs twice
+calibrate_bufsize 0 0 ${PERCENT2USE} \
+   ${LAUNCHER} -t $(pwd) -c ${TRC_CPU} -p ${PIDFILTER} -f -T -q -- ${CMD}
+
+#--- Running the target program and tracing it --------------------------------
 
 #pwd
-echo "[+] Tracing PID ${PID} on CPU 1 now ..."
+echo "[+] Tracing '${CMD}' on CPU ${TRC_CPU} now ..."
 #echo markers > trace_options
 echo > trace  # ensure the trace buffer is empty
-echo 1 > tracing_on
- # So, whatever happens here in the kernel gets traced; thus, it's not
+ # The launcher's child pins itself to the CPU, writes its own PID into the
+ # PID filter and execs the command; tracing_on is switched on just before
+ # the exec (-T) and off as soon as the command exits. The -f has any children
+ # traced as well.
+ # Even so, whatever happens here in the kernel gets traced; thus, it's not
  # completely exclusive to only our process of interest; other stuff can get
  # caught in the trace...
  # Using a *trace marker* (as below) is very useful! We can search for the string
@@ -245,10 +281,10 @@ echo 1 > tracing_on
  # ??
  #---
 #echo 'START' > trace_marker
-wait ${PID}
+${LAUNCHER} -t $(pwd) -c ${TRC_CPU} -p ${PIDFILTER} -f -T -- ${CMD}
 #echo 'END' > trace_marker
-echo 0 > tracing_on
-rm -f ${TRIGGER_FILE}
+# lost events? (see trc_dropmon.sh to watch for them as the trace runs)
+trace_drops
 
 # Older way: doing it this way, we seem to miss the ping itself!
 #echo 1 > tracing_on ; ping -c1 packtpub.com; echo 0 > tracing_on
@@ -257,6 +293,10 @@ mkdir -p ${REPDIR} 2>/dev/null
 cp -f trace ${FTRC_REP} || die "report generation failed"
 echo "Ftrace report:"
 ls -lh ${FTRC_REP}
+[ -n "${INSTANCE}" -a ${KEEP} -eq 0 ] && {
+  cd ${TRACEFS}
+  instance_remove ${INSTANCE}
+}
 
 #---FYI---
 # hey, think on this, it's so much simpler with trace-cmd(1):
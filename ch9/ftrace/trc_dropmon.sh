@@ -0,0 +1,230 @@
+#!/bin/bash
+# ch9/ftrace/trc_dropmon.sh
+# ***************************************************************
+# This program is part of the source code released for the book
+#  "Linux Kernel Debugging"
+#  (c) Author: Kaiwan N Billimoria
+#  Publisher:  Packt
+#  GitHub repository:
+#  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+#
+# From: Ch 9: Tracing the kernel flow
+#***************************************************************
+# Brief Description:
+# Can this trace be trusted? An ftrace session monitor: while a trace runs
+# (started by any of our scripts, trace-cmd, or by hand), sample the per-CPU
+# ring buffer counters - per_cpu/cpuN/stats - every interval and report the
+# rate at which each CPU is losing events:
+#  - overrun        : events overwritten before being read (overwrite mode),
+#  - dropped events : events discarded as the buffer was full (no-overwrite),
+#  - commit overrun : nested writers (irqs, NMIs) overflowing a page.
+# One small awk pass over the stats files per interval; the monitor itself
+# adds next to nothing to the trace.
+# Optionally (-T), throttle the trace when the loss rate crosses a threshold:
+# with the function_graph tracer, max_graph_depth is lowered a step each
+# interval the rate stays high (from 'unlimited' to 10, then down to 1).
+# Other tracers aren't throttled, just reported on; nor are instances, as
+# max_graph_depth is global (top-level tracefs only).
+# On exit (the command given has run, tracing_on went 0, or ^C) we print a
+# per-CPU summary for the session and a verdict; the exit status is 0 if
+# no events were lost, 2 if the trace is lossy.
+#
+# F.e.
+#  # in one terminal: start the trace; then, in another:
+#  sudo ./trc_dropmon.sh -i 0.5
+#  # or, monitor while running a workload (and throttle if needed):
+#  sudo ./trc_dropmon.sh -T -- ping -c5 packtpub.com
+#
+# For details, please refer the book, Ch 9.
+#------------------------------------------------------------------------------
+name=$(basename $0)
+
+die()
+{
+ echo "${name}: $@" 1>&2
+ exit 1
+}
+
+usage()
+{
+ echo "Usage: ${name} [options] [-- command ...]
+ Monitor an ftrace session for lost events, per CPU; with a command, while it
+ runs, else until tracing is turned off (or ^C).
+  -i secs   : sampling interval (default 1; fractions are ok)
+  -d dir    : the tracefs dir (or an instances/<name> dir within it)
+              (default /sys/kernel/tracing)
+  -T        : throttle: lower max_graph_depth (function_graph tracer) while
+              the loss rate is above the threshold
+  -r rate   : the throttle threshold, in lost events/s, all CPUs; an integer
+              (default 1000)
+  -q        : quiet; just the summary and verdict
+  -h        : this help"
+}
+
+INTERVAL=1
+TRCDIR=/sys/kernel/tracing
+THROTTLE=0
+THRESHOLD=1000
+QUIET=0
+
+while getopts "i:d:Tr:qh" opt; do
+  case "${opt}" in
+    i) INTERVAL=${OPTARG} ;;
+    d) TRCDIR=${OPTARG} ;;
+    T) THROTTLE=1 ;;
+    r) THRESHOLD=${OPTARG} ;;
+    q) QUIET=1 ;;
+    h) usage ; exit 0 ;;
+    *) usage ; exit 1 ;;
+  esac
+done
+shift $((OPTIND-1))
+
+[[ "${INTERVAL}" =~ ^([0-9]+\.?[0-9]*|\.[0-9]+)$ ]] && \
+  awk -v i=${INTERVAL} 'BEGIN { exit !(i > 0) }' || die "-i ${INTERVAL}: need a number of seconds > 0"
+[[ "${THRESHOLD}" =~ ^[0-9]+$ ]] || die "-r ${THRESHOLD}: need an integer (lost events/s)"
+
+[ $(id -u) -ne 0 ] && die "needs root."
+cd ${TRCDIR} 2>/dev/null || die "can't cd to ${TRCDIR}"
+ls per_cpu/cpu*/stats >/dev/null 2>&1 || die "${TRCDIR}: no per_cpu/cpuN/stats; not a tracefs dir?"
+
+TMP=$(mktemp -d /tmp/${name}.XXXXXX) || die "mktemp failed"
+
+# sample(): one line per CPU: cpu entries overrun commit-overrun dropped
+sample()
+{
+awk '
+/^entries:/        { cpu = FILENAME; sub(/.*cpu/, "", cpu); sub(/\/.*/, "", cpu)
+                     ent[cpu] = $2 }
+/^overrun:/        { ovr[cpu] = $2 }
+/^commit overrun:/ { cov[cpu] = $3 }
+/^dropped events:/ { drp[cpu] = $3 }
+END {
+	for (c in ent)
+		printf "%s %d %d %d %d\n", c, ent[c], ovr[c], cov[c], drp[c]
+}' per_cpu/cpu*/stats | sort -n
+}
+
+# compare(): from two samples (prev, cur), the rates over the interval secs:
+# a line per CPU that lost events, then a total line:
+#  TOTAL <events/s> <lost/s>
+compare()
+{
+awk -v SECS=$3 -v QUIET=${QUIET} -v STAMP="$(date +%H:%M:%S)" '
+FILENAME == ARGV[1] {
+	p_ent[$1] = $2; p_lost[$1] = $3 + $4 + $5
+	p_ovr[$1] = $3; p_cov[$1] = $4; p_drp[$1] = $5
+	next
+}
+{
+	lost = ($3 + $4 + $5) - p_lost[$1]
+	# entries can go down as the buffer is consumed (trace_pipe); the
+	# events written are what is in it now plus what was lost and read
+	ev = $2 - p_ent[$1] + lost
+	if (ev < 0)
+		ev = 0
+	tev += ev; tlost += lost
+	if (lost > 0 && !QUIET)
+		printf "%s   cpu%-3s lost %9.0f/s (ovr %d cov %d drp %d) of %9.0f events/s\n",
+			STAMP, $1, lost / SECS, $3 - p_ovr[$1], $4 - p_cov[$1],
+			$5 - p_drp[$1], ev / SECS
+}
+END {
+	printf "TOTAL %.0f %.0f\n", tev / SECS, tlost / SECS
+}' $1 $2
+}
+
+# throttle(): lower the function_graph depth a step; ret 1 if we can't
+THROTTLE_NOTED=0
+throttle()
+{
+local depth
+
+[ "$(cat current_tracer)" != "function_graph" ] && return 1
+if [ ! -f max_graph_depth ] ; then
+  [ ${THROTTLE_NOTED} -eq 0 ] && \
+    echo "${name}: note: no max_graph_depth here (an instance?); can't throttle, just reporting"
+  THROTTLE_NOTED=1
+  return 1
+fi
+depth=$(cat max_graph_depth)
+if [ ${depth} -eq 0 ] ; then
+  depth=10
+elif [ ${depth} -gt 1 ] ; then
+  depth=$((depth-1))
+else
+  return 1
+fi
+echo ${depth} > max_graph_depth || return 1
+echo "$(date +%H:%M:%S) [throttle] max_graph_depth -> ${depth}"
+}
+
+CMDPID=""
+finish()
+{
+  trap - INT TERM
+  [ -n "${CMDPID}" ] && kill ${CMDPID} 2>/dev/null
+  sample > ${TMP}/end
+  echo
+  echo "${name}: session summary ($(cat current_tracer) tracer; ${NSAMP} samples)"
+  awk -v THROTTLED=${NTHROTTLE} '
+  FILENAME == ARGV[1] { s_lost[$1] = $3 + $4 + $5; next }
+  {
+	lost = ($3 + $4 + $5) - s_lost[$1]
+	if (lost <= 0)
+		next
+	if (!n++)
+		printf "%6s %12s %12s\n", "cpu", "lost", "in-buffer"
+	printf "%6s %12d %12d\n", "cpu" $1, lost, $2
+	tlost += lost
+  }
+  END {
+	if (THROTTLED)
+		printf "NOTE: throttled %d time(s): max_graph_depth changed mid-trace\n", THROTTLED
+	if (n) {
+		printf "*** the trace is LOSSY: %d events lost on %d CPU(s); do not treat it as complete ***\n", tlost, n
+		exit 2
+	}
+	print "[+] no events lost during the session: the trace can be trusted"
+  }' ${TMP}/start ${TMP}/end
+  ret=$?
+  rm -rf ${TMP}
+  exit ${ret}
+}
+trap finish INT TERM
+
+sample > ${TMP}/start
+cp ${TMP}/start ${TMP}/prev
+NSAMP=0
+NTHROTTLE=0
+
+if [ $# -ge 1 ] ; then
+  "$@" &
+  CMDPID=$!
+  [ ${QUIET} -eq 0 ] && echo "[+] monitoring ${TRCDIR}, every ${INTERVAL}s, while '$*' (PID ${CMDPID}) runs"
+else
+  [ "$(cat tracing_on)" = "0" ] && echo "${name}: note: tracing is off (now)"
+  [ ${QUIET} -eq 0 ] && echo "[+] monitoring ${TRCDIR}, every ${INTERVAL}s; ^C to stop"
+fi
+
+while true ; do
+  sleep ${INTERVAL}
+  sample > ${TMP}/cur
+  NSAMP=$((NSAMP+1))
+  compare ${TMP}/prev ${TMP}/cur ${INTERVAL} > ${TMP}/rates
+  mv ${TMP}/cur ${TMP}/prev
+  grep -v "^TOTAL" ${TMP}/rates
+  read x evrate lostrate < <(grep "^TOTAL" ${TMP}/rates)
+  [ ${QUIET} -eq 0 ] && [ ${lostrate} -gt 0 ] && \
+    echo "$(date +%H:%M:%S) total: lost ${lostrate}/s of ${evrate} events/s"
+  if [ ${THROTTLE} -eq 1 -a ${lostrate} -gt ${THRESHOLD} ] ; then
+    throttle && NTHROTTLE=$((NTHROTTLE+1))
+  fi
+
+  if [ -n "${CMDPID}" ] ; then
+    kill -0 ${CMDPID} 2>/dev/null || { CMDPID="" ; break ; }
+  elif [ "$(cat tracing_on)" = "0" ] ; then
+    break
+  fi
+done
+finish
@@ -0,0 +1,322 @@
+/*
+ * ch9/ftrace/trc_launch.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Debugging"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+ *
+ * From: Ch 9: Tracing the kernel flow
+ ****************************************************************
+ * Brief Description:
+ * Launch a command under ftrace, traced from its very first instruction.
+ * To filter a trace by PID we need the PID *before* the process runs; our
+ * earlier 'runner' wrapper script got there by polling for a trigger file
+ * (up to 500 ms late) and had its parent guess its PID (pgrep --newest; racy).
+ * Here instead:
+ *  - we fork; the child pins itself to the given CPU(s) (-c) and writes its
+ *    own PID into set_ftrace_pid and/or set_event_pid (-p);
+ *  - it then tells the parent it's ready, over a pipe, and blocks on a
+ *    second pipe;
+ *  - the parent (optionally, -T) switches tracing_on on, and releases it;
+ *  - the child execve()'s the command: same PID, so it's already filtered
+ *    for; tracing is live microseconds before its first instruction.
+ * The ready pipe is close-on-exec: EOF on it tells the parent the exec
+ * succeeded; on failure the child sends its errno instead. No polling, no
+ * sleeps, no PID guessing.
+ * With -f, function-fork and event-fork are set too, so that the command's
+ * children are traced as well.
+ * We wait for the command; with -T, tracing_on is switched off as soon as
+ * it exits. Our exit status is that of the command (128+sig if killed).
+ *
+ * Setup the tracer, filters, etc as usual first (f.e. see ping_ftrace.sh).
+ *
+ * Build:
+ *  gcc -O2 -Wall trc_launch.c -o trc_launch
+ * Usage (as root):
+ *  ./trc_launch [-t tracefs-dir] [-c cpu-list] [-p ftrace|event|both|none]
+ *               [-f] [-T] [-q] -- command [args ...]
+ *
+ * For details, please refer the book, Ch 9.
+ * License: Dual MIT/GPL
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define PIDF_FTRACE	0x1
+#define PIDF_EVENT	0x2
+
+/* What the child reports, over the ready pipe */
+enum {
+	ST_READY = 0,
+	ST_AFFINITY,
+	ST_PIDFILTER,
+	ST_EXEC,
+};
+struct status {
+	int stage;
+	int err;
+};
+
+static const char *stage_str[] = {
+	[ST_READY] = "ready",
+	[ST_AFFINITY] = "setting CPU affinity",
+	[ST_PIDFILTER] = "writing the PID filter",
+	[ST_EXEC] = "exec",
+};
+
+static const char *tracefs;
+static int quiet;
+
+static void usage(const char *prg)
+{
+	fprintf(stderr,
+		"Usage: %s [options] -- command [args ...]\n"
+		" Run command, ftrace PID-filtered on it from its first instruction.\n"
+		"  -t dir   : tracefs dir, or an instances/<name> dir within it\n"
+		"             (default: /sys/kernel/tracing, else /sys/kernel/debug/tracing)\n"
+		"  -c cpus  : run the command on these CPU(s); f.e. 1 or 0-3,6\n"
+		"  -p which : PID filter to set: ftrace (set_ftrace_pid), event\n"
+		"             (set_event_pid), both (default) or none\n"
+		"  -f       : trace the command's children too (function-fork, event-fork)\n"
+		"  -T       : switch tracing_on on just before the exec, off once it exits\n"
+		"  -q       : quiet\n",
+		prg);
+}
+
+static int write_file(const char *path, const char *val)
+{
+	int fd = open(path, O_WRONLY | O_TRUNC);
+	ssize_t n;
+
+	if (fd < 0)
+		return -1;
+	n = write(fd, val, strlen(val));
+	close(fd);
+	return n < 0 ? -1 : 0;
+}
+
+static int write_tracefs(const char *file, const char *val)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", tracefs, file);
+	return write_file(path, val);
+}
+
+/* Parse a CPU list - "1", "0-3,6" - into @set; returns -1 if malformed */
+static int parse_cpus(const char *s, cpu_set_t *set)
+{
+	char *end;
+	long a, b;
+
+	CPU_ZERO(set);
+	while (*s) {
+		a = strtol(s, &end, 10);
+		if (end == s || a < 0)
+			return -1;
+		b = a;
+		if (*end == '-') {
+			s = end + 1;
+			b = strtol(s, &end, 10);
+			if (end == s || b < a)
+				return -1;
+		}
+		for (; a <= b && a < CPU_SETSIZE; a++)
+			CPU_SET(a, set);
+		if (*end == ',')
+			end++;
+		else if (*end)
+			return -1;
+		s = end;
+	}
+	return CPU_COUNT(set) ? 0 : -1;
+}
+
+static void report(int fd, int stage, int err)
+{
+	struct status st = { .stage = stage, .err = err };
+
+	if (write(fd, &st, sizeof(st)) != sizeof(st))
+		_exit(127);
+}
+
+/*
+ * The child: set itself up for tracing, sync with the parent, exec.
+ * Never returns.
+ */
+static void child(char **argv, cpu_set_t *cpus, int pidf, int ready_wr, int go_rd)
+{
+	char pid[16];
+	char c;
+
+	if (cpus && sched_setaffinity(0, sizeof(*cpus), cpus) < 0) {
+		report(ready_wr, ST_AFFINITY, errno);
+		_exit(127);
+	}
+	snprintf(pid, sizeof(pid), "%d", getpid());
+	if (((pidf & PIDF_FTRACE) && write_tracefs("set_ftrace_pid", pid) < 0) ||
+	    ((pidf & PIDF_EVENT) && write_tracefs("set_event_pid", pid) < 0)) {
+		report(ready_wr, ST_PIDFILTER, errno);
+		_exit(127);
+	}
+	report(ready_wr, ST_READY, 0);
+
+	/* wait for the go; EOF means the parent bailed out */
+	if (read(go_rd, &c, 1) != 1)
+		_exit(127);
+	close(go_rd);
+	execvp(argv[0], argv);
+	report(ready_wr, ST_EXEC, errno);
+	_exit(127);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, pidf = PIDF_FTRACE | PIDF_EVENT, follow = 0, toggle = 0;
+	int ready[2], go[2], wstatus, ret;
+	cpu_set_t cpuset, *cpus = NULL;
+	struct timespec t0, t1;
+	struct status st;
+	ssize_t n;
+	pid_t pid;
+
+	while ((opt = getopt(argc, argv, "+t:c:p:fTqh")) != -1) {
+		switch (opt) {
+		case 't':
+			tracefs = optarg;
+			break;
+		case 'c':
+			if (parse_cpus(optarg, &cpuset) < 0) {
+				fprintf(stderr, "%s: bad CPU list '%s'\n", argv[0], optarg);
+				exit(EXIT_FAILURE);
+			}
+			cpus = &cpuset;
+			break;
+		case 'p':
+			if (!strcmp(optarg, "ftrace"))
+				pidf = PIDF_FTRACE;
+			else if (!strcmp(optarg, "event"))
+				pidf = PIDF_EVENT;
+			else if (!strcmp(optarg, "both"))
+				pidf = PIDF_FTRACE | PIDF_EVENT;
+			else if (!strcmp(optarg, "none"))
+				pidf = 0;
+			else {
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'f':
+			follow = 1;
+			break;
+		case 'T':
+			toggle = 1;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (!tracefs)
+		tracefs = access("/sys/kernel/tracing/trace", F_OK) == 0 ?
+			"/sys/kernel/tracing" : "/sys/kernel/debug/tracing";
+	if (access(tracefs, W_OK) < 0) {
+		fprintf(stderr, "%s: can't access %s (not root? tracefs not mounted?)\n",
+			argv[0], tracefs);
+		exit(EXIT_FAILURE);
+	}
+
+	if (follow) {
+		if ((pidf & PIDF_FTRACE) && write_tracefs("options/function-fork", "1") < 0)
+			fprintf(stderr, "%s: warning: couldn't set function-fork\n", argv[0]);
+		if ((pidf & PIDF_EVENT) && write_tracefs("options/event-fork", "1") < 0)
+			fprintf(stderr, "%s: warning: couldn't set event-fork\n", argv[0]);
+	}
+
+	if (pipe2(ready, O_CLOEXEC) < 0 || pipe2(go, O_CLOEXEC) < 0) {
+		perror("pipe2");
+		exit(EXIT_FAILURE);
+	}
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (pid == 0) {
+		close(ready[0]);
+		close(go[1]);
+		child(&argv[optind], cpus, pidf, ready[1], go[0]);
+	}
+	close(ready[1]);
+	close(go[0]);
+
+	/* ^C and the like are for the command; we just switch tracing off after */
+	signal(SIGINT, SIG_IGN);
+	signal(SIGQUIT, SIG_IGN);
+
+	n = read(ready[0], &st, sizeof(st));
+	if (n != sizeof(st) || st.stage != ST_READY) {
+		if (n == sizeof(st))
+			fprintf(stderr, "%s: child: %s failed: %s\n", argv[0],
+				stage_str[st.stage], strerror(st.err));
+		else
+			fprintf(stderr, "%s: child died before it was ready\n", argv[0]);
+		close(go[1]);
+		waitpid(pid, NULL, 0);
+		exit(EXIT_FAILURE);
+	}
+
+	if (toggle && write_tracefs("tracing_on", "1") < 0)
+		fprintf(stderr, "%s: couldn't switch tracing on\n", argv[0]);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (write(go[1], "g", 1) != 1) {
+		perror("write go");
+		kill(pid, SIGKILL);
+	}
+	close(go[1]);
+
+	/* EOF: the exec succeeded (close-on-exec); else, it's the errno */
+	n = read(ready[0], &st, sizeof(st));
+	close(ready[0]);
+	if (n == sizeof(st))
+		fprintf(stderr, "%s: %s %s failed: %s\n", argv[0], stage_str[st.stage],
+			argv[optind], strerror(st.err));
+	else if (!quiet)
+		fprintf(stderr, "%s: PID %d: %s: traced\n", argv[0], pid, argv[optind]);
+
+	while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR)
+		;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (toggle)
+		write_tracefs("tracing_on", "0");
+
+	if (WIFEXITED(wstatus))
+		ret = WEXITSTATUS(wstatus);
+	else
+		ret = 128 + WTERMSIG(wstatus);
+	if (!quiet)
+		fprintf(stderr, "%s: PID %d exited (status %d) after %.6f s\n", argv[0], pid, ret,
+			(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+	exit(ret);
+}
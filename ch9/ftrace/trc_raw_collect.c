@@ -0,0 +1,532 @@
+/*
+ * ch9/ftrace/trc_raw_collect.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Debugging"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+ *
+ * From: Ch 9: Tracing the kernel flow
+ ****************************************************************
+ * Brief Description:
+ * A streaming, binary ftrace collector. Our ftrace scripts (ftrc_1s.sh,
+ * ping_ftrace.sh) stop tracing and then 'cp trace <report>': the kernel has to
+ * format every event as text (slow), and whatever didn't fit in the ring
+ * buffer is gone. Here instead we drain the ring buffer *while* tracing:
+ *  - one reader thread per CPU, on per_cpu/cpuN/trace_pipe_raw;
+ *  - the raw ring buffer pages are splice(2)'d - via a pipe - straight into
+ *    <outdir>/cpuN.raw; no copy through user space, no formatting;
+ *  - the reader sleeps in poll(2) until the kernel has full pages for it;
+ *    on stop, the remaining (partial) pages are read(2) out.
+ * Decoding is done offline (see trc_raw_decode.c); for that, we also snapshot
+ * the metadata it needs into <outdir>: events/header_page, every
+ * events/<subsys>/<event>/format, printk_formats, saved_cmdlines, trace_clock,
+ * and an 'info' file (# of CPUs, sub-buffer size, bytes per CPU, ...). The
+ * per-CPU 'stats' (overruns, dropped events) are saved as cpuN.stats - if
+ * they aren't zero, the readers didn't keep up (enlarge buffer_size_kb).
+ *
+ * Setup the tracer, filters, etc as usual (f.e. via our ftrace scripts); by
+ * default we don't touch tracing_on (pass -T to have us switch it on and,
+ * at the end, off).
+ *
+ * Build:
+ *  gcc -O2 -Wall -pthread trc_raw_collect.c -o trc_raw_collect
+ * Usage (as root):
+ *  ./trc_raw_collect [-t tracefs-dir] [-o outdir] [-d seconds] [-p] [-T]
+ * Stops after -d seconds or on ^C / SIGTERM.
+ *
+ * For details, please refer the book, Ch 9.
+ * License: Dual MIT/GPL
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sched.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/utsname.h>
+
+#define MAX_CPUS	1024
+#define POLL_MS		100
+
+struct reader {
+	pthread_t thread;
+	int cpu;
+	int in_fd;		/* per_cpu/cpuN/trace_pipe_raw */
+	int out_fd;		/* <outdir>/cpuN.raw */
+	int pipefd[2];
+	unsigned long long bytes;
+	unsigned long long pages;
+	int err;		/* errno of a fatal error, if any */
+};
+
+static const char *tracefs;
+static const char *outdir = "trc_raw";
+static long subbuf_sz;
+static volatile sig_atomic_t stop;
+static struct reader readers[MAX_CPUS];
+static int nr_readers;
+
+static void sig_stop(int sig)
+{
+	stop = 1;
+}
+
+static void usage(const char *prg)
+{
+	fprintf(stderr,
+		"Usage: %s [-t tracefs-dir] [-o outdir] [-d seconds] [-p] [-T]\n"
+		" Stream the raw ftrace ring buffer of every CPU into <outdir> (default: %s)\n"
+		"  -t : tracefs mount point (default: /sys/kernel/tracing, else /sys/kernel/debug/tracing)\n"
+		"  -d : stop after this many seconds (default: run until ^C / SIGTERM)\n"
+		"  -p : pin each reader thread to the CPU it drains\n"
+		"  -T : switch tracing_on on at start, and off at the end\n",
+		prg, outdir);
+}
+
+static int write_file(const char *path, const char *val)
+{
+	int fd = open(path, O_WRONLY | O_TRUNC);
+	ssize_t n;
+
+	if (fd < 0)
+		return -1;
+	n = write(fd, val, strlen(val));
+	close(fd);
+	return n < 0 ? -1 : 0;
+}
+
+/* Read a (small) file into @buf, NUL-terminated; returns the length or -1 */
+static ssize_t read_file(const char *path, char *buf, size_t len)
+{
+	int fd = open(path, O_RDONLY);
+	ssize_t n;
+
+	if (fd < 0)
+		return -1;
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+	buf[n] = '\0';
+	return n;
+}
+
+/*
+ * Copy @src to @dst. Tracefs files report a size of 0, so we can't stat()
+ * them; just read till EOF.
+ */
+static int copy_file(const char *src, const char *dst)
+{
+	char buf[8192];
+	int in, out, ret = 0;
+	ssize_t n;
+
+	in = open(src, O_RDONLY);
+	if (in < 0)
+		return -1;
+	out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0) {
+		close(in);
+		return -1;
+	}
+	while ((n = read(in, buf, sizeof(buf))) > 0) {
+		if (write(out, buf, n) != n) {
+			ret = -1;
+			break;
+		}
+	}
+	if (n < 0)
+		ret = -1;
+	close(in);
+	close(out);
+	return ret;
+}
+
+static int mkdir_p(const char *path)
+{
+	char tmp[PATH_MAX], *p;
+
+	snprintf(tmp, sizeof(tmp), "%s", path);
+	for (p = tmp + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(tmp, 0755) < 0 && errno != EEXIST)
+			return -1;
+		*p = '/';
+	}
+	if (mkdir(tmp, 0755) < 0 && errno != EEXIST)
+		return -1;
+	return 0;
+}
+
+/* Snapshot events/header_page, events/header_event and every events/<sys>/<ev>/format */
+static int snapshot_formats(void)
+{
+	char src[PATH_MAX], dst[PATH_MAX];
+	struct dirent *sd, *ed;
+	DIR *sysdir, *evdir;
+	int nr = 0;
+
+	snprintf(dst, sizeof(dst), "%s/events", outdir);
+	if (mkdir_p(dst) < 0)
+		return -1;
+	snprintf(src, sizeof(src), "%s/events/header_page", tracefs);
+	snprintf(dst, sizeof(dst), "%s/events/header_page", outdir);
+	copy_file(src, dst);
+	snprintf(src, sizeof(src), "%s/events/header_event", tracefs);
+	snprintf(dst, sizeof(dst), "%s/events/header_event", outdir);
+	copy_file(src, dst);
+
+	snprintf(src, sizeof(src), "%s/events", tracefs);
+	sysdir = opendir(src);
+	if (!sysdir)
+		return -1;
+	while ((sd = readdir(sysdir))) {
+		if (sd->d_name[0] == '.' || sd->d_type != DT_DIR)
+			continue;
+		snprintf(src, sizeof(src), "%s/events/%s", tracefs, sd->d_name);
+		evdir = opendir(src);
+		if (!evdir)
+			continue;
+		while ((ed = readdir(evdir))) {
+			if (ed->d_name[0] == '.' || ed->d_type != DT_DIR)
+				continue;
+			snprintf(dst, sizeof(dst), "%s/events/%s/%s", outdir, sd->d_name, ed->d_name);
+			if (mkdir_p(dst) < 0)
+				continue;
+			snprintf(src, sizeof(src), "%s/events/%s/%s/format",
+				 tracefs, sd->d_name, ed->d_name);
+			snprintf(dst, sizeof(dst), "%s/events/%s/%s/format",
+				 outdir, sd->d_name, ed->d_name);
+			if (copy_file(src, dst) == 0)
+				nr++;
+		}
+		closedir(evdir);
+	}
+	closedir(sysdir);
+	return nr;
+}
+
+static void snapshot_misc(void)
+{
+	static const char * const files[] = {
+		"printk_formats", "saved_cmdlines", "saved_tgids", "trace_clock",
+		"current_tracer", "buffer_size_kb",
+	};
+	char src[PATH_MAX], dst[PATH_MAX];
+	size_t i;
+
+	for (i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+		snprintf(src, sizeof(src), "%s/%s", tracefs, files[i]);
+		snprintf(dst, sizeof(dst), "%s/%s", outdir, files[i]);
+		copy_file(src, dst);
+	}
+}
+
+/* Write everything that's in the pipe out to the file */
+static int pipe_to_file(struct reader *r, ssize_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = splice(r->pipefd[0], NULL, r->out_fd, NULL, len, SPLICE_F_MOVE);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)
+			break;
+		len -= n;
+	}
+	return 0;
+}
+
+/* The final drain: read(2) returns partially filled pages as well */
+static void drain_partial(struct reader *r)
+{
+	char *buf = malloc(subbuf_sz);
+	ssize_t n;
+
+	if (!buf)
+		return;
+	while ((n = read(r->in_fd, buf, subbuf_sz)) > 0) {
+		if (write(r->out_fd, buf, n) != n) {
+			r->err = errno;
+			break;
+		}
+		r->bytes += n;
+		r->pages++;
+	}
+	free(buf);
+}
+
+static void *reader_thread(void *arg)
+{
+	struct reader *r = arg;
+	struct pollfd pfd = { .fd = r->in_fd, .events = POLLIN };
+	ssize_t n;
+
+	while (!stop) {
+		n = splice(r->in_fd, NULL, r->pipefd[1], NULL, subbuf_sz,
+			   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n > 0) {
+			if (pipe_to_file(r, n) < 0) {
+				r->err = errno;
+				break;
+			}
+			r->bytes += n;
+			r->pages++;
+			continue;
+		}
+		if (n < 0 && errno != EAGAIN && errno != EINTR) {
+			r->err = errno;
+			break;
+		}
+		/* No full page yet; sleep till there is one (or it's time to check 'stop') */
+		poll(&pfd, 1, POLL_MS);
+	}
+	if (!r->err)
+		drain_partial(r);
+	return NULL;
+}
+
+static int open_reader(struct reader *r, int cpu)
+{
+	char path[PATH_MAX];
+
+	r->cpu = cpu;
+	snprintf(path, sizeof(path), "%s/per_cpu/cpu%d/trace_pipe_raw", tracefs, cpu);
+	r->in_fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (r->in_fd < 0) {
+		fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	snprintf(path, sizeof(path), "%s/cpu%d.raw", outdir, cpu);
+	r->out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (r->out_fd < 0) {
+		fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+		close(r->in_fd);
+		return -1;
+	}
+	if (pipe(r->pipefd) < 0) {
+		perror("pipe");
+		close(r->in_fd);
+		close(r->out_fd);
+		return -1;
+	}
+	/* room for a few sub-buffers in flight */
+	fcntl(r->pipefd[1], F_SETPIPE_SZ, 4 * subbuf_sz);
+	return 0;
+}
+
+static void write_info(const struct timespec *t0, const struct timespec *t1)
+{
+	char path[PATH_MAX], clk[256] = "";
+	struct utsname uts;
+	FILE *fp;
+	int i;
+
+	snprintf(path, sizeof(path), "%s/info", outdir);
+	fp = fopen(path, "w");
+	if (!fp) {
+		perror("fopen info");
+		return;
+	}
+	uname(&uts);
+	snprintf(path, sizeof(path), "%s/trace_clock", tracefs);
+	read_file(path, clk, sizeof(clk));
+	clk[strcspn(clk, "\n")] = '\0';
+
+	fprintf(fp, "release %s\n", uts.release);
+	fprintf(fp, "machine %s\n", uts.machine);
+	fprintf(fp, "page_size %ld\n", sysconf(_SC_PAGESIZE));
+	fprintf(fp, "subbuf_size %ld\n", subbuf_sz);
+	fprintf(fp, "long_size %zu\n", sizeof(long));
+	fprintf(fp, "trace_clock %s\n", clk);
+	fprintf(fp, "start %ld.%09ld\n", (long)t0->tv_sec, t0->tv_nsec);
+	fprintf(fp, "end %ld.%09ld\n", (long)t1->tv_sec, t1->tv_nsec);
+	fprintf(fp, "nr_cpus %d\n", nr_readers);
+	for (i = 0; i < nr_readers; i++)
+		fprintf(fp, "cpu %d bytes %llu pages %llu\n",
+			readers[i].cpu, readers[i].bytes, readers[i].pages);
+	fclose(fp);
+}
+
+/* Save per_cpu/cpuN/stats and return its 'overrun' + 'dropped events' */
+static unsigned long long save_stats(int cpu)
+{
+	char src[PATH_MAX], dst[PATH_MAX], buf[2048], *p;
+	unsigned long long lost = 0;
+
+	snprintf(src, sizeof(src), "%s/per_cpu/cpu%d/stats", tracefs, cpu);
+	snprintf(dst, sizeof(dst), "%s/cpu%d.stats", outdir, cpu);
+	copy_file(src, dst);
+	if (read_file(src, buf, sizeof(buf)) < 0)
+		return 0;
+	p = strstr(buf, "overrun:");
+	if (p)
+		lost += strtoull(p + strlen("overrun:"), NULL, 10);
+	p = strstr(buf, "dropped events:");
+	if (p)
+		lost += strtoull(p + strlen("dropped events:"), NULL, 10);
+	return lost;
+}
+
+int main(int argc, char **argv)
+{
+	struct timespec t0, t1;
+	char path[PATH_MAX], buf[64];
+	unsigned long long total = 0, lost;
+	int opt, duration = 0, pin = 0, toggle = 0, cpu, nr_fmt, i;
+	struct sigaction sa;
+	sigset_t sigs, oldmask;
+	double secs;
+
+	while ((opt = getopt(argc, argv, "t:o:d:pTh")) != -1) {
+		switch (opt) {
+		case 't':
+			tracefs = optarg;
+			break;
+		case 'o':
+			outdir = optarg;
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'p':
+			pin = 1;
+			break;
+		case 'T':
+			toggle = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+	if (!tracefs)
+		tracefs = access("/sys/kernel/tracing/trace", F_OK) == 0 ?
+			"/sys/kernel/tracing" : "/sys/kernel/debug/tracing";
+	snprintf(path, sizeof(path), "%s/per_cpu", tracefs);
+	if (access(path, R_OK) < 0) {
+		fprintf(stderr, "%s: can't access %s (not root? tracefs not mounted?)\n",
+			argv[0], path);
+		exit(EXIT_FAILURE);
+	}
+
+	/* 6.8 on: the ring buffer sub-buffer size is tunable; else it's a page */
+	subbuf_sz = sysconf(_SC_PAGESIZE);
+	snprintf(path, sizeof(path), "%s/buffer_subbuf_size_kb", tracefs);
+	if (read_file(path, buf, sizeof(buf)) > 0 && atol(buf) > 0)
+		subbuf_sz = atol(buf) * 1024;
+
+	if (mkdir_p(outdir) < 0) {
+		fprintf(stderr, "%s: mkdir %s: %s\n", argv[0], outdir, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	nr_fmt = snapshot_formats();
+	if (nr_fmt < 0) {
+		fprintf(stderr, "%s: couldn't snapshot the event formats\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	/* per_cpu/ has a cpuN dir for every possible CPU */
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		snprintf(path, sizeof(path), "%s/per_cpu/cpu%d", tracefs, cpu);
+		if (access(path, F_OK) < 0)
+			break;
+		if (open_reader(&readers[nr_readers], cpu) < 0)
+			exit(EXIT_FAILURE);
+		nr_readers++;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sig_stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGALRM, &sa, NULL);
+
+	printf("%s: %d CPUs, %ld byte sub-buffers, %d event formats saved; output in %s/\n",
+	       argv[0], nr_readers, subbuf_sz, nr_fmt, outdir);
+	/*
+	 * Only the main thread takes the signals; the readers (created with them
+	 * blocked) poll 'stop'. We keep them blocked here too, except within
+	 * sigsuspend(): a signal arriving between the test of 'stop' and the
+	 * wait stays pending, instead of being missed as with pause().
+	 */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	sigaddset(&sigs, SIGALRM);
+	pthread_sigmask(SIG_BLOCK, &sigs, &oldmask);
+	sigdelset(&oldmask, SIGINT);	/* in case we inherited them blocked */
+	sigdelset(&oldmask, SIGTERM);
+	sigdelset(&oldmask, SIGALRM);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < nr_readers; i++) {
+		if (pthread_create(&readers[i].thread, NULL, reader_thread, &readers[i])) {
+			fprintf(stderr, "%s: pthread_create failed\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		if (pin) {
+			cpu_set_t set;
+
+			CPU_ZERO(&set);
+			CPU_SET(readers[i].cpu, &set);
+			/* fails for offline CPUs; that's ok, it's just a hint */
+			pthread_setaffinity_np(readers[i].thread, sizeof(set), &set);
+		}
+	}
+	snprintf(path, sizeof(path), "%s/tracing_on", tracefs);
+	if (toggle && write_file(path, "1") < 0)
+		fprintf(stderr, "%s: couldn't switch tracing on\n", argv[0]);
+	if (duration > 0)
+		alarm(duration);
+	printf("collecting ... (^C to stop)\n");
+
+	while (!stop)
+		sigsuspend(&oldmask);
+
+	if (toggle)
+		write_file(path, "0");
+	for (i = 0; i < nr_readers; i++)
+		pthread_join(readers[i].thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	snapshot_misc();	/* now, so that saved_cmdlines is current */
+	write_info(&t0, &t1);
+
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("\n%5s %12s %9s %14s\n", "cpu", "bytes", "pages", "overrun+drop");
+	for (i = 0; i < nr_readers; i++) {
+		struct reader *r = &readers[i];
+
+		lost = save_stats(r->cpu);
+		printf("%5d %12llu %9llu %14llu%s%s\n", r->cpu, r->bytes, r->pages, lost,
+		       r->err ? "  error: " : "", r->err ? strerror(r->err) : "");
+		total += r->bytes;
+		close(r->in_fd);
+		close(r->out_fd);
+		close(r->pipefd[0]);
+		close(r->pipefd[1]);
+	}
+	printf("total: %llu bytes in %.2f s (%.2f MB/s)\n",
+	       total, secs, secs > 0 ? total / secs / (1024 * 1024) : 0.0);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,821 @@
+/*
+ * ch9/ftrace/trc_raw_decode.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Debugging"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+ *
+ * From: Ch 9: Tracing the kernel flow
+ ****************************************************************
+ * Brief Description:
+ * The offline decoder for the raw ring buffer pages trc_raw_collect saves.
+ * Instead of (yet another) text report - that, like ping_ftrace_report.txt,
+ * takes ages to grep - we write a columnar store: every column is a plain
+ * binary file of fixed-width, native-endian values (strings: one per line),
+ * so it can be mmap()'ed / numpy.fromfile()'d / awk'ed on its own, and a
+ * query reads only the columns it needs.
+ *
+ * How:
+ *  - the event format files (events/<sys>/<event>/format) and
+ *    events/header_page are parsed once, into a decode table indexed by
+ *    event ID;
+ *  - the per-CPU raw files are decoded in parallel, one thread per file
+ *    (up to -j threads); each CPU is its own partition, so the threads
+ *    share nothing but the (read-only) decode table.
+ *
+ * The output, under <outdir> (default <indir>/cols):
+ *  schema                         : every event type seen; its ID, # of rows
+ *                                   and its columns (name and type)
+ *  cpuN/common/{ts.u64, pid.i32, id.u16, flags.u8, preempt.u8}
+ *                                 : one row per event, in time order
+ *  cpuN/<sys>.<event>/row.u64     : the event's row # in cpuN/common/
+ *  cpuN/<sys>.<event>/<field>.<t> : the event's own fields, one file each;
+ *    <t> is u8..u64 / i8..i64 (integers), str (char arrays and __data_loc
+ *    strings; a line per row, '\' and newlines escaped), or bN (any other
+ *    N-byte array, raw)
+ * Timestamps are raw ring buffer time (trace_clock units; ns for the
+ * default 'local' clock).
+ * Each thread keeps 1 + <# of fields> files open per event type seen, so we
+ * raise the open files limit (RLIMIT_NOFILE) to its max first. If a column
+ * still can't be created, that CPU's decode stops right there, with the
+ * error in the summary (and a non-zero exit): a column that's silently
+ * missing data is worse than none.
+ * F.e., in Python:
+ *  ts = numpy.fromfile('cols/cpu1/common/ts.u64', dtype=numpy.uint64)
+ *
+ * Build:
+ *  gcc -O2 -Wall -pthread trc_raw_decode.c -o trc_raw_decode
+ * Usage:
+ *  ./trc_raw_decode [-o outdir] [-j threads] <indir>
+ * (<indir> being a trc_raw_collect output directory.)
+ *
+ * For details, please refer the book, Ch 9.
+ * License: Dual MIT/GPL
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define MAX_CPUS	1024
+#define MAX_EVENT_ID	65536
+#define MAX_FIELDS	64
+#define NAME_LEN	64
+#define COL_BUFSZ	(64 * 1024)
+
+/* The ring buffer's event header type_len special values */
+#define RB_TYPE_PADDING		29
+#define RB_TYPE_TIME_EXTEND	30
+#define RB_TYPE_TIME_STAMP	31
+#define RB_TS_SHIFT		27
+#define RB_TS_MSB_MASK		(~((1ULL << 59) - 1))
+/* The page header 'commit' word: data length, and 'missed events' flags */
+#define RB_COMMIT_MASK		((1UL << 27) - 1)
+#define RB_MISSED_EVENTS	(1UL << 31)
+#define RB_MISSED_STORED	(1UL << 30)
+
+enum ftype {
+	FT_INT,		/* 1, 2, 4, 8 byte integers */
+	FT_STR,		/* char foo[N] */
+	FT_DATA_LOC,	/* __data_loc char[] foo : u32, offset | len << 16 */
+	FT_REL_LOC,	/* __rel_loc: as above, offset relative to the field's end */
+	FT_BYTES,	/* any other array */
+};
+
+struct field {
+	char name[NAME_LEN];
+	enum ftype type;
+	int offset;
+	int size;
+	int is_signed;
+	char ext[16];	/* the column file's extension */
+};
+
+struct event {
+	int id;
+	char sys[NAME_LEN];
+	char name[NAME_LEN];
+	int nr_fields;
+	struct field fields[MAX_FIELDS];	/* excluding the common_* ones */
+	unsigned long long rows[MAX_CPUS];
+};
+
+/* Per-thread, per-event output */
+struct ev_out {
+	FILE *row;
+	FILE *cols[MAX_FIELDS];
+};
+
+struct part {
+	int cpu;
+	char in[PATH_MAX];
+	unsigned long long rows;
+	unsigned long long pages;
+	unsigned long long missed;	/* events the kernel reported lost */
+	unsigned long long bad;		/* undecodable (unknown ID, bad length) */
+	int err;
+};
+
+static struct event *events[MAX_EVENT_ID];
+static struct part parts[MAX_CPUS];
+static int nr_parts, next_part;
+static pthread_mutex_t part_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char *outdir;
+static long subbuf_sz;
+/* from events/header_page */
+static int hp_ts_off = 0, hp_commit_off = 8, hp_commit_size = 8, hp_data_off = 16;
+/* the common fields; the same layout for every event */
+static struct field f_pid = { "common_pid", FT_INT, 4, 4, 1, "" };
+static struct field f_flags = { "common_flags", FT_INT, 2, 1, 0, "" };
+static struct field f_preempt = { "common_preempt_count", FT_INT, 3, 1, 0, "" };
+
+static void usage(const char *prg)
+{
+	fprintf(stderr,
+		"Usage: %s [-o outdir] [-j threads] <indir>\n"
+		" Decode the raw ftrace pages saved by trc_raw_collect in <indir> into a\n"
+		" columnar store (default: <indir>/cols/)\n"
+		"  -j : max # of decoder threads (default: the # of online CPUs)\n",
+		prg);
+}
+
+static int mkdir_p(const char *path)
+{
+	char tmp[PATH_MAX], *p;
+
+	snprintf(tmp, sizeof(tmp), "%s", path);
+	for (p = tmp + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(tmp, 0755) < 0 && errno != EEXIST)
+			return -1;
+		*p = '/';
+	}
+	if (mkdir(tmp, 0755) < 0 && errno != EEXIST)
+		return -1;
+	return 0;
+}
+
+/* Get the integer following @key (f.e. "offset:") in @line; -1 if absent */
+static long line_val(const char *line, const char *key)
+{
+	const char *p = strstr(line, key);
+
+	return p ? strtol(p + strlen(key), NULL, 10) : -1;
+}
+
+/*
+ * Parse a format file field line:
+ *  field:<type> <name>[<N>];	offset:<o>;	size:<s>;	signed:<0|1>;
+ */
+static int parse_field(const char *line, struct field *f)
+{
+	const char *decl = strstr(line, "field:"), *semi, *p;
+	char buf[256], *name, *br;
+	size_t len;
+
+	if (!decl)
+		return -1;
+	decl += strlen("field:");
+	semi = strchr(decl, ';');
+	if (!semi || (len = semi - decl) >= sizeof(buf))
+		return -1;
+	memcpy(buf, decl, len);
+	buf[len] = '\0';
+
+	name = strrchr(buf, ' ');
+	name = name ? name + 1 : buf;
+	br = strchr(name, '[');
+	if (br)
+		*br = '\0';
+	snprintf(f->name, sizeof(f->name), "%.*s", NAME_LEN - 1, name);
+
+	f->offset = line_val(semi, "offset:");
+	f->size = line_val(semi, "size:");
+	f->is_signed = line_val(semi, "signed:") == 1;
+	if (f->offset < 0 || f->size <= 0)
+		return -1;
+
+	p = buf + strspn(buf, " \t");
+	if (!strncmp(p, "__data_loc", strlen("__data_loc"))) {
+		f->type = FT_DATA_LOC;
+		strcpy(f->ext, "str");
+	} else if (!strncmp(p, "__rel_loc", strlen("__rel_loc"))) {
+		f->type = FT_REL_LOC;
+		strcpy(f->ext, "str");
+	} else if (br) {
+		/* an array: of char, it's a string */
+		if (strstr(p, "char ") == p || strstr(p, "unsigned char ") == p ||
+		    strstr(p, "const char ") == p) {
+			f->type = FT_STR;
+			strcpy(f->ext, "str");
+		} else {
+			f->type = FT_BYTES;
+			snprintf(f->ext, sizeof(f->ext), "b%d", f->size);
+		}
+	} else if (f->size == 1 || f->size == 2 || f->size == 4 || f->size == 8) {
+		f->type = FT_INT;
+		snprintf(f->ext, sizeof(f->ext), "%c%d", f->is_signed ? 'i' : 'u', f->size * 8);
+	} else {
+		f->type = FT_BYTES;
+		snprintf(f->ext, sizeof(f->ext), "b%d", f->size);
+	}
+	return 0;
+}
+
+static int parse_format(const char *path, const char *sys, const char *evname)
+{
+	char line[1024];
+	struct event *ev;
+	struct field f;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	ev = calloc(1, sizeof(*ev));
+	if (!ev) {
+		fclose(fp);
+		return -1;
+	}
+	ev->id = -1;
+	snprintf(ev->sys, sizeof(ev->sys), "%.*s", NAME_LEN - 1, sys);
+	snprintf(ev->name, sizeof(ev->name), "%.*s", NAME_LEN - 1, evname);
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (!strncmp(line, "ID:", 3)) {
+			ev->id = atoi(line + 3);
+			continue;
+		}
+		if (parse_field(line, &f) < 0)
+			continue;
+		if (!strcmp(f.name, "common_pid"))
+			f_pid = f;
+		else if (!strcmp(f.name, "common_flags"))
+			f_flags = f;
+		else if (!strcmp(f.name, "common_preempt_count"))
+			f_preempt = f;
+		else if (!strncmp(f.name, "common_", 7))
+			continue;
+		else if (ev->nr_fields < MAX_FIELDS)
+			ev->fields[ev->nr_fields++] = f;
+	}
+	fclose(fp);
+	if (ev->id < 0 || ev->id >= MAX_EVENT_ID) {
+		free(ev);
+		return -1;
+	}
+	events[ev->id] = ev;
+	return 0;
+}
+
+/* Build the decode table: parse events/header_page and events/<sys>/<event>/format */
+static int load_formats(const char *indir)
+{
+	char path[PATH_MAX], line[512];
+	struct dirent *sd, *ed;
+	DIR *sysdir, *evdir;
+	FILE *fp;
+	int nr = 0;
+
+	snprintf(path, sizeof(path), "%s/events/header_page", indir);
+	fp = fopen(path, "r");
+	if (fp) {
+		while (fgets(line, sizeof(line), fp)) {
+			if (strstr(line, " timestamp;"))
+				hp_ts_off = line_val(line, "offset:");
+			else if (strstr(line, " commit;")) {
+				hp_commit_off = line_val(line, "offset:");
+				hp_commit_size = line_val(line, "size:");
+			} else if (strstr(line, " data;"))
+				hp_data_off = line_val(line, "offset:");
+		}
+		fclose(fp);
+	} else
+		fprintf(stderr, "warning: no %s; assuming the 64-bit page header layout\n", path);
+
+	snprintf(path, sizeof(path), "%s/events", indir);
+	sysdir = opendir(path);
+	if (!sysdir)
+		return -1;
+	while ((sd = readdir(sysdir))) {
+		if (sd->d_name[0] == '.' || sd->d_type != DT_DIR)
+			continue;
+		snprintf(path, sizeof(path), "%s/events/%s", indir, sd->d_name);
+		evdir = opendir(path);
+		if (!evdir)
+			continue;
+		while ((ed = readdir(evdir))) {
+			if (ed->d_name[0] == '.' || ed->d_type != DT_DIR)
+				continue;
+			snprintf(path, sizeof(path), "%s/events/%s/%s/format",
+				 indir, sd->d_name, ed->d_name);
+			if (parse_format(path, sd->d_name, ed->d_name) == 0)
+				nr++;
+		}
+		closedir(evdir);
+	}
+	closedir(sysdir);
+	return nr;
+}
+
+static FILE *col_open(const char *dir, const char *name, const char *ext)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+
+	if (snprintf(path, sizeof(path), "%s/%s.%s", dir, name, ext) >= (int)sizeof(path))
+		return NULL;
+	fp = fopen(path, "w");
+	if (fp)
+		setvbuf(fp, NULL, _IOFBF, COL_BUFSZ);
+	return fp;
+}
+
+static uint64_t rd_uint(const unsigned char *p, int size)
+{
+	uint64_t v = 0;
+
+	memcpy(&v, p, size > 8 ? 8 : size);	/* little-endian host assumed */
+	return v;
+}
+
+/* Write a string, a line per row: escape the '\'s and newlines */
+static void put_str(FILE *fp, const unsigned char *s, size_t max)
+{
+	size_t i;
+
+	for (i = 0; i < max && s[i]; i++) {
+		if (s[i] == '\n')
+			fputs("\\n", fp);
+		else if (s[i] == '\\')
+			fputs("\\\\", fp);
+		else
+			fputc(s[i], fp);
+	}
+	fputc('\n', fp);
+}
+
+/* Decoder state, per thread */
+struct decoder {
+	struct part *part;
+	char dir[PATH_MAX];
+	FILE *c_ts, *c_pid, *c_id, *c_flags, *c_preempt;
+	struct ev_out *out[MAX_EVENT_ID];
+};
+
+/*
+ * The event's output files, created on its first occurrence. All of them or
+ * none: on failure, the error's in the partition's 'err' and we return NULL.
+ */
+static struct ev_out *ev_out_get(struct decoder *d, struct event *ev)
+{
+	char dir[PATH_MAX];
+	struct ev_out *o = d->out[ev->id];
+	const char *what = "row";
+	int i;
+
+	if (o)
+		return o;
+	o = calloc(1, sizeof(*o));
+	if (!o) {
+		d->part->err = ENOMEM;
+		return NULL;
+	}
+	if (snprintf(dir, sizeof(dir), "%s/%s.%s", d->dir, ev->sys, ev->name) >= (int)sizeof(dir)) {
+		errno = ENAMETOOLONG;
+		goto fail;
+	}
+	if (mkdir_p(dir) < 0 || !(o->row = col_open(dir, "row", "u64")))
+		goto fail;
+	for (i = 0; i < ev->nr_fields; i++) {
+		what = ev->fields[i].name;
+		o->cols[i] = col_open(dir, what, ev->fields[i].ext);
+		if (!o->cols[i])
+			goto fail;
+	}
+	d->out[ev->id] = o;
+	return o;
+
+ fail:
+	d->part->err = errno ? errno : EIO;
+	fprintf(stderr, "cpu%d: %s.%s: can't create column '%s': %s%s\n", d->part->cpu,
+		ev->sys, ev->name, what, strerror(d->part->err),
+		d->part->err == EMFILE ? " (try fewer threads, -j)" : "");
+	if (o->row)
+		fclose(o->row);
+	for (i = 0; i < ev->nr_fields; i++)
+		if (o->cols[i])
+			fclose(o->cols[i]);
+	free(o);
+	return NULL;
+}
+
+static void emit_event(struct decoder *d, uint64_t ts, const unsigned char *data, size_t len)
+{
+	struct part *pt = d->part;
+	struct event *ev;
+	struct ev_out *o;
+	uint64_t row;
+	uint32_t loc;
+	uint16_t id;
+	int32_t pid;
+	uint8_t u8;
+	int i;
+
+	if (pt->err)
+		return;
+	if (len < 8) {
+		pt->bad++;
+		return;
+	}
+	id = rd_uint(data, 2);
+	ev = events[id];
+	if (!ev || !(o = ev_out_get(d, ev))) {
+		pt->bad++;
+		return;
+	}
+	row = pt->rows++;
+	ev->rows[pt->cpu]++;
+
+	fwrite(&ts, sizeof(ts), 1, d->c_ts);
+	pid = rd_uint(data + f_pid.offset, f_pid.size);
+	fwrite(&pid, sizeof(pid), 1, d->c_pid);
+	fwrite(&id, sizeof(id), 1, d->c_id);
+	u8 = data[f_flags.offset];
+	fwrite(&u8, 1, 1, d->c_flags);
+	u8 = data[f_preempt.offset];
+	fwrite(&u8, 1, 1, d->c_preempt);
+
+	fwrite(&row, sizeof(row), 1, o->row);
+	for (i = 0; i < ev->nr_fields; i++) {
+		const struct field *f = &ev->fields[i];
+		FILE *fp = o->cols[i];
+		size_t off, l;
+
+		if (f->offset + f->size > (int)len) {
+			/* truncated event: keep the columns aligned regardless */
+			if (f->type == FT_STR || f->type == FT_DATA_LOC || f->type == FT_REL_LOC)
+				fputc('\n', fp);
+			else
+				fwrite("\0\0\0\0\0\0\0\0", 1, f->size < 8 ? f->size : 8, fp);
+			continue;
+		}
+		switch (f->type) {
+		case FT_INT:
+		case FT_BYTES:
+			fwrite(data + f->offset, f->size, 1, fp);
+			break;
+		case FT_STR:
+			put_str(fp, data + f->offset, f->size);
+			break;
+		case FT_DATA_LOC:
+		case FT_REL_LOC:
+			loc = rd_uint(data + f->offset, 4);
+			off = loc & 0xffff;
+			l = loc >> 16;
+			if (f->type == FT_REL_LOC)
+				off += f->offset + f->size;
+			if (off + l > len)
+				l = off < len ? len - off : 0;
+			put_str(fp, data + off, l);
+			break;
+		}
+	}
+}
+
+/* Decode one ring buffer page (sub-buffer) */
+static void decode_page(struct decoder *d, const unsigned char *page)
+{
+	const unsigned char *p, *end;
+	uint64_t ts, commit, ext;
+	uint32_t hdr, type_len, delta, len;
+
+	ts = rd_uint(page + hp_ts_off, 8);
+	commit = rd_uint(page + hp_commit_off, hp_commit_size);
+	if (commit & RB_MISSED_EVENTS)
+		d->part->missed++;	/* at least one; the exact # may follow */
+	len = commit & RB_COMMIT_MASK;
+	if (hp_data_off + len > subbuf_sz)
+		len = subbuf_sz - hp_data_off;
+	p = page + hp_data_off;
+	end = p + len;
+	if ((commit & RB_MISSED_STORED) && end + hp_commit_size <= page + subbuf_sz)
+		d->part->missed += rd_uint(end, hp_commit_size) - 1;
+
+	while (p + 4 <= end) {
+		hdr = rd_uint(p, 4);
+		type_len = hdr & 0x1f;
+		delta = hdr >> 5;
+		p += 4;
+
+		switch (type_len) {
+		case RB_TYPE_PADDING:
+			if (!delta || p + 4 > end)	/* the rest of the page is empty */
+				return;
+			p += rd_uint(p, 4);	/* a discarded event */
+			break;
+		case RB_TYPE_TIME_EXTEND:
+			if (p + 4 > end)
+				return;
+			ext = rd_uint(p, 4);
+			ts += (ext << RB_TS_SHIFT) + delta;
+			p += 4;
+			break;
+		case RB_TYPE_TIME_STAMP:
+			if (p + 4 > end)
+				return;
+			ext = rd_uint(p, 4);
+			ts = (ts & RB_TS_MSB_MASK) | (ext << RB_TS_SHIFT) | delta;
+			p += 4;
+			break;
+		case 0:
+			if (p + 4 > end)
+				return;
+			len = rd_uint(p, 4);
+			if (len < 4)
+				return;
+			len -= 4;
+			p += 4;
+			ts += delta;
+			if (p + len > end) {
+				d->part->bad++;
+				return;
+			}
+			emit_event(d, ts, p, len);
+			p += (len + 3) & ~3U;
+			break;
+		default:
+			len = type_len * 4;
+			ts += delta;
+			if (p + len > end) {
+				d->part->bad++;
+				return;
+			}
+			emit_event(d, ts, p, len);
+			p += len;
+			break;
+		}
+	}
+}
+
+static void decode_part(struct part *pt)
+{
+	struct decoder *d;
+	unsigned char *map;
+	struct stat st;
+	char cdir[PATH_MAX];
+	off_t off;
+	int fd = -1, i;
+
+	d = calloc(1, sizeof(*d));
+	if (!d) {
+		pt->err = ENOMEM;
+		return;
+	}
+	d->part = pt;
+	snprintf(d->dir, sizeof(d->dir), "%s/cpu%d", outdir, pt->cpu);
+	if (snprintf(cdir, sizeof(cdir), "%s/common", d->dir) >= (int)sizeof(cdir)) {
+		pt->err = ENAMETOOLONG;
+		goto out;
+	}
+	fd = open(pt->in, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0 || mkdir_p(cdir) < 0) {
+		pt->err = errno;
+		goto out;
+	}
+	d->c_ts = col_open(cdir, "ts", "u64");
+	d->c_pid = col_open(cdir, "pid", "i32");
+	d->c_id = col_open(cdir, "id", "u16");
+	d->c_flags = col_open(cdir, "flags", "u8");
+	d->c_preempt = col_open(cdir, "preempt", "u8");
+	if (!d->c_ts || !d->c_pid || !d->c_id || !d->c_flags || !d->c_preempt) {
+		pt->err = errno;
+		goto out;
+	}
+	if (st.st_size >= subbuf_sz) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			pt->err = errno;
+			goto out;
+		}
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+		for (off = 0; off + subbuf_sz <= st.st_size && !pt->err; off += subbuf_sz) {
+			decode_page(d, map + off);
+			pt->pages++;
+		}
+		munmap(map, st.st_size);
+	}
+ out:
+	if (fd >= 0)
+		close(fd);
+	if (d->c_ts)
+		fclose(d->c_ts);
+	if (d->c_pid)
+		fclose(d->c_pid);
+	if (d->c_id)
+		fclose(d->c_id);
+	if (d->c_flags)
+		fclose(d->c_flags);
+	if (d->c_preempt)
+		fclose(d->c_preempt);
+	for (i = 0; i < MAX_EVENT_ID; i++) {
+		struct ev_out *o = d->out[i];
+		int j;
+
+		if (!o)
+			continue;
+		fclose(o->row);
+		for (j = 0; j < MAX_FIELDS; j++)
+			if (o->cols[j])
+				fclose(o->cols[j]);
+		free(o);
+	}
+	free(d);
+}
+
+static void *decoder_thread(void *arg)
+{
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&part_lock);
+		i = next_part++;
+		pthread_mutex_unlock(&part_lock);
+		if (i >= nr_parts)
+			break;
+		decode_part(&parts[i]);
+	}
+	return NULL;
+}
+
+/* Get 'subbuf_size' from the collector's info file; else assume a page */
+static void read_info(const char *indir)
+{
+	char path[PATH_MAX], line[256];
+	FILE *fp;
+
+	subbuf_sz = sysconf(_SC_PAGESIZE);
+	snprintf(path, sizeof(path), "%s/info", indir);
+	fp = fopen(path, "r");
+	if (!fp)
+		return;
+	while (fgets(line, sizeof(line), fp))
+		if (!strncmp(line, "subbuf_size ", 12) && atol(line + 12) > 0)
+			subbuf_sz = atol(line + 12);
+	fclose(fp);
+}
+
+static void write_schema(void)
+{
+	char path[PATH_MAX];
+	unsigned long long n;
+	FILE *fp;
+	int id, i;
+
+	snprintf(path, sizeof(path), "%s/schema", outdir);
+	fp = fopen(path, "w");
+	if (!fp) {
+		perror("fopen schema");
+		return;
+	}
+	fprintf(fp, "# common: ts u64, pid i32, id u16, flags u8, preempt u8\n");
+	for (id = 0; id < MAX_EVENT_ID; id++) {
+		struct event *ev = events[id];
+
+		if (!ev)
+			continue;
+		for (n = 0, i = 0; i < nr_parts; i++)
+			n += ev->rows[parts[i].cpu];
+		if (!n)
+			continue;
+		fprintf(fp, "%s.%s id %d rows %llu\n", ev->sys, ev->name, ev->id, n);
+		fprintf(fp, "  row u64\n");
+		for (i = 0; i < ev->nr_fields; i++)
+			fprintf(fp, "  %s %s\n", ev->fields[i].name, ev->fields[i].ext);
+	}
+	fclose(fp);
+}
+
+int main(int argc, char **argv)
+{
+	char path[PATH_MAX], def_out[PATH_MAX];
+	unsigned long long rows = 0, missed = 0, bad = 0;
+	int opt, nthreads = 0, nr_fmt, cpu, i, nr_err = 0;
+	struct rlimit rl;
+	pthread_t *threads;
+	const char *indir;
+
+	while ((opt = getopt(argc, argv, "o:j:h")) != -1) {
+		switch (opt) {
+		case 'o':
+			outdir = optarg;
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	indir = argv[optind];
+	if (!outdir) {
+		snprintf(def_out, sizeof(def_out), "%s/cols", indir);
+		outdir = def_out;
+	}
+
+	read_info(indir);
+	nr_fmt = load_formats(indir);
+	if (nr_fmt <= 0) {
+		fprintf(stderr, "%s: no event formats under %s/events (not a trc_raw_collect dir?)\n",
+			argv[0], indir);
+		exit(EXIT_FAILURE);
+	}
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		snprintf(path, sizeof(path), "%s/cpu%d.raw", indir, cpu);
+		if (access(path, R_OK) < 0)
+			continue;
+		parts[nr_parts].cpu = cpu;
+		snprintf(parts[nr_parts].in, sizeof(parts[nr_parts].in), "%s", path);
+		nr_parts++;
+	}
+	if (!nr_parts) {
+		fprintf(stderr, "%s: no cpuN.raw files in %s\n", argv[0], indir);
+		exit(EXIT_FAILURE);
+	}
+	if (mkdir_p(outdir) < 0) {
+		fprintf(stderr, "%s: mkdir %s: %s\n", argv[0], outdir, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	/* the column files: every thread has a set open per event type */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > nr_parts)
+		nthreads = nr_parts;
+	printf("%s: %d event formats, %d CPU file(s), %ld byte pages, %d thread(s)\n",
+	       argv[0], nr_fmt, nr_parts, subbuf_sz, nthreads);
+
+	threads = calloc(nthreads, sizeof(*threads));
+	if (!threads)
+		exit(EXIT_FAILURE);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, decoder_thread, NULL)) {
+			fprintf(stderr, "%s: pthread_create failed\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	write_schema();
+
+	printf("%5s %9s %12s %9s %9s\n", "cpu", "pages", "events", "missed", "bad");
+	for (i = 0; i < nr_parts; i++) {
+		struct part *pt = &parts[i];
+
+		printf("%5d %9llu %12llu %9llu %9llu%s%s\n", pt->cpu, pt->pages, pt->rows,
+		       pt->missed, pt->bad, pt->err ? "  error: " : "",
+		       pt->err ? strerror(pt->err) : "");
+		rows += pt->rows;
+		missed += pt->missed;
+		bad += pt->bad;
+		if (pt->err)
+			nr_err++;
+	}
+	printf("total: %llu events (%llu missed, %llu undecodable); output in %s/\n",
+	       rows, missed, bad, outdir);
+	if (nr_err) {
+		fflush(stdout);
+		fprintf(stderr, "%s: %d CPU(s) failed to decode fully; their columns are INCOMPLETE\n",
+			argv[0], nr_err);
+		exit(EXIT_FAILURE);
+	}
+	exit(EXIT_SUCCESS);
+}
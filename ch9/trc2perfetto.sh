@@ -0,0 +1,309 @@
+#!/bin/bash
+# ch9/trc2perfetto.sh
+# ***************************************************************
+# This program is part of the source code released for the book
+#  "Linux Kernel Debugging"
+#  (c) Author: Kaiwan N Billimoria
+#  Publisher:  Packt
+#  GitHub repository:
+#  https://github.com/PacktPublishing/Linux-Kernel-Debugging
+#
+# From: Ch 9: Tracing the kernel flow
+#***************************************************************
+# Brief Description:
+# One converter for the captures our Ch 9 scripts make, to the Chrome
+# JSON trace event format - which the Perfetto UI (https://ui.perfetto.dev)
+# and chrome://tracing open directly. Input (auto-detected, line by line):
+#  - ftrace function_graph reports, with the funcgraph-abstime option on
+#    (ftrace/ping_ftrace.sh, ftrace/ftrc_1s.sh);
+#  - ftrace / trace-cmd event reports: 'comm-pid [cpu] ... ts: event: ...'
+#    lines (tracecmd/trccmd_1ping.sh, tracecmd/trc-cmd2-mod.sh; function_graph
+#    via trace-cmd too); a trace-cmd .dat file is run through
+#    'trace-cmd report' for you;
+#  - LTTng traces (lttng/lttng_trc.sh): pass the trace directory and we run
+#    it through babeltrace2 (or babeltrace); or pass that tool's text output
+#    (made with --clock-seconds).
+# Mapping:
+#  - every CPU is a track group ('process' CPU N); within it, a track per
+#    task;
+#  - function_graph entry/exit -> slices (B/E events; leaf calls -> complete,
+#    X, events);
+#  - LTTng syscall_entry_* / syscall_exit_* -> slices, on the task current on
+#    that CPU (tracked via sched_switch);
+#  - every other tracepoint -> an instant event, its fields as args.
+# Streaming: input is read once, output written as it's produced; the only
+# state kept is a call depth per CPU and task and the names of the tasks
+# seen - so multi-GB inputs run in bounded memory.
+#
+# For details, please refer the book, Ch 9.
+#------------------------------------------------------------------------------
+name=$(basename $0)
+
+die()
+{
+ echo "${name}: $@" 1>&2
+ exit 1
+}
+
+usage()
+{
+ echo "Usage: ${name} [-o output.json] [-z] input ...
+ Convert ftrace / trace-cmd / LTTng captures to a Chrome JSON trace (for the
+ Perfetto UI). An input is a text report, a trace-cmd .dat file or an LTTng
+ trace directory; '-' is stdin.
+  -o : the output file (default: trace.json; '-' for stdout)
+  -z : gzip the output (the Perfetto UI opens .json.gz as is)
+  -h : this help"
+}
+
+OUT=trace.json
+GZIP=0
+
+while getopts "o:zh" opt; do
+  case "${opt}" in
+    o) OUT=${OPTARG} ;;
+    z) GZIP=1 ;;
+    h) usage ; exit 0 ;;
+    *) usage ; exit 1 ;;
+  esac
+done
+shift $((OPTIND-1))
+[ $# -eq 0 ] && { usage ; exit 1 ; }
+[ ${GZIP} -eq 1 -a "${OUT}" != "-" ] && OUT=${OUT%.gz}.gz
+
+TMP=$(mktemp -d /tmp/${name}.XXXXXX) || die "mktemp failed"
+trap 'rm -rf ${TMP}' EXIT
+
+cat > ${TMP}/conv.awk << 'EOF'
+function jstr(s) {
+	gsub(/\\/, "&&", s)
+	gsub(/"/, "\\\"", s)
+	gsub(/\t/, " ", s)
+	return "\"" s "\""
+}
+# "12345.678901234" seconds -> us, relative to the first timestamp seen
+# (done on the string: doubles can't hold epoch ns)
+function ts_us(s,    dot, sec, frac) {
+	dot = index(s, ".")
+	sec = dot ? substr(s, 1, dot - 1) : s
+	frac = dot ? substr(s, dot + 1) : ""
+	if (base == "")
+		base = sec
+	frac = substr(frac "000000000", 1, 9)
+	return sprintf("%.3f", (sec - base) * 1000000 + frac / 1000)
+}
+# LTTng's default 'HH:MM:SS.nnnnnnnnn' -> seconds
+function hms2s(s,    a) {
+	if (s !~ /:/)
+		return s
+	split(s, a, ":")
+	return sprintf("%d.%s", a[1] * 3600 + a[2] * 60 + int(a[3]), substr(a[3], index(a[3], ".") + 1))
+}
+function emit(json) {
+	printf "%s%s\n", (nev++ ? "," : ""), json
+}
+# The track (CPU 'process', task 'thread') metadata, once each
+function track(cpu, tid, comm) {
+	if (!(cpu in cpu_seen)) {
+		cpu_seen[cpu] = 1
+		emit("{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" cpu ",\"args\":{\"name\":\"CPU " cpu "\"}}")
+		emit("{\"ph\":\"M\",\"name\":\"process_sort_index\",\"pid\":" cpu ",\"args\":{\"sort_index\":" cpu "}}")
+	}
+	if (comm != "" && thr_name[cpu, tid] != comm) {
+		thr_name[cpu, tid] = comm
+		emit("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" cpu ",\"tid\":" tid ",\"args\":{\"name\":" jstr(comm "-" tid) "}}")
+	}
+}
+function ev_common(ph, nm, ts, cpu, tid) {
+	return "{\"ph\":\"" ph "\",\"name\":" jstr(nm) ",\"ts\":" ts ",\"pid\":" cpu ",\"tid\":" tid
+}
+function instant(nm, ts, cpu, tid, info) {
+	emit(ev_common("i", nm, ts, cpu, tid) ",\"s\":\"t\",\"args\":{\"info\":" jstr(info) "}}")
+	ninst++
+}
+# A function_graph line's function text and duration (us): entry / leaf / exit
+function fgraph(fn, dur, ts, cpu, tid,    k, f, start) {
+	sub(/^ +/, "", fn)
+	sub(/ +$/, "", fn)
+	k = cpu SUBSEP tid
+	if (fn ~ /\(\) \{$/) {
+		emit(ev_common("B", substr(fn, 1, length(fn) - 4), ts, cpu, tid) "}")
+		depth[k]++
+		nslice++
+	} else if (fn ~ /\(\);$/) {
+		if (dur == "")
+			dur = 0
+		emit(ev_common("X", substr(fn, 1, length(fn) - 3), ts, cpu, tid) ",\"dur\":" dur "}")
+		nslice++
+	} else if (fn ~ /^\}/) {
+		if (depth[k] > 0) {
+			emit(ev_common("E", "", ts, cpu, tid) "}")
+			depth[k]--
+		} else if (dur != "") {
+			# it began before the trace did: we know its start from its duration
+			f = "?"
+			if (match(fn, /\/\* .* \*\//))
+				f = substr(fn, RSTART + 3, RLENGTH - 6)
+			start = sprintf("%.3f", ts - dur)
+			emit(ev_common("X", f, start, cpu, tid) ",\"dur\":" dur "}")
+			nslice++
+		}
+	} else if (fn ~ /^\/\*/) {
+		sub(/^\/\* */, "", fn)
+		sub(/ *\*\/$/, "", fn)
+		f = fn
+		sub(/[(: ].*/, "", f)
+		instant(f, ts, cpu, tid, fn)
+	}
+}
+function duration(s) {
+	return match(s, /[0-9]+(\.[0-9]+)? us/) ? substr(s, RSTART, RLENGTH - 3) + 0 : ""
+}
+function comm_of(task) {
+	sub(/-[0-9]+$/, "", task)
+	return task
+}
+function tid_of(task) {
+	return match(task, /-[0-9]+$/) ? substr(task, RSTART + 1) + 0 : 0
+}
+BEGIN {
+	printf "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+}
+/^#/ || /^ *$/ {
+	next
+}
+# LTTng (babeltrace) text:
+#  [ts] (+delta) host event: { cpu_id = N }, { ctx }, { field = val, ... }
+/^\[[0-9:.]+\] \(/ {
+	if (!match($0, /^\[[0-9:.]+\]/))
+		next
+	ts = ts_us(hms2s(substr($0, 2, RLENGTH - 2)))
+	rest = substr($0, RLENGTH + 1)
+	if (!match(rest, / [A-Za-z0-9_:]+: \{/))
+		next
+	ev = substr(rest, RSTART + 1, RLENGTH - 4)
+	rest = substr(rest, RSTART + RLENGTH - 1)
+	cpu = match(rest, /cpu_id = [0-9]+/) ? substr(rest, RSTART + 9, RLENGTH - 9) + 0 : 0
+	tid = cur_tid[cpu] + 0
+	if (match(rest, /[{ ]tid = [0-9]+/))
+		tid = substr(rest, RSTART + 7, RLENGTH - 7) + 0
+	comm = (cpu SUBSEP tid) in thr_name ? thr_name[cpu, tid] : ""
+	if (match(rest, /procname = "[^"]*"/))
+		comm = substr(rest, RSTART + 12, RLENGTH - 13)
+	if (ev == "sched_switch" && match(rest, /next_tid = [0-9]+/)) {
+		tid = cur_tid[cpu] = substr(rest, RSTART + 11, RLENGTH - 11) + 0
+		if (match(rest, /next_comm = "[^"]*"/))
+			comm = substr(rest, RSTART + 13, RLENGTH - 14)
+	}
+	track(cpu, tid, comm)
+	k = cpu SUBSEP tid
+	if (ev ~ /^syscall_entry_/) {
+		emit(ev_common("B", substr(ev, 15), ts, cpu, tid) ",\"args\":{\"info\":" jstr(rest) "}}")
+		depth[k]++
+		nslice++
+	} else if (ev ~ /^syscall_exit_/) {
+		if (depth[k] > 0) {
+			emit(ev_common("E", "", ts, cpu, tid) ",\"args\":{\"info\":" jstr(rest) "}}")
+			depth[k]--
+		}
+	} else
+		instant(ev, ts, cpu, tid, rest)
+	next
+}
+# ftrace / trace-cmd event lines:
+#  comm-pid [cpu] flags ts: event: ...   (or, latency format: comm-pid cpu+flags ts: ...)
+match($0, /[0-9]+\.[0-9]+: [A-Za-z0-9_]+:/) {
+	pre = substr($0, 1, RSTART - 1)
+	hit = substr($0, RSTART, RLENGTH)
+	rest = substr($0, RSTART + RLENGTH)
+	ts = ts_us(substr(hit, 1, index(hit, ":") - 1))
+	ev = substr(hit, index(hit, ":") + 2)
+	sub(/:$/, "", ev)
+	cpu = 0
+	if (match(pre, /\[[0-9]+\]/))
+		cpu = substr(pre, RSTART + 1, RLENGTH - 2) + 0
+	else if (match(pre, / [0-9]+[^ ]* +$/))
+		cpu = substr(pre, RSTART + 1) + 0
+	task = match(pre, /[^ ]+-[0-9]+/) ? substr(pre, RSTART, RLENGTH) : "?-0"
+	tid = tid_of(task)
+	track(cpu, tid, comm_of(task))
+	if (ev == "funcgraph_entry" || ev == "funcgraph_exit") {
+		n = split(rest, f, "|")
+		fgraph(f[n], n > 1 ? duration(f[n - 1]) : "", ts, cpu, tid)
+	} else {
+		sub(/^ +/, "", rest)
+		instant(ev, ts, cpu, tid, rest)
+	}
+	next
+}
+# ftrace function_graph (needs the abstime column):
+#  ts | cpu) task | flags | duration | function
+/\|/ {
+	n = split($0, f, "|")
+	if (n < 3 || f[1] !~ /^ *[0-9]+\.[0-9]+ *$/) {
+		if (n >= 3 && f[1] ~ /[0-9]+\)/)
+			noabs++
+		next
+	}
+	pre = f[2]
+	for (i = 3; i < n; i++)
+		pre = pre "|" f[i]
+	if (!match(pre, /[0-9]+\)/))
+		next
+	cpu = substr(pre, RSTART, RLENGTH - 1) + 0
+	r = substr(pre, RSTART + RLENGTH)
+	task = match(r, /[^ |]+-[0-9]+/) ? substr(r, RSTART, RLENGTH) : "?-0"
+	tid = tid_of(task)
+	track(cpu, tid, comm_of(task))
+	t = f[1]
+	gsub(/ /, "", t)
+	ts = ts_us(t)
+	fgraph(f[n], duration(f[n - 1]), ts, cpu, tid)
+	next
+}
+END {
+	printf "]}\n"
+	printf "%d events: %d slices, %d instants\n", nev, nslice, ninst > "/dev/stderr"
+	if (noabs)
+		printf "warning: %d function_graph lines skipped: no timestamps (turn options/funcgraph-abstime on)\n", noabs > "/dev/stderr"
+}
+EOF
+
+# Turn an input into text on stdout
+feed()
+{
+ local in=$1
+ if [ "${in}" = "-" ] ; then
+   cat
+ elif [ -d "${in}" ] ; then   # LTTng (CTF) trace dir
+   if which babeltrace2 >/dev/null 2>&1 ; then
+     babeltrace2 --clock-seconds "${in}"
+   elif which babeltrace >/dev/null 2>&1 ; then
+     babeltrace --clock-seconds "${in}"
+   else
+     die "${in}: need babeltrace2 (or babeltrace) to read an LTTng trace"
+   fi
+ elif [ "$(head -c 10 "${in}" | tail -c 7)" = "tracing" ] ; then   # trace-cmd .dat
+   which trace-cmd >/dev/null 2>&1 || die "${in}: need trace-cmd to read a .dat file"
+   trace-cmd report -i "${in}"
+ else
+   cat "${in}"
+ fi
+}
+
+for in in "$@" ; do
+  [ "${in}" = "-" -o -e "${in}" ] || die "${in}: no such file or directory"
+done
+{
+ for in in "$@" ; do
+   feed "${in}"
+ done
+} | awk -f ${TMP}/conv.awk | {
+ if [ "${OUT}" = "-" ] ; then
+   [ ${GZIP} -eq 1 ] && gzip -c || cat
+ else
+   [ ${GZIP} -eq 1 ] && gzip -c > ${OUT} || cat > ${OUT}
+ fi
+} || die "conversion failed"
+[ "${OUT}" != "-" ] && ls -lh ${OUT}
+exit 0
@@ -226,6 +226,57 @@ if (!(expr)) {                                                           \
 } while (0)
 #endif
 
+/*------------------------ spin_ns / spin_us / spin_ms ------------------
+ * Busy-wait - never yielding the CPU - for (precisely) the given duration.
+ * Unlike counting loop iterations, whose duration varies wildly across CPUs,
+ * compilers and optimization levels, we spin on a clock. Both clocks used are
+ * driven by the clocksource (typically the TSC) that the kernel calibrates at
+ * boot, so the durations hold on every machine:
+ *  kernel : ktime_get_mono_fast_ns(); NMI-safe, fine with IRQs off
+ *  user   : clock_gettime(CLOCK_MONOTONIC); a vDSO call, no syscall
+ * The loop body is cpu_relax() (PAUSE/YIELD), to be kind to SMT siblings.
+ * In the kernel, remember: spinning with preemption or IRQs disabled for long
+ * *will* trip the lockup detectors (which is sometimes exactly the point).
+ */
+#ifdef __KERNEL__
+#include <linux/timekeeping.h>
+#include <asm/processor.h>	/* cpu_relax() */
+static inline u64 lkd_now_ns(void)
+{
+	return ktime_get_mono_fast_ns();
+}
+#define lkd_cpu_relax()  cpu_relax()
+#else
+#include <time.h>
+static inline unsigned long long lkd_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+static inline void lkd_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	asm volatile ("yield" ::: "memory");
+#else
+	asm volatile ("" ::: "memory");
+#endif
+}
+#endif
+
+static inline void spin_ns(unsigned long long ns)
+{
+	unsigned long long end = lkd_now_ns() + ns;
+
+	while (lkd_now_ns() < end)
+		lkd_cpu_relax();
+}
+#define spin_us(us)	spin_ns((unsigned long long)(us) * 1000ULL)
+#define spin_ms(ms)	spin_ns((unsigned long long)(ms) * 1000000ULL)
+
 /*------------------------ DELAY_LOOP --------------------------------*/
 static inline void beep(int what)
 {
@@ -242,23 +293,23 @@ static inline void beep(int what)
  * DELAY_LOOP macro
  * (Mostly) mindlessly loop, then print a char (via our beep() routine,
  * to emulate 'work' :-)
+ * Each iteration now spins for DELAY_LOOP_MS milliseconds (via spin_ms())
+ * instead of an uncalibrated inner loop count, so the total runtime is
+ * (roughly) loop_count * DELAY_LOOP_MS ms on any machine.
  * @val        : ASCII value to print
  * @loop_count : times to loop around
  */
+#ifndef DELAY_LOOP_MS
+#define DELAY_LOOP_MS	10
+#endif
 #define DELAY_LOOP(val, loop_count)                                        \
 {                                                                          \
-	int c = 0, m;                                                          \
-	unsigned int for_index, inner_index, x;                                \
+	unsigned int for_index;                                                \
 																			\
 	for (for_index = 0; for_index < loop_count; for_index++) {             \
 		beep((val));                                                       \
-		c++;                                                               \
-		for (inner_index = 0; inner_index < HZ; inner_index++) {           \
-			for (m = 0; m < 50; m++);                                      \
-			x = inner_index / 2;                                           \
-		}                                                                  \
+		spin_ms(DELAY_LOOP_MS);                                            \
 	}                                                                      \
-	/*printf("c=%d\n",c);*/                                                \
 }
 /*------------------------------------------------------------------------*/
 